@@ -0,0 +1,1121 @@
+#define _DEFAULT_SOURCE
+
+#include "../src/cpu.c"
+#include "../src/6502_memory.c"
+#include "../src/opcodes.c"
+#include "../src/block_cache.c"
+#include "../src/jit.c"
+#include "../src/snapshot.c"
+#include "../src/batch.c"
+#include "../src/farm.c"
+#include "../src/cpu_pool.c"
+#include "../src/loader.c"
+#include "../src/scheduler.c"
+#include "../src/trace.c"
+#include "../src/trace_sink.c"
+#include "../src/profile.c"
+#include "../src/sampler.c"
+#include "../src/instruction.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+
+#define BENCH_MEMORY_SIZE (64 * 1024)
+#define BENCH_CYCLES 200000000
+
+/*
+    A 16 byte mix of every addressing mode. 65536 is a multiple of 16, so the program counter
+    wraps back onto an instruction boundary and the stream never ends.
+*/
+static const Byte LOAD_MIX[] = {
+    LDA_IMM, 0x42,
+    LDX_ZERO, 0x10,
+    LDY_ABS, 0x00, 0x02,
+    LDA_ABS_X, 0xF0, 0x03,
+    LDA_ZERO_X, 0x20,
+    LDX_IMM, 0x80,
+    LDA_IND_Y, 0x30
+};
+
+#define LOOP_ORIGIN 0x0200
+#define LOOP_REPEATS 4
+
+static double now_in_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill_with_pattern(CPU* cpu, const Byte* pattern, size_t length) {
+    for(size_t i = 0; i < BENCH_MEMORY_SIZE; i++) {
+        cpu->memory.data[i] = pattern[i % length];
+    }
+}
+
+// LOAD_MIX repeated LOOP_REPEATS times at LOOP_ORIGIN, closed by JMP LOOP_ORIGIN
+static void load_loop(CPU* cpu) {
+    Word address = LOOP_ORIGIN;
+    for(int i = 0; i < LOOP_REPEATS; i++) {
+        memcpy(&cpu->memory.data[address], LOAD_MIX, sizeof(LOAD_MIX));
+        address += sizeof(LOAD_MIX);
+    }
+    cpu->memory.data[address] = JMP_ABS;
+    cpu->memory.data[address + 1] = LOOP_ORIGIN & 0xFF;
+    cpu->memory.data[address + 2] = LOOP_ORIGIN >> 8;
+    cpu->program_counter = LOOP_ORIGIN;
+}
+
+static void bench_dispatch(void) {
+    CPU* cpu = cpu_create(BENCH_MEMORY_SIZE);
+    cpu_reset(cpu);
+    fill_with_pattern(cpu, LOAD_MIX, sizeof(LOAD_MIX));
+
+    double start = now_in_seconds();
+    long long cycles = 0;
+    while(cycles < BENCH_CYCLES) {
+        cycles += cpu_run(cpu, 1000000);
+    }
+    double elapsed = now_in_seconds() - start;
+
+    printf("dispatch %-9s %lld cycles in %.3fs (%.1f emulated MHz)\n",
+            cpu_dispatch_name(), cycles, elapsed, cycles / elapsed / 1e6);
+    cpu_destroy(cpu);
+}
+
+#define BUS_READS 400000000
+
+// Reads BUS_READS pseudo-random addresses straight from data and through memory_read
+static void bench_memory_bus(void) {
+    CPU* cpu = cpu_create(BENCH_MEMORY_SIZE);
+    cpu_reset(cpu);
+    fill_with_pattern(cpu, LOAD_MIX, sizeof(LOAD_MIX));
+    Byte* data = cpu->memory.data;
+
+    unsigned int sum = 0;
+    Word address = 0;
+    double start = now_in_seconds();
+    for(long i = 0; i < BUS_READS; i++) {
+        sum += data[address];
+        address = address * 25173 + 13849;
+    }
+    double raw = now_in_seconds() - start;
+
+    Word bus_address = 0;
+    unsigned int bus_sum = 0;
+    start = now_in_seconds();
+    for(long i = 0; i < BUS_READS; i++) {
+        bus_sum += memory_read(&cpu->memory, bus_address);
+        bus_address = bus_address * 25173 + 13849;
+    }
+    double bus = now_in_seconds() - start;
+
+    printf("memory bus %d reads: raw array %.3fs, memory_read %.3fs (%.2fx)%s\n",
+            BUS_READS, raw, bus, raw / bus, sum == bus_sum ? "" : " MISMATCH");
+    cpu_destroy(cpu);
+}
+
+#define FLAG_UPDATES 400000000
+
+// The status register as it was before it was packed: one bitfield per flag, set by branches
+typedef struct BitfieldFlags {
+    bool carry: 1;
+    bool zero: 1;
+    bool interrupt_disable: 1;
+    bool decimal_mode: 1;
+    bool break_command: 1;
+    bool overflow: 1;
+    bool negative: 1;
+} BitfieldFlags;
+
+static void bitfield_set_nz(BitfieldFlags* flags, Byte value) {
+    if(value == 0) {
+        flags->zero = true;
+    } else {
+        flags->zero = false;
+    }
+    if((s8)value < 0) {
+        flags->negative = true;
+    } else {
+        flags->negative = false;
+    }
+}
+
+// Sets N and Z from a stream of loaded bytes, then packs them the way PHP pushes them
+static void bench_flags(void) {
+    BitfieldFlags bitfield = { 0 };
+    unsigned int bitfield_sum = 0;
+    Byte value = 0;
+    double start = now_in_seconds();
+    for(long i = 0; i < FLAG_UPDATES; i++) {
+        bitfield_set_nz(&bitfield, value);
+        bitfield_sum += bitfield.negative << 7 | bitfield.zero << 1;
+        value = value * 77 + 13;
+    }
+    double unpacked = now_in_seconds() - start;
+
+    Flags packed;
+    flags_reset(&packed);
+    unsigned int packed_sum = 0;
+    value = 0;
+    start = now_in_seconds();
+    for(long i = 0; i < FLAG_UPDATES; i++) {
+        flags_set_nz(&packed, value);
+        packed_sum += flags_to_byte(&packed, false) & (FLAG_NEGATIVE | FLAG_ZERO);
+        value = value * 77 + 13;
+    }
+    double table = now_in_seconds() - start;
+
+    printf("flags %d N/Z updates: bitfields %.3fs, packed table %.3fs (%.2fx)%s\n",
+            FLAG_UPDATES, unpacked, table, unpacked / table, bitfield_sum == packed_sum ? "" : " MISMATCH");
+}
+
+#define RESETS 200000
+
+// Reset latency of the old byte loop against cpu_reset, with touched pages written between resets
+static void bench_reset(int touched) {
+    CPU* cpu = cpu_create(BENCH_MEMORY_SIZE);
+    cpu_reset(cpu);
+
+    double start = now_in_seconds();
+    for(int i = 0; i < RESETS; i++) {
+        for(int page = 0; page < touched; page++) {
+            cpu_write_byte(cpu, page << 8 | (i & 0xFF), i);
+        }
+        for(int j = 0; j < cpu->memory.SIZE_IN_BYTES; j++) {
+            cpu->memory.data[j] = 0;
+        }
+        // Keeps the stores above from being merged across iterations
+        __asm__ volatile("" ::: "memory");
+    }
+    double loop = now_in_seconds() - start;
+    cpu_reset(cpu);
+
+    start = now_in_seconds();
+    for(int i = 0; i < RESETS; i++) {
+        for(int page = 0; page < touched; page++) {
+            cpu_write_byte(cpu, page << 8 | (i & 0xFF), i);
+        }
+        cpu_reset(cpu);
+    }
+    double dirty = now_in_seconds() - start;
+
+    printf("reset %3d of %d pages touched: byte loop %.0fns, cpu_reset %.0fns (%.2fx)\n",
+            touched, BENCH_MEMORY_SIZE / 256, loop / RESETS * 1e9, dirty / RESETS * 1e9, loop / dirty);
+    cpu_destroy(cpu);
+}
+
+// Rollback latency of copying the whole array back against snapshot_restore
+static void bench_snapshot(int touched) {
+    CPU* cpu = cpu_create(BENCH_MEMORY_SIZE);
+    cpu_reset(cpu);
+    fill_with_pattern(cpu, LOAD_MIX, sizeof(LOAD_MIX));
+    memory_mark_dirty(&cpu->memory, 0, BENCH_MEMORY_SIZE);
+    Snapshot* snapshot = snapshot_create();
+    snapshot_take(snapshot, cpu);
+    Byte* copy = malloc(BENCH_MEMORY_SIZE);
+    memcpy(copy, cpu->memory.data, BENCH_MEMORY_SIZE);
+
+    double start = now_in_seconds();
+    for(int i = 0; i < RESETS; i++) {
+        for(int page = 0; page < touched; page++) {
+            cpu_write_byte(cpu, page << 8 | (i & 0xFF), i);
+        }
+        memcpy(cpu->memory.data, copy, BENCH_MEMORY_SIZE);
+        __asm__ volatile("" ::: "memory");
+    }
+    double full = now_in_seconds() - start;
+
+    start = now_in_seconds();
+    for(int i = 0; i < RESETS; i++) {
+        for(int page = 0; page < touched; page++) {
+            cpu_write_byte(cpu, page << 8 | (i & 0xFF), i);
+        }
+        snapshot_restore(snapshot, cpu);
+    }
+    double incremental = now_in_seconds() - start;
+
+    printf("restore %3d of %d pages touched: full copy %.0fns, snapshot_restore %.0fns (%.2fx)\n",
+            touched, BENCH_MEMORY_SIZE / 256, full / RESETS * 1e9, incremental / RESETS * 1e9, full / incremental);
+    free(copy);
+    snapshot_destroy(snapshot);
+    cpu_destroy(cpu);
+}
+
+static double run_for_seconds(CPU* cpu, int (*run)(CPU*, int), long long* cycles) {
+    double start = now_in_seconds();
+    *cycles = 0;
+    while(*cycles < BENCH_CYCLES) {
+        *cycles += run(cpu, 1000000);
+    }
+    return now_in_seconds() - start;
+}
+
+static int run_block_cache(CPU* cpu, int cycles) {
+    return block_cache_run(cpu->block_cache, cpu, cycles);
+}
+
+static void bench_block_cache(void) {
+    CPU* cpu = cpu_create(BENCH_MEMORY_SIZE);
+    cpu_reset(cpu);
+    load_loop(cpu);
+    if(cpu->block_cache == NULL) {
+        cpu->block_cache = block_cache_create();
+    }
+
+    long long cycles;
+    double plain = run_for_seconds(cpu, cpu_run, &cycles);
+    cpu->program_counter = LOOP_ORIGIN;
+    double cached = run_for_seconds(cpu, run_block_cache, &cycles);
+
+    printf("block cache %lld cycles: cpu_run %.3fs, cached %.3fs (%.2fx), hit rate %.2f%%\n",
+            cycles, plain, cached, plain / cached, block_cache_hit_rate(cpu->block_cache) * 100);
+    cpu_destroy(cpu);
+}
+
+static int run_jit(CPU* cpu, int cycles) {
+    return jit_run(cpu->jit, cpu->block_cache, cpu, cycles);
+}
+
+static void bench_jit(void) {
+    CPU* cpu = cpu_create(BENCH_MEMORY_SIZE);
+    cpu_reset(cpu);
+    load_loop(cpu);
+    if(cpu->block_cache == NULL) {
+        cpu->block_cache = block_cache_create();
+    }
+    if(cpu->jit == NULL) {
+        cpu->jit = jit_create();
+    }
+
+    long long cycles;
+    double plain = run_for_seconds(cpu, cpu_run, &cycles);
+    cpu->program_counter = LOOP_ORIGIN;
+    double translated = run_for_seconds(cpu, run_jit, &cycles);
+
+    printf("jit %s: cpu_run %.1f emulated MHz, jit %.1f emulated MHz (%.2fx), %llu blocks translated\n",
+            cpu->jit != NULL ? "x86-64" : "unavailable", cycles / plain / 1e6, cycles / translated / 1e6,
+            plain / translated, cpu->jit != NULL ? cpu->jit->blocks_compiled : 0);
+    cpu_destroy(cpu);
+}
+
+#define PAGE_CROSS_CODE 0x0200
+#define PAGE_CROSS_END 0xFFFC
+
+/*
+    LDA (zp),Y over and over with Y = $80, so a pointer crosses a page exactly when its low
+    byte is $80 or more. The zero page holds 128 pointers, none, half or all of them crossing
+    in a pseudo-random order. Taking the penalty without a branch should make the time per
+    instruction the same whichever pattern the program follows.
+*/
+static void bench_page_cross(void) {
+    static const char* const names[] = { "no", "half the", "every" };
+    for(int pattern = 0; pattern < 3; pattern++) {
+        CPU* cpu = cpu_create(BENCH_MEMORY_SIZE);
+        cpu_reset(cpu);
+        Byte value = 0;
+        int crossing = 0;
+        for(int pointer = 0; pointer < 128; pointer++) {
+            value = value * 77 + 13;
+            Byte lo = value & 0x7F;
+            if(pattern == 2 || (pattern == 1 && (value & 0x80))) {
+                lo |= 0x80;
+                crossing++;
+            }
+            cpu->memory.data[pointer * 2] = lo;
+            cpu->memory.data[pointer * 2 + 1] = 0x20 + pointer;
+        }
+        for(int address = PAGE_CROSS_CODE; address < PAGE_CROSS_END; address += 2) {
+            cpu->memory.data[address] = LDA_IND_Y;
+            cpu->memory.data[address + 1] = address & 0xFE;
+        }
+        cpu->memory.data[PAGE_CROSS_END] = JMP_ABS;
+        cpu->memory.data[PAGE_CROSS_END + 1] = PAGE_CROSS_CODE & 0xFF;
+        cpu->memory.data[PAGE_CROSS_END + 2] = PAGE_CROSS_CODE >> 8;
+        cpu->program_counter = PAGE_CROSS_CODE;
+        cpu->idx_reg_y = 0x80;
+
+        long long cycles;
+        double elapsed = run_for_seconds(cpu, cpu_run, &cycles);
+        double instructions = cycles / (opcode_cycles[LDA_IND_Y] + crossing / 128.0);
+        printf("page cross %-9s %-8s pointer crossing: %.2fns per instruction, %.1f emulated MHz\n",
+                cpu_dispatch_name(), names[pattern], elapsed / instructions * 1e9, cycles / elapsed / 1e6);
+        cpu_destroy(cpu);
+    }
+}
+
+#define BATCH_SLICE 100000
+
+// Instructions per cycle of the load loop, to turn emulated cycles into instructions
+static double load_loop_instructions_per_cycle(CPU* cpu) {
+    int instructions = 0;
+    int cycles = 0;
+    Word address = LOOP_ORIGIN;
+    Byte opcode;
+    do {
+        opcode = cpu->memory.data[address];
+        instructions++;
+        cycles += opcode_cycles[opcode];
+        address += opcode_length(opcode);
+    } while(opcode != JMP_ABS);
+    return (double)instructions / cycles;
+}
+
+// The same load loop in every lane over different data, run one CPU at a time and in lock step
+static void bench_batch(int lanes) {
+    CPU* cpus[BATCH_MAX_LANES];
+    for(int lane = 0; lane < lanes; lane++) {
+        cpus[lane] = cpu_create(BENCH_MEMORY_SIZE);
+        cpu_reset(cpus[lane]);
+        fill_with_pattern(cpus[lane], LOAD_MIX, sizeof(LOAD_MIX));
+        load_loop(cpus[lane]);
+        cpus[lane]->memory.data[0x10] = lane;
+        cpus[lane]->memory.data[0x30] = lane * 8;
+    }
+    double instructions_per_cycle = load_loop_instructions_per_cycle(cpus[0]);
+
+    long long cycles = 0;
+    double start = now_in_seconds();
+    while(cycles < BENCH_CYCLES) {
+        for(int lane = 0; lane < lanes; lane++) {
+            cycles += cpu_run(cpus[lane], BATCH_SLICE);
+        }
+    }
+    double scalar = cycles * instructions_per_cycle / (now_in_seconds() - start);
+
+    Batch* batch = batch_create(cpus, lanes);
+    cycles = 0;
+    start = now_in_seconds();
+    while(cycles < BENCH_CYCLES) {
+        cycles += batch_run(batch, BATCH_SLICE);
+    }
+    double lockstep = cycles * instructions_per_cycle / (now_in_seconds() - start);
+
+    printf("batch %2d lanes: cpu_run loop %.1f MIPS, lock step %.1f MIPS (%.2fx), %llu divergences\n",
+            lanes, scalar / 1e6, lockstep / 1e6, lockstep / scalar, batch->divergences);
+    batch_destroy(batch);
+    for(int lane = 0; lane < lanes; lane++) {
+        cpu_destroy(cpus[lane]);
+    }
+}
+
+#define FARM_JOBS 64
+#define FARM_JOB_CYCLES 4000000
+
+// Emulated MHz of FARM_JOBS load loop jobs on a farm of threads workers
+static double run_farm(int threads, const Byte* image, unsigned long long* steals) {
+    FarmJob jobs[FARM_JOBS];
+    Farm* farm = farm_create(threads, BENCH_MEMORY_SIZE);
+
+    double start = now_in_seconds();
+    for(int i = 0; i < FARM_JOBS; i++) {
+        memset(&jobs[i], 0, sizeof(FarmJob));
+        jobs[i].image = image;
+        jobs[i].image_size = BENCH_MEMORY_SIZE;
+        jobs[i].cycles = FARM_JOB_CYCLES;
+        jobs[i].program_counter = LOOP_ORIGIN;
+        flags_reset(&jobs[i].flags);
+        farm_submit(farm, &jobs[i]);
+    }
+    long long cycles = 0;
+    FarmJob* job;
+    while((job = farm_wait(farm)) != NULL) {
+        cycles += job->cycles_completed;
+    }
+    double elapsed = now_in_seconds() - start;
+
+    *steals = 0;
+    for(int i = 0; i < threads; i++) {
+        *steals += farm->workers[i].steals;
+    }
+    farm_destroy(farm);
+    return cycles / elapsed / 1e6;
+}
+
+static void bench_farm(void) {
+    CPU* cpu = cpu_create(BENCH_MEMORY_SIZE);
+    cpu_reset(cpu);
+    fill_with_pattern(cpu, LOAD_MIX, sizeof(LOAD_MIX));
+    load_loop(cpu);
+
+    int thread_counts[] = { 1, 2, 4, farm_default_threads() };
+    double single = 0;
+    for(int i = 0; i < 4; i++) {
+        unsigned long long steals;
+        double mhz = run_farm(thread_counts[i], cpu->memory.data, &steals);
+        if(i == 0) {
+            single = mhz;
+        }
+        printf("farm %2d threads: %d jobs, %.1f emulated MHz (%.2fx of 1 thread), %llu steals\n",
+                thread_counts[i], FARM_JOBS, mhz, mhz / single, steals);
+    }
+    cpu_destroy(cpu);
+}
+
+#define CHURN 20000
+#define POOL_CPUS 256
+#define POOL_SLICE 1000
+
+// Creates, touches and frees a CPU CHURN times through cpu_create and through a pool
+static void bench_pool_churn(void) {
+    double start = now_in_seconds();
+    for(int i = 0; i < CHURN; i++) {
+        CPU* cpu = cpu_create(BENCH_MEMORY_SIZE);
+        cpu_reset(cpu);
+        cpu_write_byte(cpu, i, 1);
+        cpu_destroy(cpu);
+    }
+    double created = (now_in_seconds() - start) / CHURN;
+
+    CpuPool* pool = cpu_pool_create(1, BENCH_MEMORY_SIZE, CPU_POOL_SMALL_PAGES);
+    start = now_in_seconds();
+    for(int i = 0; i < CHURN; i++) {
+        CPU* cpu = cpu_pool_acquire(pool);
+        cpu_write_byte(cpu, i, 1);
+        cpu_pool_release(pool, cpu);
+    }
+    double pooled = (now_in_seconds() - start) / CHURN;
+    cpu_pool_destroy(pool);
+
+    printf("cpu pool churn: cpu_create/destroy %.2fus, acquire/release %.2fus (%.0fx)\n",
+            created * 1e6, pooled * 1e6, created / pooled);
+}
+
+#define CACHE_READ_MISSES(cache) ((cache) | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+
+// A user space counter of one host event for this thread, counting from now, -1 where the host has none
+static int open_counter(u32 type, u64 config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+    Closes a counter and returns what it counted, scaled up to the whole time it was open when
+    the kernel had to share the host's counter registers out between more events than it has.
+    -1 where the counter never opened or never got to count.
+*/
+static long long close_counter(int counter) {
+    if(counter < 0) {
+        return -1;
+    }
+    u64 values[3];
+    long long count = -1;
+    if(read(counter, values, sizeof(values)) == sizeof(values) && values[2] > 0) {
+        count = values[0] * ((double)values[1] / values[2]);
+    }
+    close(counter);
+    return count;
+}
+
+// Runs the load loop on POOL_CPUS CPUs in turn, POOL_SLICE cycles each, so every slice touches another CPU
+static void bench_pool_spread(const char* name, CPU** cpus) {
+    for(int i = 0; i < POOL_CPUS; i++) {
+        fill_with_pattern(cpus[i], LOAD_MIX, sizeof(LOAD_MIX));
+        load_loop(cpus[i]);
+    }
+
+    int counter = open_counter(PERF_TYPE_HW_CACHE, CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_DTLB));
+    long long cycles = 0;
+    double start = now_in_seconds();
+    while(cycles < BENCH_CYCLES) {
+        for(int i = 0; i < POOL_CPUS; i++) {
+            cycles += cpu_run(cpus[i], POOL_SLICE);
+        }
+    }
+    double elapsed = now_in_seconds() - start;
+    long long misses = close_counter(counter);
+
+    printf("cpu pool %d CPUs %-24s %.1f emulated MHz, ", POOL_CPUS, name, cycles / elapsed / 1e6);
+    if(misses >= 0) {
+        printf("%.2f dTLB misses per 1000 cycles\n", misses * 1000.0 / cycles);
+    } else {
+        printf("dTLB counter unavailable\n");
+    }
+}
+
+static void bench_pool(void) {
+    bench_pool_churn();
+
+    CPU* cpus[POOL_CPUS];
+    for(int i = 0; i < POOL_CPUS; i++) {
+        cpus[i] = cpu_create(BENCH_MEMORY_SIZE);
+        cpu_reset(cpus[i]);
+    }
+    bench_pool_spread("cpu_create:", cpus);
+    for(int i = 0; i < POOL_CPUS; i++) {
+        cpu_destroy(cpus[i]);
+    }
+
+    const char* names[] = { "pool, small pages:", "pool, transparent huge:", "pool, explicit huge:" };
+    for(int pages = CPU_POOL_SMALL_PAGES; pages <= CPU_POOL_EXPLICIT_HUGE_PAGES; pages++) {
+        CpuPool* pool = cpu_pool_create(POOL_CPUS, BENCH_MEMORY_SIZE, pages);
+        if(pool->pages != pages) {
+            printf("cpu pool %d CPUs %-24s unavailable, fell back to transparent huge pages\n", POOL_CPUS, names[pages]);
+            cpu_pool_destroy(pool);
+            continue;
+        }
+        for(int i = 0; i < POOL_CPUS; i++) {
+            cpus[i] = cpu_pool_acquire(pool);
+        }
+        bench_pool_spread(names[pages], cpus);
+        cpu_pool_destroy(pool);
+    }
+}
+
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_PAGED
+
+#define ROM_INSTANCES 10000
+#define ROM_ORIGIN 0x8000
+#define ROM_SIZE 0x8000
+#define ROM_CYCLES 1000
+
+// Resident set size of the process in bytes
+static long resident_bytes(void) {
+    long pages = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if(statm == NULL || fscanf(statm, "%*d %ld", &pages) != 1) {
+        pages = 0;
+    }
+    if(statm != NULL) {
+        fclose(statm);
+    }
+    return pages * sysconf(_SC_PAGESIZE);
+}
+
+// Bytes of a CPU's 64 KiB of data that are backed by host pages
+static long resident_data_bytes(CPU* cpu) {
+    long page = sysconf(_SC_PAGESIZE);
+    unsigned char resident[MEMORY_ADDRESS_SPACE / 4096];
+    long pages = MEMORY_ADDRESS_SPACE / page;
+    if(pages > (long)sizeof(resident) || mincore(cpu->memory.data, MEMORY_ADDRESS_SPACE, resident) != 0) {
+        return 0;
+    }
+    long bytes = 0;
+    for(long i = 0; i < pages; i++) {
+        bytes += (resident[i] & 1) * page;
+    }
+    return bytes;
+}
+
+/*
+    Sets up ROM_INSTANCES CPUs running the same ROM_SIZE image at ROM_ORIGIN, either with a
+    private copy of it in 64 KiB of RAM each or with ROM_ORIGIN bytes of RAM and the image mapped
+    from one file, and reports the memory each instance costs. Every instance also gets some
+    private state in zero page and the stack, and runs ROM_CYCLES cycles. Each setup runs in a
+    child process, so neither starts with heap the other has freed.
+*/
+static void bench_shared_rom_instances(const char* name, const Byte* rom, bool shared) {
+    fflush(stdout);
+    pid_t child = fork();
+    if(child != 0) {
+        waitpid(child, NULL, 0);
+        return;
+    }
+
+    long before = resident_bytes();
+    CpuPool* pool = cpu_pool_create(ROM_INSTANCES, shared ? ROM_ORIGIN : BENCH_MEMORY_SIZE, CPU_POOL_SMALL_PAGES);
+    long data_bytes = 0;
+    for(int i = 0; i < ROM_INSTANCES; i++) {
+        CPU* cpu = cpu_pool_acquire(pool);
+        if(shared) {
+            memory_map_rom(&cpu->memory, ROM_ORIGIN >> 8, ROM_SIZE / MEMORY_PAGE_SIZE, rom);
+        } else {
+            memcpy(cpu->memory.data + ROM_ORIGIN, rom, ROM_SIZE);
+            memory_mark_dirty(&cpu->memory, ROM_ORIGIN, ROM_SIZE);
+        }
+        cpu_write_byte(cpu, 0x0010, i);
+        cpu_write_byte(cpu, 0x01FF, i >> 8);
+        cpu->program_counter = ROM_ORIGIN;
+        cpu_run(cpu, ROM_CYCLES);
+        data_bytes += resident_data_bytes(cpu);
+    }
+    long used = resident_bytes() - before;
+    printf("rom %d instances %-16s %.1f KiB RSS, %.1f KiB of guest memory per instance (%.1f MiB in all)\n",
+            ROM_INSTANCES, name, used / 1024.0 / ROM_INSTANCES, data_bytes / 1024.0 / ROM_INSTANCES, used / 1048576.0);
+    fflush(stdout);
+    _exit(0);
+}
+
+static void bench_shared_rom(void) {
+    Byte image[ROM_SIZE];
+    for(int i = 0; i < ROM_SIZE; i++) {
+        image[i] = LOAD_MIX[i % sizeof(LOAD_MIX)];
+    }
+    image[sizeof(LOAD_MIX) * LOOP_REPEATS] = JMP_ABS;
+    image[sizeof(LOAD_MIX) * LOOP_REPEATS + 1] = ROM_ORIGIN & 0xFF;
+    image[sizeof(LOAD_MIX) * LOOP_REPEATS + 2] = ROM_ORIGIN >> 8;
+
+    char path[] = "/tmp/6502_bench_rom_XXXXXX";
+    int file = mkstemp(path);
+    if(file < 0 || write(file, image, ROM_SIZE) != ROM_SIZE) {
+        printf("rom: cannot write %s\n", path);
+        return;
+    }
+    close(file);
+    int size = 0;
+    const Byte* rom = memory_open_rom(path, &size);
+    unlink(path);
+    if(rom == NULL) {
+        printf("rom: cannot map %s\n", path);
+        return;
+    }
+
+    bench_shared_rom_instances("private copy:", image, false);
+    bench_shared_rom_instances("shared ROM:", rom, true);
+    memory_close_rom(rom, size);
+}
+
+#endif
+
+#define POLL_PERIOD 1000
+
+// A periodic device: context holds its period, every firing schedules the next
+static void bench_tick(CPU* cpu, void* context, u64 when) {
+    scheduler_add(cpu->scheduler, when + *(int*)context, bench_tick, context);
+}
+
+static u64 poll_deadline = 0;
+static unsigned long long polls_fired = 0;
+
+// The alternative to a scheduler: one instruction at a time, checking the device after each
+static int run_polling(CPU* cpu, int cycles) {
+    int completed = 0;
+    while(cycles > 0) {
+        int c = cpu_run(cpu, 1);
+        completed += c;
+        cycles -= BUDGET_COST(c);
+        if(cpu->clock >= poll_deadline) {
+            poll_deadline += POLL_PERIOD;
+            polls_fired++;
+        }
+    }
+    return completed;
+}
+
+static void bench_scheduler(void) {
+    CPU* cpu = cpu_create(BENCH_MEMORY_SIZE);
+    cpu_reset(cpu);
+    fill_with_pattern(cpu, LOAD_MIX, sizeof(LOAD_MIX));
+
+    long long cycles;
+    double elapsed = run_for_seconds(cpu, cpu_run, &cycles);
+    printf("scheduler %-9s no scheduler:          %.1f emulated MHz\n", cpu_dispatch_name(), cycles / elapsed / 1e6);
+
+    Scheduler* scheduler = scheduler_create();
+    cpu->scheduler = scheduler;
+    elapsed = run_for_seconds(cpu, cpu_run, &cycles);
+    printf("scheduler %-9s empty queue:           %.1f emulated MHz\n", cpu_dispatch_name(), cycles / elapsed / 1e6);
+
+    static int periods[] = { 10000, 1000, 100 };
+    for(int i = 0; i < 3; i++) {
+        unsigned long long fired = scheduler->fired;
+        scheduler_add(scheduler, cpu->clock + periods[i], bench_tick, &periods[i]);
+        elapsed = run_for_seconds(cpu, cpu_run, &cycles);
+        scheduler_cancel(scheduler, bench_tick, &periods[i]);
+        printf("scheduler %-9s event every %5d:     %.1f emulated MHz, %llu events\n",
+                cpu_dispatch_name(), periods[i], cycles / elapsed / 1e6, scheduler->fired - fired);
+    }
+    cpu->scheduler = NULL;
+    scheduler_destroy(scheduler);
+
+    poll_deadline = cpu->clock + POLL_PERIOD;
+    elapsed = run_for_seconds(cpu, run_polling, &cycles);
+    printf("scheduler %-9s polling every step:    %.1f emulated MHz, %llu events\n",
+            cpu_dispatch_name(), cycles / elapsed / 1e6, polls_fired);
+    cpu_destroy(cpu);
+}
+
+#define NMI_HANDLER 0x0F00
+
+// Raises an NMI every context cycles; the handler only returns
+static void bench_nmi(CPU* cpu, void* context, u64 when) {
+    cpu_nmi(cpu);
+    scheduler_add(cpu->scheduler, when + *(int*)context, bench_nmi, context);
+}
+
+/*
+    The load loop with NMIs raised at fixed periods. Every NMI costs a cut budget, an engine
+    exit and the 7 + 6 cycles of entering and leaving the handler, against nothing between them.
+*/
+static void bench_interrupts(void) {
+    CPU* cpu = cpu_create(BENCH_MEMORY_SIZE);
+    cpu_reset(cpu);
+    load_loop(cpu);
+    cpu->memory.data[NMI_HANDLER] = RTI;
+    cpu->memory.data[CPU_NMI_VECTOR] = NMI_HANDLER & 0xFF;
+    cpu->memory.data[CPU_NMI_VECTOR + 1] = NMI_HANDLER >> 8;
+
+    long long cycles;
+    double elapsed = run_for_seconds(cpu, cpu_run, &cycles);
+    printf("interrupts %-9s none:              %.1f emulated MHz\n", cpu_dispatch_name(), cycles / elapsed / 1e6);
+
+    Scheduler* scheduler = scheduler_create();
+    cpu->scheduler = scheduler;
+    static int periods[] = { 10000, 1000, 100 };
+    for(int i = 0; i < 3; i++) {
+        unsigned long long fired = scheduler->fired;
+        scheduler_add(scheduler, cpu->clock + periods[i], bench_nmi, &periods[i]);
+        elapsed = run_for_seconds(cpu, cpu_run, &cycles);
+        scheduler_cancel(scheduler, bench_nmi, &periods[i]);
+        printf("interrupts %-9s NMI every %5d:   %.1f emulated MHz, %llu NMIs\n",
+                cpu_dispatch_name(), periods[i], cycles / elapsed / 1e6, scheduler->fired - fired);
+    }
+    cpu->scheduler = NULL;
+    scheduler_destroy(scheduler);
+    cpu_destroy(cpu);
+}
+
+/*
+    A program waiting for a device: a loop polling a RAM flag, with a timer due every period
+    cycles. The loop spins between timer events, so all but a pass or two after each event
+    are skipped.
+*/
+static void bench_idle(void) {
+    CPU* cpu = cpu_create(BENCH_MEMORY_SIZE);
+    cpu_reset(cpu);
+    Byte wait[] = { LDA_ZERO, 0x10, JMP_ABS, 0x00, 0x00 };
+    memcpy(cpu->memory.data, wait, sizeof(wait));
+
+    Scheduler* scheduler = scheduler_create();
+    cpu->scheduler = scheduler;
+    static int periods[] = { 10000, 1000, 100 };
+    for(int i = 0; i < 3; i++) {
+        unsigned long long skipped = cpu->spin_cycles_skipped;
+        scheduler_add(scheduler, cpu->clock + periods[i], bench_tick, &periods[i]);
+        long long cycles;
+        double elapsed = run_for_seconds(cpu, cpu_run, &cycles);
+        scheduler_cancel(scheduler, bench_tick, &periods[i]);
+        printf("idle loop %-9s event every %5d:     %.1f emulated MHz, %.1f%% of cycles skipped\n",
+                cpu_dispatch_name(), periods[i], cycles / elapsed / 1e6, 100.0 * (cpu->spin_cycles_skipped - skipped) / cycles);
+    }
+    cpu->scheduler = NULL;
+    scheduler_destroy(scheduler);
+    cpu_destroy(cpu);
+}
+
+/*
+    The load mix called as a subroutine from a loop, run plain and then sampled every period
+    cycles, which also keeps the call stack on every JSR and RTS.
+*/
+static void bench_sampler(void) {
+    CPU* cpu = cpu_create(BENCH_MEMORY_SIZE);
+    cpu_reset(cpu);
+    load_loop(cpu);
+    Word end = LOOP_ORIGIN + LOOP_REPEATS * sizeof(LOAD_MIX);
+    cpu->memory.data[end] = RTS;
+    Byte main[] = { JSR_ABS, LOOP_ORIGIN & 0xFF, LOOP_ORIGIN >> 8, JMP_ABS, 0x00, 0x00 };
+    memcpy(cpu->memory.data, main, sizeof(main));
+    cpu->program_counter = 0;
+    Scheduler* scheduler = scheduler_create();
+    cpu->scheduler = scheduler;
+
+    long long cycles;
+    double elapsed = run_for_seconds(cpu, cpu_run, &cycles);
+    printf("sampler %-9s off:                  %.1f emulated MHz\n", cpu_dispatch_name(), cycles / elapsed / 1e6);
+    static const int periods[] = { 100000, 1000 };
+    for(int i = 0; i < 2; i++) {
+        Sampler* sampler = sampler_create(periods[i]);
+        sampler_start(sampler, cpu);
+        elapsed = run_for_seconds(cpu, cpu_run, &cycles);
+        sampler_stop(sampler, cpu);
+        printf("sampler %-9s every %6d cycles:   %.1f emulated MHz, %d stacks\n",
+                cpu_dispatch_name(), periods[i], cycles / elapsed / 1e6, sampler->count);
+        sampler_destroy(sampler);
+    }
+    cpu->scheduler = NULL;
+    scheduler_destroy(scheduler);
+    cpu_destroy(cpu);
+}
+
+#if CPU_TRACE == CPU_TRACE_ON
+/*
+    The load mix traced into the ring alone and streamed to a file as well, with how much of
+    it the writer thread kept up with and the bytes written per instruction it kept.
+*/
+static void bench_trace_sink(void) {
+    CPU* cpu = cpu_create(BENCH_MEMORY_SIZE);
+    cpu_reset(cpu);
+    load_loop(cpu);
+    long long cycles;
+    double elapsed = run_for_seconds(cpu, cpu_run, &cycles);
+    printf("trace %-9s ring only:            %.1f emulated MHz\n", cpu_dispatch_name(), cycles / elapsed / 1e6);
+
+    char path[] = "/tmp/6502_bench_stream_XXXXXX";
+    close(mkstemp(path));
+    TraceSink* sink = trace_sink_open(cpu, path);
+    u64 written = cpu->trace->written;
+    elapsed = run_for_seconds(cpu, cpu_run, &cycles);
+    u64 run = cpu->trace->written - written;
+    unsigned long long dropped = sink->dropped;
+    trace_sink_close(sink);
+    struct stat file;
+    stat(path, &file);
+    unlink(path);
+    printf("trace %-9s streamed:             %.1f emulated MHz, %.1f%% kept, %.2f bytes per instruction\n",
+            cpu_dispatch_name(), cycles / elapsed / 1e6, 100.0 * (run - dropped) / run, (double)file.st_size / (run - dropped));
+    cpu_destroy(cpu);
+}
+#endif
+
+#define WORKLOAD_ORIGIN 0x0200
+#define WORKLOAD_SUBROUTINES 16
+#define WORKLOAD_SUBROUTINE_ORIGIN 0x1000
+#define WORKLOAD_TAIL 0x0F00
+#define WORKLOAD_CALLS 64
+#define STREAM_STRIDE 64
+#define STACK_CODE 0x0110
+#define STACK_SUBROUTINE 0x0160
+#define STACK_CALLS 8
+#define WORKLOAD_SAMPLE 1000000
+
+// Writes one instruction at address and returns where the next one goes
+static Word put_instruction(CPU* cpu, Word address, Byte opcode, Word operand) {
+    int length = opcode_length(opcode);
+    cpu->memory.data[address] = opcode;
+    if(length > 1) {
+        cpu->memory.data[(Word)(address + 1)] = operand & 0xFF;
+    }
+    if(length > 2) {
+        cpu->memory.data[(Word)(address + 2)] = operand >> 8;
+    }
+    return address + length;
+}
+
+static void load_heavy_workload(CPU* cpu) {
+    fill_with_pattern(cpu, LOAD_MIX, sizeof(LOAD_MIX));
+    load_loop(cpu);
+}
+
+/*
+    There are no branch instructions yet, so control flow comes from JSR, RTS and JMP:
+    WORKLOAD_CALLS calls in a scrambled order to WORKLOAD_SUBROUTINES subroutines of one to four
+    loads, every other one jumping on to a shared tail to return. Every RTS goes back somewhere
+    else, and every handler is followed by another than last time, which is what the host's
+    branch predictors find hard in an interpreter.
+*/
+static void branch_heavy_workload(CPU* cpu) {
+    fill_with_pattern(cpu, LOAD_MIX, sizeof(LOAD_MIX));
+    put_instruction(cpu, put_instruction(cpu, WORKLOAD_TAIL, LDX_IMM, 0x01), RTS, 0);
+    for(int i = 0; i < WORKLOAD_SUBROUTINES; i++) {
+        Word address = WORKLOAD_SUBROUTINE_ORIGIN + i * 0x100;
+        for(int load = 0; load <= i % 4; load++) {
+            address = put_instruction(cpu, address, LDA_IMM, i);
+        }
+        put_instruction(cpu, address, i % 2 ? JMP_ABS : RTS, WORKLOAD_TAIL);
+    }
+    Word address = WORKLOAD_ORIGIN;
+    u32 order = 1;
+    for(int call = 0; call < WORKLOAD_CALLS; call++) {
+        order = order * 1103515245 + 12345;
+        address = put_instruction(cpu, address, JSR_ABS, WORKLOAD_SUBROUTINE_ORIGIN + (order >> 16) % WORKLOAD_SUBROUTINES * 0x100);
+    }
+    put_instruction(cpu, address, JMP_ABS, WORKLOAD_ORIGIN);
+    cpu->program_counter = WORKLOAD_ORIGIN;
+}
+
+// LDA abs from every STREAM_STRIDE'th byte in turn, so each pass reads all 64 KiB of guest memory
+static void memory_streaming_workload(CPU* cpu) {
+    fill_with_pattern(cpu, LOAD_MIX, sizeof(LOAD_MIX));
+    Word address = WORKLOAD_ORIGIN;
+    for(int target = 0; target < MEMORY_ADDRESS_SPACE; target += STREAM_STRIDE) {
+        address = put_instruction(cpu, address, LDA_ABS, target);
+    }
+    put_instruction(cpu, address, JMP_ABS, WORKLOAD_ORIGIN);
+    cpu->program_counter = WORKLOAD_ORIGIN;
+}
+
+/*
+    With no store instructions yet, code in the stack page stands in for code that patches
+    itself: every JSR from it pushes its return address into the page it runs from, which
+    throws away what the block cache or the JIT made of that page each time.
+*/
+static void self_modifying_workload(CPU* cpu) {
+    fill_with_pattern(cpu, LOAD_MIX, sizeof(LOAD_MIX));
+    put_instruction(cpu, put_instruction(cpu, STACK_SUBROUTINE, LDY_IMM, 0x01), RTS, 0);
+    Word address = STACK_CODE;
+    for(int call = 0; call < STACK_CALLS; call++) {
+        address = put_instruction(cpu, address, LDA_IMM, call);
+        address = put_instruction(cpu, address, LDX_ZERO, 0x10);
+        address = put_instruction(cpu, address, JSR_ABS, STACK_SUBROUTINE);
+    }
+    put_instruction(cpu, address, JMP_ABS, STACK_CODE);
+    cpu->program_counter = STACK_CODE;
+}
+
+typedef struct Workload {
+    const char* name;
+    // Lays the program out in a reset CPU and points the program counter at it
+    void (*load)(CPU*);
+} Workload;
+
+static const Workload workloads[] = {
+    { "load-heavy", load_heavy_workload },
+    { "branch-heavy", branch_heavy_workload },
+    { "memory-streaming", memory_streaming_workload },
+    { "self-modifying", self_modifying_workload }
+};
+
+enum HostEvent {
+    HOST_CYCLES,
+    HOST_INSTRUCTIONS,
+    HOST_BRANCH_MISSES,
+    HOST_L1I_MISSES,
+    HOST_L1D_MISSES,
+    HOST_EVENTS
+};
+
+/*
+    What the harness counts on the host while a workload runs. Each event is a counter of its
+    own rather than one of a group, so a host or virtual machine without one still reports the
+    others.
+*/
+static const struct {
+    u32 type;
+    u64 config;
+} host_events[HOST_EVENTS] = {
+    [HOST_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [HOST_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [HOST_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    [HOST_L1I_MISSES] = { PERF_TYPE_HW_CACHE, CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_L1I) },
+    [HOST_L1D_MISSES] = { PERF_TYPE_HW_CACHE, CACHE_READ_MISSES(PERF_COUNT_HW_CACHE_L1D) }
+};
+
+// Instructions per emulated cycle of a workload, stepping a copy of it one instruction at a time
+static double workload_instructions_per_cycle(const Workload* workload) {
+    CPU* cpu = cpu_create(BENCH_MEMORY_SIZE);
+    cpu_reset(cpu);
+    workload->load(cpu);
+    long long cycles = 0;
+    for(int i = 0; i < WORKLOAD_SAMPLE; i++) {
+        cycles += cpu_step(cpu);
+    }
+    cpu_destroy(cpu);
+    return (double)WORKLOAD_SAMPLE / cycles;
+}
+
+// count per denominator times scale, n/a where either counter was unavailable
+static void print_counter_ratio(const char* name, long long count, double denominator, double scale) {
+    if(count < 0 || denominator <= 0) {
+        printf(", %s n/a", name);
+    } else {
+        printf(", %s %.2f", name, count * scale / denominator);
+    }
+}
+
+/*
+    Each synthetic workload through cpu_run for BENCH_CYCLES, with host instructions per host
+    cycle and branch mispredicts and L1 misses per 1000 emulated instructions. The counters
+    are only there where perf_event_open lets this process count its own user space events.
+*/
+static void bench_workloads(void) {
+    for(size_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+        const Workload* workload = &workloads[w];
+        double per_cycle = workload_instructions_per_cycle(workload);
+        CPU* cpu = cpu_create(BENCH_MEMORY_SIZE);
+        cpu_reset(cpu);
+        workload->load(cpu);
+
+        int counters[HOST_EVENTS];
+        for(int e = 0; e < HOST_EVENTS; e++) {
+            counters[e] = open_counter(host_events[e].type, host_events[e].config);
+        }
+        long long cycles;
+        double elapsed = run_for_seconds(cpu, cpu_run, &cycles);
+        long long counts[HOST_EVENTS];
+        for(int e = 0; e < HOST_EVENTS; e++) {
+            counts[e] = close_counter(counters[e]);
+        }
+
+        double instructions = cycles * per_cycle;
+        printf("workload %-9s %-16s %.1f emulated MHz, %.2fns per instruction", cpu_dispatch_name(),
+                workload->name, cycles / elapsed / 1e6, elapsed / instructions * 1e9);
+        print_counter_ratio("IPC", counts[HOST_INSTRUCTIONS], counts[HOST_CYCLES], 1);
+        print_counter_ratio("branch misses/1k", counts[HOST_BRANCH_MISSES], instructions, 1000);
+        print_counter_ratio("L1I misses/1k", counts[HOST_L1I_MISSES], instructions, 1000);
+        print_counter_ratio("L1D misses/1k", counts[HOST_L1D_MISSES], instructions, 1000);
+        printf("\n");
+        cpu_destroy(cpu);
+    }
+}
+
+#define LOADS 100000
+
+// Loads one 32 KiB image at $8000 LOADS times into a CPU whose RAM stops below it and one whose RAM covers it
+static void bench_loader(void) {
+    static Byte rom[0x8000];
+    for(size_t i = 0; i < sizeof(rom); i++) {
+        rom[i] = LOAD_MIX[i % sizeof(LOAD_MIX)];
+    }
+    char path[] = "/tmp/6502_bench_image_XXXXXX";
+    int file = mkstemp(path);
+    if(file < 0 || write(file, rom, sizeof(rom)) != sizeof(rom)) {
+        printf("loader: cannot write %s\n", path);
+        return;
+    }
+    close(file);
+    LoaderImage* image = loader_open(path, LOADER_FORMAT_RAW, LOADER_ORIGIN_TOP);
+    unlink(path);
+
+    const int memory_sizes[] = { 0x8000, BENCH_MEMORY_SIZE };
+    double seconds[2];
+    for(int i = 0; i < 2; i++) {
+        CPU* cpu = cpu_create(memory_sizes[i]);
+        double start = now_in_seconds();
+        for(int load = 0; load < LOADS; load++) {
+            loader_load(image, cpu);
+        }
+        seconds[i] = (now_in_seconds() - start) / LOADS;
+        cpu_destroy(cpu);
+    }
+    printf("loader 32 KiB image: mapped as ROM %.2fus, copied into RAM %.2fus per load (%.0fx)\n",
+            seconds[0] * 1e6, seconds[1] * 1e6, seconds[1] / seconds[0]);
+    loader_close(image);
+}
+
+// "workloads" runs only the workload harness
+int main(int argc, char** argv) {
+    if(argc > 1 && strcmp(argv[1], "workloads") == 0) {
+        bench_workloads();
+        return 0;
+    }
+    bench_workloads();
+    bench_dispatch();
+    bench_memory_bus();
+    bench_flags();
+    bench_reset(1);
+    bench_reset(16);
+    bench_reset(256);
+    bench_snapshot(1);
+    bench_snapshot(16);
+    bench_snapshot(256);
+    bench_block_cache();
+    bench_jit();
+    bench_page_cross();
+    bench_batch(8);
+    bench_batch(16);
+    bench_batch(32);
+    bench_farm();
+    bench_pool();
+    bench_loader();
+    bench_scheduler();
+    bench_interrupts();
+    bench_idle();
+    bench_sampler();
+#if CPU_TRACE == CPU_TRACE_ON
+    bench_trace_sink();
+#endif
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_PAGED
+    bench_shared_rom();
+#endif
+    return 0;
+}
@@ -1,32 +1,52 @@
 #include "../deps/bdd-for-c.h"
 #include "../src/cpu.c"
+#include "../src/6502_memory.c"
+#include "../src/opcodes.c"
+#include "../src/block_cache.c"
+#include "../src/jit.c"
+#include "../src/snapshot.c"
+#include "../src/batch.c"
+#include "../src/farm.c"
+#include "../src/cpu_pool.c"
+#include "../src/loader.c"
+#include "../src/scheduler.c"
+#include "../src/trace.c"
+#include "../src/trace_sink.c"
+#include "../src/profile.c"
+#include "../src/sampler.c"
+#include "../src/aot.c"
 #include "../src/instruction.h"
+// What rom2c made of spec/aot_rom.bin, see the Makefile
+#include "../build/spec_rom_aot.c"
 #include "stdbool.h"
 #include <stdio.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #define NZ_FLAGS_CHECK(val) {                       \
     if (val > 0) {                                  \
-        cpu->flags.zero = true;                     \
-        cpu->flags.negative = true;                 \
+        flags_set_zero(&cpu->flags, true);          \
+        flags_set_negative(&cpu->flags, true);      \
                                                     \
         cpu_run(cpu, 1);                            \
-        check(cpu->flags.zero == false);            \
-        check(cpu->flags.negative == false);        \
+        check(!flags_zero(&cpu->flags));            \
+        check(!flags_negative(&cpu->flags));        \
     } else if (val < 0) {                           \
-        cpu->flags.zero = true;                     \
-        cpu->flags.negative = false;                \
+        flags_set_zero(&cpu->flags, true);          \
+        flags_set_negative(&cpu->flags, false);     \
                                                     \
         cpu_run(cpu, 1);                            \
-        check(cpu->flags.zero == false);            \
-        check(cpu->flags.negative == true);         \
+        check(!flags_zero(&cpu->flags));            \
+        check(flags_negative(&cpu->flags));         \
     } else {                                        \
-        cpu->flags.zero = false;                    \
-        cpu->flags.negative = true;                 \
+        flags_set_zero(&cpu->flags, false);         \
+        flags_set_negative(&cpu->flags, true);      \
                                                     \
         cpu_run(cpu, 1);                            \
-        check(cpu->flags.zero == true);             \
-        check(cpu->flags.negative == false);        \
-    } \
+        check(flags_zero(&cpu->flags));             \
+        check(!flags_negative(&cpu->flags));        \
+    }                                               \
 }
 
 #define NZ_AUTO_FLAGS_CHECK(dest) {                             \
@@ -46,6 +66,105 @@
     }                                                           \
 }
 
+// Reads address in a child process and reports whether that crashed it
+static bool read_faults(volatile Byte* address) {
+    pid_t child = fork();
+    if(child == 0) {
+        (void)*address;
+        _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    return WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV;
+}
+
+// Writes address in a child process and reports whether that crashed it
+static bool write_faults(volatile Byte* address) {
+    pid_t child = fork();
+    if(child == 0) {
+        *address = 0;
+        _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    return WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV;
+}
+
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_PAGED
+// A one byte device register for the memory bus specs
+static Byte latch = 0;
+static int latch_reads = 0;
+
+static Byte read_latch(void* context, Word address) {
+    (void)address;
+    latch_reads++;
+    return *(Byte*)context;
+}
+
+static void write_latch(void* context, Word address, Byte value) {
+    (void)address;
+    *(Byte*)context = value;
+}
+#endif
+
+// Copies the byte the farm spec program loaded into the job's user byte
+static void copy_loaded_byte(FarmJob* job, CPU* worker) {
+    *(Byte*)job->user = worker->memory.data[0x20 + job->idx_reg_x];
+}
+
+// Writes size bytes to a new temporary file and stores its name in path
+static void write_temp_file(char* path, const void* bytes, int size) {
+    strcpy(path, "/tmp/6502_spec_XXXXXX");
+    int file = mkstemp(path);
+    if(write(file, bytes, size) != size) {
+        path[0] = '\0';
+    }
+    close(file);
+}
+
+// What the scheduler spec events saw when they fired
+static int fired_events[8];
+static u64 fired_clocks[8];
+static int fired_count = 0;
+
+static void record_event(CPU* cpu, void* context, u64 when) {
+    (void)when;
+    fired_events[fired_count] = *(int*)context;
+    fired_clocks[fired_count] = cpu->clock;
+    fired_count++;
+}
+
+// Fires every 4 cycles, context is the scheduler
+static void repeat_event(CPU* cpu, void* context, u64 when) {
+    (void)cpu;
+    fired_count++;
+    scheduler_add(context, when + 4, repeat_event, context);
+}
+
+// Holds IRQ line 0 from the cycle it fires at
+static void raise_irq(CPU* cpu, void* context, u64 when) {
+    (void)context;
+    (void)when;
+    cpu_set_irq(cpu, 1, true);
+}
+
+// Runs one instruction per budget, so a spinning loop is never seen coming round
+static int run_one_at_a_time(CPU* cpu, int cycles) {
+    int completed = 0;
+    while(completed < cycles) {
+        completed += cpu_run(cpu, 1);
+    }
+    return completed;
+}
+
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_PAGED
+// A device register that holds IRQ line 0 of the CPU in context once it is read
+static Byte irq_on_read(void* context, Word address) {
+    (void)address;
+    cpu_set_irq(context, 1, true);
+    return 0x99;
+}
+#endif
 
 spec("CPU") {
 
@@ -74,13 +193,35 @@ spec("CPU") {
             check(cpu->idx_reg_y == 0);
             check(cpu->program_counter == 0);
             check(cpu->stack_pointer == 0);
-            check(cpu->flags.break_command == 0);
-            check(cpu->flags.carry == 0);
-            check(cpu->flags.decimal_mode == 0);
-            check(cpu->flags.interrupt_disable == 0);
-            check(cpu->flags.negative == 0);
-            check(cpu->flags.overflow == 0);
-            check(cpu->flags.zero == 0);
+            check(!flags_break_command(&cpu->flags));
+            check(!flags_carry(&cpu->flags));
+            check(!flags_decimal_mode(&cpu->flags));
+            check(!flags_interrupt_disable(&cpu->flags));
+            check(!flags_negative(&cpu->flags));
+            check(!flags_overflow(&cpu->flags));
+            check(!flags_zero(&cpu->flags));
+        }
+
+        it("should push bit 5 set and B only for PHP and BRK") {
+            cpu_reset(cpu);
+            flags_set_carry(&cpu->flags, true);
+            flags_set_negative(&cpu->flags, true);
+            check(flags_to_byte(&cpu->flags, true) == (FLAG_NEGATIVE | FLAG_UNUSED | FLAG_BREAK_COMMAND | FLAG_CARRY));
+            check(flags_to_byte(&cpu->flags, false) == (FLAG_NEGATIVE | FLAG_UNUSED | FLAG_CARRY));
+            flags_from_byte(&cpu->flags, FLAG_BREAK_COMMAND | FLAG_OVERFLOW);
+            check(flags_to_byte(&cpu->flags, false) == (FLAG_UNUSED | FLAG_OVERFLOW));
+        }
+
+        it("should keep N and Z set together when no result could set both") {
+            cpu_reset(cpu);
+            flags_set_zero(&cpu->flags, true);
+            flags_set_negative(&cpu->flags, true);
+            check(flags_zero(&cpu->flags));
+            check(flags_negative(&cpu->flags));
+            flags_from_byte(&cpu->flags, FLAG_NEGATIVE | FLAG_ZERO | FLAG_CARRY);
+            check(flags_to_byte(&cpu->flags, false) == (FLAG_NEGATIVE | FLAG_UNUSED | FLAG_ZERO | FLAG_CARRY));
+            flags_set_nz(&cpu->flags, 0x01);
+            check(flags_to_byte(&cpu->flags, false) == (FLAG_UNUSED | FLAG_CARRY));
         }
 
         it("should zero out memory when reset") {
@@ -89,6 +230,1472 @@ spec("CPU") {
                 check(cpu->memory.data[i] == 0);
             }
         }
+
+        it("should only zero pages written since the last reset") {
+            cpu_reset(cpu);
+            cpu_write_byte(cpu, 0x0100, 0x12);
+            cpu_write_byte(cpu, 0x1FFF, 0x34);
+            cpu->memory.data[0x0800] = 0x56;
+            memory_mark_dirty(&cpu->memory, 0x0800, 1);
+            check(cpu->memory.dirty_pages[0] == (1u << 0x01 | 1u << 0x08 | 1u << 0x1F));
+
+            cpu_reset(cpu);
+            check(cpu->memory.data[0x0100] == 0);
+            check(cpu->memory.data[0x1FFF] == 0);
+            check(cpu->memory.data[0x0800] == 0);
+            check(cpu->memory.dirty_pages[0] == 0);
+        }
+    }
+
+    describe("opcode table") {
+
+        it("should describe every opcode") {
+            check(strcmp(opcode_mnemonics[LDA_ABS_X], "LDA") == 0);
+            check(opcode_addressing_modes[LDA_ABS_X] == ADDR_ABS_X);
+            check(opcode_cycles[LDA_ABS_X] == 4);
+            check(opcode_page_cross_penalty[LDA_ABS_X] == 1);
+            check(opcode_length(LDA_ABS_X) == 3);
+            check(strcmp(opcode_mnemonics[ILLEGAL_02], "???") == 0);
+        }
+
+        it("should disassemble instructions") {
+            char text[32];
+            Byte absolute_x[] = { LDA_ABS_X, 0x00, 0x04 };
+            Byte indirect_y[] = { LDA_IND_Y, 0x24 };
+
+            check(opcode_disassemble(0, absolute_x, text, sizeof(text)) == 3);
+            check(strcmp(text, "LDA $0400,X") == 0);
+            check(opcode_disassemble(0, indirect_y, text, sizeof(text)) == 2);
+            check(strcmp(text, "LDA ($24),Y") == 0);
+        }
+
+        it("should disassemble branches in both directions") {
+            char text[32];
+            Byte backward[] = { BNE, 0xFC };
+            Byte forward[] = { BEQ, 0x10 };
+
+            opcode_disassemble(0x1000, backward, text, sizeof(text));
+            check(strcmp(text, "BNE $0FFE") == 0);
+            opcode_disassemble(0x1000, forward, text, sizeof(text));
+            check(strcmp(text, "BEQ $1012") == 0);
+        }
+
+        it("should consume budget without completing cycles for unimplemented opcodes") {
+            cpu_reset(cpu);
+            cpu->memory.data[0] = ILLEGAL_02;
+            check(cpu_run(cpu, 1) == 0);
+            check(cpu->program_counter == 1);
+        }
+    }
+
+    describe("address space") {
+
+        it("should fault on host accesses just outside the 64 KiB reservation") {
+            check(read_faults(cpu->memory.data - 1));
+            check(read_faults(cpu->memory.data + MEMORY_ADDRESS_SPACE));
+            check(!read_faults(cpu->memory.data + MEMORY_ADDRESS_SPACE - 1));
+        }
+
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_FLAT
+        it("should be all RAM in the flat layout") {
+            cpu_reset(cpu);
+            check(cpu->memory.SIZE_IN_BYTES == MEMORY_ADDRESS_SPACE);
+            cpu_write_byte(cpu, 0xFFFF, 0x12);
+            check(memory_read(&cpu->memory, 0xFFFF) == 0x12);
+        }
+#else
+        it("should read past the end of a small memory as unmapped") {
+            cpu_reset(cpu);
+            check(cpu->memory.SIZE_IN_BYTES == MEMORY_SIZE_IN_BYTES);
+            cpu->memory.data[MEMORY_SIZE_IN_BYTES] = 0x12;
+            check(memory_read(&cpu->memory, MEMORY_SIZE_IN_BYTES) == 0);
+        }
+#endif
+    }
+
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_PAGED
+    describe("memory bus") {
+        static Byte rom[0x100];
+
+        before_each() {
+            cpu_reset(cpu);
+            memset(rom, 0, sizeof(rom));
+            latch = 0;
+            latch_reads = 0;
+        }
+
+        after_each() {
+            memory_init(&cpu->memory, cpu->memory.data, cpu->memory.SIZE_IN_BYTES);
+        }
+
+        it("should read unmapped pages as zero and drop writes to them") {
+            cpu_write_byte(cpu, 0xC000, 0x12);
+            check(memory_read(&cpu->memory, 0xC000) == 0);
+        }
+
+        it("should drop writes to ROM") {
+            rom[0x34] = 0x56;
+            memory_map_rom(&cpu->memory, 0xF0, 1, rom);
+            cpu_write_byte(cpu, 0xF034, 0x78);
+            check(memory_read(&cpu->memory, 0xF034) == 0x56);
+            check(rom[0x34] == 0x56);
+        }
+
+        it("should share storage between mirrors") {
+            memory_map_ram(&cpu->memory, 0x20, 8, cpu->memory.data);
+            cpu_write_byte(cpu, 0x2010, 0x9A);
+            check(cpu->memory.data[0x10] == 0x9A);
+            check(cpu->memory.home_pages[0x20] == 0x00);
+        }
+
+        it("should zero RAM on reset through mirrors left when their home page is unmapped") {
+            memory_map_ram(&cpu->memory, 0x08, 1, cpu->memory.data);
+            cpu_write_byte(cpu, 0x0820, 0x34);
+            memory_map_device(&cpu->memory, 0x00, 1, read_latch, write_latch, &latch);
+            check(cpu->memory.home_pages[0x08] == 0x08);
+
+            cpu_write_byte(cpu, 0x0810, 0x12);
+            cpu_reset(cpu);
+            check(memory_read(&cpu->memory, 0x0810) == 0);
+            check(memory_read(&cpu->memory, 0x0820) == 0);
+        }
+
+        it("should call device callbacks for device pages") {
+            memory_map_device(&cpu->memory, 0xD0, 1, read_latch, write_latch, &latch);
+
+            cpu_write_byte(cpu, 0xD012, 0x81);
+            cpu->memory.data[0] = LDA_ABS;
+            cpu->memory.data[1] = 0x12;
+            cpu->memory.data[2] = 0xD0;
+            cpu_run(cpu, 4);
+            check(latch == 0x81);
+            check(latch_reads == 1);
+            check(cpu->accumulator == 0x81);
+            check(flags_negative(&cpu->flags));
+        }
+
+        it("should not zero RAM hidden behind ROM on reset") {
+            cpu_write_byte(cpu, 0x1234, 0x56);
+            memory_map_rom(&cpu->memory, 0x12, 1, rom);
+            cpu_reset(cpu);
+            check(cpu->memory.data[0x1234] == 0x56);
+
+            memory_map_ram(&cpu->memory, 0x12, 1, cpu->memory.data + 0x1200);
+            cpu_reset(cpu);
+            check(cpu->memory.data[0x1234] == 0);
+        }
+
+        it("should share one ROM file between instances") {
+            char path[32];
+            Byte image[0x180] = { [0x17F] = 0xEA };
+            write_temp_file(path, image, sizeof(image));
+
+            int size = 0;
+            const Byte* shared = memory_open_rom(path, &size);
+            unlink(path);
+            check(shared != NULL);
+            check(size == sizeof(image));
+
+            CPU* other = cpu_create(0x8000);
+            memory_map_rom(&cpu->memory, 0xE0, 2, shared);
+            memory_map_rom(&other->memory, 0xE0, 2, shared);
+            check(cpu->memory.read_pages[0xE1] == other->memory.read_pages[0xE1]);
+            check(memory_read(&other->memory, 0xE17F) == 0xEA);
+            // The partial last page reads as zeroes past the end of the file
+            check(memory_read(&other->memory, 0xE180) == 0);
+            cpu_write_byte(other, 0xE17F, 0);
+            check(memory_read(&cpu->memory, 0xE17F) == 0xEA);
+
+            cpu_destroy(other);
+            memory_close_rom(shared, size);
+        }
+
+        it("should decode again after a write through a mirror of the code") {
+            if(cpu->block_cache == NULL) {
+                cpu->block_cache = block_cache_create();
+            }
+            memory_map_ram(&cpu->memory, 0x20, 1, cpu->memory.data);
+            cpu->memory.data[0] = LDA_IMM;
+            cpu->memory.data[1] = 5;
+            block_cache_run(cpu->block_cache, cpu, 2);
+            cpu_write_byte(cpu, 0x2001, 7);
+            cpu->program_counter = 0;
+            block_cache_run(cpu->block_cache, cpu, 2);
+            check(cpu->accumulator == 7);
+        }
+    }
+#endif
+
+    describe("loader") {
+        static char path[32];
+
+        before_each() {
+            cpu_reset(cpu);
+        }
+
+        after_each() {
+            memory_init(&cpu->memory, cpu->memory.data, cpu->memory.SIZE_IN_BYTES);
+        }
+
+        it("should pick the format from the file extension") {
+            check(loader_format_from_path("game.NES") == LOADER_FORMAT_INES);
+            check(loader_format_from_path("monitor.ihx") == LOADER_FORMAT_HEX);
+            check(loader_format_from_path("basic.rom") == LOADER_FORMAT_RAW);
+        }
+
+        it("should map a raw image above RAM in place and start from its reset vector") {
+            static Byte rom[0x1000] = { LDA_IMM, 0x42, [0xFFC] = 0x00, [0xFFD] = 0xF0 };
+            write_temp_file(path, rom, sizeof(rom));
+            LoaderImage* image = loader_open(path, LOADER_FORMAT_RAW, LOADER_ORIGIN_TOP);
+            unlink(path);
+            check(image != NULL);
+            check(image->entry == 0xF000);
+
+            loader_load(image, cpu);
+            check(cpu->program_counter == 0xF000);
+            cpu_run(cpu, 2);
+            check(cpu->accumulator == 0x42);
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_PAGED
+            check(cpu->memory.read_pages[0xF0] == image->mapping);
+            cpu_reset(cpu);
+            check(cpu->program_counter == 0xF000);
+#endif
+            loader_close(image);
+        }
+
+        it("should copy a raw image on RAM and give it a reset vector") {
+            Byte program[] = { LDX_IMM, 0x07 };
+            write_temp_file(path, program, sizeof(program));
+            LoaderImage* image = loader_open(path, LOADER_FORMAT_RAW, 0x0201);
+            unlink(path);
+
+            loader_load(image, cpu);
+            check(cpu->memory.data[0x0201] == LDX_IMM);
+            check(memory_read(&cpu->memory, 0xFFFC) == 0x01);
+            check(memory_read(&cpu->memory, 0xFFFD) == 0x02);
+            cpu_run(cpu, 2);
+            check(cpu->idx_reg_x == 0x07);
+
+            // A reset clears the copy, and the vector too unless it went onto a ROM page
+            cpu_reset(cpu);
+            check(cpu->memory.data[0x0201] == 0);
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_PAGED
+            check(cpu->program_counter == 0x0201);
+#else
+            check(cpu->program_counter == 0x0000);
+#endif
+            loader_load(image, cpu);
+            loader_close(image);
+            check(cpu->program_counter == 0x0201);
+            cpu_run(cpu, 2);
+            check(cpu->idx_reg_x == 0x07);
+        }
+
+        it("should parse Intel HEX records and reject a bad checksum") {
+            const char* text = ":02100000A955F0\r\n:0400000500001000E7\r\n:00000001FF\r\n";
+            write_temp_file(path, text, strlen(text));
+            LoaderImage* image = loader_open(path, LOADER_FORMAT_HEX, LOADER_ORIGIN_TOP);
+            unlink(path);
+            check(image != NULL);
+            check(image->entry == 0x1000);
+            loader_load(image, cpu);
+            loader_close(image);
+            cpu_run(cpu, 2);
+            check(cpu->accumulator == 0x55);
+
+            const char* corrupt = ":02100000A956F0\n:00000001FF\n";
+            write_temp_file(path, corrupt, strlen(corrupt));
+            check(loader_open(path, LOADER_FORMAT_HEX, LOADER_ORIGIN_TOP) == NULL);
+            unlink(path);
+        }
+
+        it("should mirror a single iNES PRG bank at $8000 and $C000") {
+            static Byte file[LOADER_INES_HEADER_SIZE + LOADER_INES_BANK_SIZE] = { 'N', 'E', 'S', 0x1A, 1 };
+            Byte* prg = file + LOADER_INES_HEADER_SIZE;
+            prg[0] = LDY_IMM;
+            prg[1] = 0x09;
+            prg[0x3FFC] = 0x00;
+            prg[0x3FFD] = 0xC0;
+            write_temp_file(path, file, sizeof(file));
+            LoaderImage* image = loader_open(path, LOADER_FORMAT_INES, LOADER_ORIGIN_TOP);
+            unlink(path);
+            check(image != NULL);
+            check(image->entry == 0xC000);
+
+            loader_load(image, cpu);
+            check(memory_read(&cpu->memory, 0x8001) == 0x09);
+            check(memory_read(&cpu->memory, 0xC001) == 0x09);
+            cpu_run(cpu, 2);
+            check(cpu->idx_reg_y == 0x09);
+            loader_close(image);
+        }
+    }
+
+    describe("block cache") {
+
+        before_each() {
+            cpu_reset(cpu);
+            if(cpu->block_cache == NULL) {
+                cpu->block_cache = block_cache_create();
+            }
+
+            cpu->memory.data[0] = LDA_IMM;
+            cpu->memory.data[1] = 5;
+            cpu->memory.data[2] = LDX_IMM;
+            cpu->memory.data[3] = 6;
+        }
+
+        it("should run a predecoded block like cpu_run") {
+            int cycles = block_cache_run(cpu->block_cache, cpu, 4);
+            check(cycles == 4);
+            check(cpu->accumulator == 5);
+            check(cpu->idx_reg_x == 6);
+            check(cpu->program_counter == 4);
+        }
+
+        it("should stop in the middle of a block when the budget runs out") {
+            block_cache_run(cpu->block_cache, cpu, 1);
+            check(cpu->accumulator == 5);
+            check(cpu->idx_reg_x == 0);
+            check(cpu->program_counter == 2);
+        }
+
+        it("should reuse a decoded block") {
+            block_cache_run(cpu->block_cache, cpu, 4);
+            cpu->program_counter = 0;
+            block_cache_run(cpu->block_cache, cpu, 4);
+            check(cpu->block_cache->hits == 1);
+            check(cpu->block_cache->misses == 1);
+        }
+
+        it("should decode again after a write into the block") {
+            block_cache_run(cpu->block_cache, cpu, 4);
+            cpu_write_byte(cpu, 1, 7);
+            cpu->program_counter = 0;
+            block_cache_run(cpu->block_cache, cpu, 4);
+            check(cpu->accumulator == 7);
+            check(cpu->block_cache->invalidations == 1);
+            check(cpu->block_cache->misses == 2);
+        }
+    }
+
+    describe("snapshot") {
+        static Snapshot* snapshot = NULL;
+
+        before_each() {
+            cpu_reset(cpu);
+            snapshot = snapshot_create();
+            cpu->accumulator = 0x11;
+            flags_set_carry(&cpu->flags, true);
+            cpu_write_byte(cpu, 0x0100, 0x22);
+            snapshot_take(snapshot, cpu);
+        }
+
+        after_each() {
+            snapshot_destroy(snapshot);
+        }
+
+        it("should restore registers, flags and written pages") {
+            cpu->accumulator = 0x33;
+            flags_set_carry(&cpu->flags, false);
+            cpu->program_counter = 0x1234;
+            cpu_write_byte(cpu, 0x0100, 0x44);
+            cpu_write_byte(cpu, 0x1000, 0x55);
+            snapshot_restore(snapshot, cpu);
+
+            check(cpu->accumulator == 0x11);
+            check(flags_carry(&cpu->flags));
+            check(cpu->program_counter == 0);
+            check(cpu->memory.data[0x0100] == 0x22);
+            check(cpu->memory.data[0x1000] == 0);
+        }
+
+        it("should only copy pages written since the last snapshot") {
+            unsigned long long full = snapshot->pages_copied;
+            check(full == cpu->memory.SIZE_IN_BYTES / MEMORY_PAGE_SIZE);
+
+            cpu_write_byte(cpu, 0x0200, 0x66);
+            snapshot_take(snapshot, cpu);
+            check(snapshot->pages_copied == full + 1);
+
+            cpu_write_byte(cpu, 0x0300, 0x77);
+            cpu_write_byte(cpu, 0x0301, 0x78);
+            snapshot_restore(snapshot, cpu);
+            check(snapshot->pages_copied == full + 2);
+            check(cpu->memory.data[0x0200] == 0x66);
+            check(cpu->memory.data[0x0300] == 0);
+        }
+
+        it("should copy everything for a snapshot that is not the latest") {
+            Snapshot* later = snapshot_create();
+            cpu_write_byte(cpu, 0x0100, 0x44);
+            snapshot_take(later, cpu);
+            snapshot_restore(snapshot, cpu);
+            check(cpu->memory.data[0x0100] == 0x22);
+            check(snapshot->pages_copied == 2 * (cpu->memory.SIZE_IN_BYTES / MEMORY_PAGE_SIZE));
+            snapshot_destroy(later);
+        }
+
+        it("should restore pages cleared by a reset") {
+            cpu_reset(cpu);
+            snapshot_restore(snapshot, cpu);
+            check(cpu->memory.data[0x0100] == 0x22);
+        }
+    }
+
+    describe("scheduler") {
+        static Scheduler* scheduler = NULL;
+        static int ids[] = { 0, 1, 2 };
+
+        before_each() {
+            cpu_reset(cpu);
+            for(int i = 0; i < MEMORY_SIZE_IN_BYTES; i += 2) {
+                cpu->memory.data[i] = LDA_IMM;
+            }
+            scheduler = scheduler_create();
+            cpu->scheduler = scheduler;
+            fired_count = 0;
+        }
+
+        after_each() {
+            cpu->scheduler = NULL;
+            scheduler_destroy(scheduler);
+        }
+
+        it("should fire events in cycle order at the next instruction boundary") {
+            u64 start = cpu->clock;
+            scheduler_add(scheduler, start + 5, record_event, &ids[0]);
+            scheduler_add(scheduler, start + 3, record_event, &ids[1]);
+            scheduler_add(scheduler, start + 3, record_event, &ids[2]);
+
+            check(cpu_run(cpu, 10) == 10);
+            check(cpu->clock == start + 10);
+            check(fired_count == 3);
+            check(fired_events[0] == 1 && fired_clocks[0] == start + 4);
+            check(fired_events[1] == 2 && fired_clocks[1] == start + 4);
+            check(fired_events[2] == 0 && fired_clocks[2] == start + 6);
+        }
+
+        it("should let an event schedule its next occurrence") {
+            scheduler_add(scheduler, cpu->clock + 4, repeat_event, scheduler);
+            check(cpu_run(cpu, 20) == 20);
+            check(fired_count == 5);
+            check(scheduler->count == 1);
+            check(scheduler->events[0].when == cpu->clock + 4);
+        }
+
+        it("should not fire cancelled events") {
+            scheduler_add(scheduler, cpu->clock + 2, record_event, &ids[0]);
+            scheduler_add(scheduler, cpu->clock + 4, record_event, &ids[1]);
+            check(scheduler_cancel(scheduler, record_event, &ids[0]));
+            check(!scheduler_cancel(scheduler, record_event, &ids[0]));
+
+            cpu_run(cpu, 8);
+            check(fired_count == 1);
+            check(fired_events[0] == 1);
+            check(scheduler->count == 0);
+        }
+    }
+
+    describe("interrupts") {
+        static Byte vectors[0x100];
+
+        before_each() {
+            memset(vectors, 0, sizeof(vectors));
+            vectors[0xFA] = 0x00;
+            vectors[0xFB] = 0x03;
+            vectors[0xFE] = 0x00;
+            vectors[0xFF] = 0x02;
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_PAGED
+            memory_map_rom(&cpu->memory, 0xFF, 1, vectors);
+#else
+            memcpy(cpu->memory.data + 0xFF00, vectors, sizeof(vectors));
+#endif
+            cpu_reset(cpu);
+            for(int i = 0; i < 0x20; i += 2) {
+                cpu->memory.data[i] = LDA_IMM;
+            }
+            // IRQ and BRK handler at $0200, NMI handler at $0300
+            Byte irq[] = { LDX_IMM, 0x42, RTI };
+            Byte nmi[] = { LDY_IMM, 0x24, RTI };
+            memcpy(cpu->memory.data + 0x200, irq, sizeof(irq));
+            memcpy(cpu->memory.data + 0x300, nmi, sizeof(nmi));
+        }
+
+        it("should take an IRQ at the first instruction boundary after it is raised") {
+            Scheduler* scheduler = scheduler_create();
+            cpu->scheduler = scheduler;
+            scheduler_add(scheduler, cpu->clock + 3, raise_irq, NULL);
+
+            check(cpu_run(cpu, 4 + CPU_INTERRUPT_CYCLES + 2) == 13);
+            cpu->scheduler = NULL;
+            scheduler_destroy(scheduler);
+            check(cpu->idx_reg_x == 0x42);
+            check(cpu->program_counter == 0x0202);
+            check(cpu->stack_pointer == 0xFD);
+            check(cpu->memory.data[0x100] == 0x00 && cpu->memory.data[0x1FF] == 0x04);
+            check(!(cpu->memory.data[0x1FE] & FLAG_BREAK_COMMAND));
+            check(flags_interrupt_disable(&cpu->flags));
+        }
+
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_PAGED
+        it("should take an IRQ right after the instruction whose read raised it") {
+            memory_map_device(&cpu->memory, 0xD0, 1, irq_on_read, NULL, cpu);
+            cpu->memory.data[0] = LDA_ABS;
+            cpu->memory.data[1] = 0x00;
+            cpu->memory.data[2] = 0xD0;
+
+            check(cpu_run(cpu, 4 + CPU_INTERRUPT_CYCLES + 2) == 13);
+            check(cpu->accumulator == 0x99);
+            check(cpu->idx_reg_x == 0x42);
+            check(cpu->memory.data[0x1FF] == 0x03);
+        }
+#endif
+
+        it("should return from BRK past its padding byte") {
+            cpu->memory.data[0] = BRK;
+            check(cpu_run(cpu, CPU_INTERRUPT_CYCLES + 2 + 6) == 15);
+            check(cpu->program_counter == 0x0002);
+            check(cpu->idx_reg_x == 0x42);
+            check(cpu->stack_pointer == 0x00);
+            check(cpu->memory.data[0x1FE] & FLAG_BREAK_COMMAND);
+            check(!flags_interrupt_disable(&cpu->flags));
+        }
+
+        it("should take a held IRQ again as soon as RTI unmasks it") {
+            cpu_set_irq(cpu, 1, true);
+            check(cpu_run(cpu, CPU_INTERRUPT_CYCLES + 2 + 6 + 1) == 22);
+            check(cpu->program_counter == 0x0200);
+            check(cpu->accumulator == 0);
+
+            cpu_set_irq(cpu, 1, false);
+            cpu_run(cpu, 2 + 6);
+            check(cpu->program_counter == 0x0000);
+        }
+
+        it("should mask IRQs while I is set but not NMIs") {
+            flags_set_interrupt_disable(&cpu->flags, true);
+            cpu_set_irq(cpu, 1, true);
+            cpu_run(cpu, 4);
+            check(cpu->program_counter == 0x0004);
+
+            cpu_nmi(cpu);
+            check(cpu_run(cpu, CPU_INTERRUPT_CYCLES + 2) == 9);
+            check(cpu->idx_reg_y == 0x24);
+            check(!cpu->nmi_pending);
+        }
+    }
+
+    describe("trace") {
+        it("should save and load records with their full clocks") {
+            TraceRing* ring = trace_create();
+            u32 clocks[] = { 0xFFFFFFFE, 0x00000003, 0x00000009 };
+            for(int i = 0; i < 3; i++) {
+                ring->records[i] = (TraceRecord){ .clock = clocks[i], .program_counter = 0x0202 + 2 * i, .opcode = LDA_IMM, .operand = i };
+            }
+            ring->written = 3;
+
+            char path[] = "/tmp/6502_spec_XXXXXX";
+            int file = mkstemp(path);
+            check(trace_save(ring, 0x10000000CULL, file));
+            close(file);
+            trace_destroy(ring);
+
+            int count;
+            u64 clock;
+            TraceRecord* records = trace_load(path, &count, &clock);
+            unlink(path);
+            check(records != NULL);
+            check(count == 3 && clock == 0x10000000CULL);
+            check(trace_address(&records[2]) == 0x0204 && records[2].operand == 2);
+
+            FILE* out = tmpfile();
+            trace_print(out, records, count, clock);
+            rewind(out);
+            char line[128];
+            check(fgets(line, sizeof(line), out) != NULL && strstr(line, "  4294967294  0200  A9 00     LDA #$00") == line);
+            check(fgets(line, sizeof(line), out) != NULL && strncmp(line, "  4294967299", 12) == 0);
+            check(fgets(line, sizeof(line), out) != NULL && strncmp(line, "  4294967305", 12) == 0);
+            fclose(out);
+            free(records);
+        }
+
+        it("should keep the newest records when the ring wraps") {
+            TraceRing* ring = trace_create();
+            for(int i = 0; i < TRACE_RING_RECORDS + 10; i++) {
+                ring->records[i % TRACE_RING_RECORDS].clock = i;
+            }
+            ring->written = TRACE_RING_RECORDS + 10;
+
+            static TraceRecord records[TRACE_RING_RECORDS];
+            check(trace_copy(ring, records) == TRACE_RING_RECORDS - 1);
+            check(records[0].clock == 11);
+            check(records[TRACE_RING_RECORDS - 2].clock == TRACE_RING_RECORDS + 9);
+            trace_destroy(ring);
+        }
+
+#if CPU_TRACE == CPU_TRACE_ON
+        it("should record every instruction with the registers and clock it started with") {
+            cpu_reset(cpu);
+            Byte program[] = { LDA_IMM, 0x80, LDX_ZERO, 0x10, JMP_ABS, 0x00, 0x00 };
+            memcpy(cpu->memory.data, program, sizeof(program));
+            cpu->memory.data[0x10] = 0x07;
+            u64 start = cpu->clock;
+            cpu_run(cpu, 8);
+
+            static TraceRecord records[TRACE_RING_RECORDS];
+            check(trace_copy(cpu->trace, records) == 3);
+            check(trace_address(&records[0]) == 0x0000 && records[0].opcode == LDA_IMM && records[0].operand == 0x80);
+            check(records[0].clock == (u32)start && records[0].accumulator == 0x00);
+            check(trace_address(&records[1]) == 0x0002 && records[1].clock == (u32)(start + 2));
+            check(records[1].accumulator == 0x80 && (records[1].status & FLAG_NEGATIVE));
+            check(trace_address(&records[2]) == 0x0004 && records[2].opcode == JMP_ABS);
+            check(records[2].operand == 0x0000);
+            check(records[2].idx_reg_x == 0x07 && records[2].clock == (u32)(start + 5));
+        }
+
+        it("should keep the last instructions of a long run") {
+            cpu_reset(cpu);
+            for(int i = 0; i < MEMORY_SIZE_IN_BYTES - 4; i += 2) {
+                cpu->memory.data[i] = LDA_IMM;
+            }
+            Byte* back = cpu->memory.data + MEMORY_SIZE_IN_BYTES - 4;
+            back[0] = JMP_ABS;
+            back[1] = 0x00;
+            back[2] = 0x00;
+            cpu_run(cpu, 3 * TRACE_RING_RECORDS);
+
+            static TraceRecord records[TRACE_RING_RECORDS];
+            // The oldest slot is the next to be written, so a copy leaves it out
+            int count = trace_copy(cpu->trace, records);
+            check(count == TRACE_RING_RECORDS - 1);
+            for(int i = 1; i < count; i++) {
+                check(records[i].clock - records[i - 1].clock == opcode_cycles[records[i - 1].opcode]);
+            }
+            const TraceRecord* last = &records[count - 1];
+            check(last->clock + opcode_cycles[last->opcode] == (u32)cpu->clock);
+        }
+
+        it("should stream a run to a file that reads back from anywhere") {
+            cpu_reset(cpu);
+            for(int i = 0; i < MEMORY_SIZE_IN_BYTES - 4; i += 2) {
+                cpu->memory.data[i] = LDA_IMM;
+                cpu->memory.data[i + 1] = i >> 1;
+            }
+            Byte* back = cpu->memory.data + MEMORY_SIZE_IN_BYTES - 4;
+            back[0] = JMP_ABS;
+            back[1] = 0x00;
+            back[2] = 0x00;
+            char path[] = "/tmp/6502_spec_stream_XXXXXX";
+            close(mkstemp(path));
+            TraceSink* sink = trace_sink_open(cpu, path);
+            check(sink != NULL);
+            u64 start = cpu->clock;
+
+            // A batch at a time, letting the writer catch up so that nothing is dropped
+            for(int i = 0; i < 80; i++) {
+                cpu_run(cpu, TRACE_SINK_BATCH_RECORDS * 2);
+                while(__atomic_load_n(&sink->queue.head, __ATOMIC_ACQUIRE) != sink->queue.tail) {
+                    usleep(100);
+                }
+            }
+            u64 run = cpu->trace->written;
+            static TraceRecord records[TRACE_RING_RECORDS];
+            int count = trace_copy(cpu->trace, records);
+            check(trace_sink_close(sink));
+
+            TraceReader* reader = trace_reader_open(path);
+            check(reader != NULL);
+            check(reader->records == run && reader->dropped == 0);
+            check(reader->index_count == (run + TRACE_SINK_KEYFRAME_INTERVAL - 1) / TRACE_SINK_KEYFRAME_INTERVAL);
+
+            TraceRecord record, last;
+            u64 clock, last_clock = 0;
+            for(u64 n = 0; n < run; n++) {
+                check(trace_reader_next(reader, &record, &clock));
+                if(n == 0) {
+                    check(clock == start && trace_address(&record) == 0x0000);
+                } else {
+                    check(clock == last_clock + opcode_cycles[last.opcode]);
+                    check(record.clock == (u32)clock);
+                    check(trace_address(&record) == (last.opcode == JMP_ABS ? last.operand : last.program_counter));
+                    check(last.opcode != LDA_IMM || record.accumulator == last.operand);
+                }
+                if(n >= run - count) {
+                    check(memcmp(&record, &records[n - (run - count)], sizeof(record)) == 0);
+                }
+                last = record;
+                last_clock = clock;
+            }
+            check(!trace_reader_next(reader, &record, &clock));
+            check(last_clock + opcode_cycles[last.opcode] == cpu->clock);
+
+            // Just past a keyframe, and the last record
+            const u64 seeks[] = { TRACE_SINK_KEYFRAME_INTERVAL + 5, run - 1 };
+            for(int i = 0; i < 2; i++) {
+                check(trace_reader_seek(reader, seeks[i]));
+                check(trace_reader_next(reader, &record, &clock));
+                check(record.clock == (u32)clock);
+                check(i == 0 || memcmp(&record, &last, sizeof(record)) == 0);
+            }
+            check(trace_reader_seek(reader, TRACE_SINK_KEYFRAME_INTERVAL + 5));
+            trace_reader_next(reader, &last, &last_clock);
+            check(trace_reader_seek(reader, TRACE_SINK_KEYFRAME_INTERVAL + 4));
+            trace_reader_next(reader, &record, &clock);
+            check(last_clock == clock + opcode_cycles[record.opcode]);
+            check(!trace_reader_seek(reader, run + 1));
+            trace_reader_close(reader);
+            unlink(path);
+        }
+#else
+        it("should have no trace to stream") {
+            check(trace_sink_open(cpu, "/tmp/6502_spec_no_stream") == NULL);
+        }
+#endif
+    }
+
+    describe("profile") {
+        // Two passes of LDX #$20, LDA $00F0,X (crossing into page 1), LDA $0100,X and JMP $0000
+        static Byte program[] = { LDX_IMM, 0x20, LDA_ABS_X, 0xF0, 0x00, LDA_ABS_X, 0x00, 0x01, JMP_ABS, 0x00, 0x00 };
+
+        it("should export the counters as CSV, JSON and an annotated listing") {
+            Profile* profile = profile_create();
+            profile->opcodes[LDA_ABS_X] = (ProfileOpcode){ 4, 18 };
+            profile->opcodes[JMP_ABS] = (ProfileOpcode){ 2, 6 };
+            profile->addresses[0x0002] = 2;
+            profile->addresses[0x0005] = 2;
+            profile->addresses[0x0008] = 2;
+            profile->addresses[0x0100] = 2;
+            memcpy(cpu->memory.data, program, sizeof(program));
+            check(profile_page_crosses(profile, LDA_ABS_X) == 2 && profile_page_crosses(profile, JMP_ABS) == 0);
+
+            FILE* out = tmpfile();
+            char line[128];
+            profile_write_opcodes_csv(profile, out);
+            rewind(out);
+            check(fgets(line, sizeof(line), out) != NULL && strcmp(line, "opcode,mnemonic,mode,executions,cycles,page_crosses\n") == 0);
+            check(fgets(line, sizeof(line), out) != NULL && strcmp(line, "0x4C,JMP,absolute,2,6,0\n") == 0);
+            check(fgets(line, sizeof(line), out) != NULL && strcmp(line, "0xBD,LDA,absolute_x,4,18,2\n") == 0);
+            check(fgets(line, sizeof(line), out) == NULL);
+            fclose(out);
+
+            out = tmpfile();
+            profile_write_json(profile, out);
+            rewind(out);
+            static char json[1024];
+            json[fread(json, 1, sizeof(json) - 1, out)] = '\0';
+            check(strstr(json, "\"instructions\": 6,\n  \"cycles\": 24,") != NULL);
+            check(strstr(json, "{\"opcode\": 189, \"mnemonic\": \"LDA\", \"mode\": \"absolute_x\", \"executions\": 4, \"cycles\": 18, \"page_crosses\": 2}\n") != NULL);
+            check(strstr(json, "{\"address\": 256, \"executions\": 2}\n  ]\n}") != NULL);
+            fclose(out);
+
+            out = tmpfile();
+            profile_write_listing(profile, &cpu->memory, out);
+            rewind(out);
+            check(fgets(line, sizeof(line), out) != NULL && strcmp(line, "; 6 instructions, 24 cycles\n") == 0);
+            check(fgets(line, sizeof(line), out) != NULL && fgets(line, sizeof(line), out) != NULL && strcmp(line, "\n") == 0);
+            check(fgets(line, sizeof(line), out) != NULL && strcmp(line, "             2   33.33           8     0002  BD F0 00  LDA $00F0,X\n") == 0);
+            check(fgets(line, sizeof(line), out) != NULL && strstr(line, "0005  BD 00 01  LDA $0100,X\n") != NULL);
+            check(fgets(line, sizeof(line), out) != NULL && strstr(line, "          6     0008  4C 00 00  JMP $0000\n") != NULL);
+            // Not following on from the JMP, so a block of its own
+            check(fgets(line, sizeof(line), out) != NULL && strcmp(line, "\n") == 0);
+            check(fgets(line, sizeof(line), out) != NULL && strstr(line, "0100  00        BRK\n") != NULL);
+            fclose(out);
+            profile_destroy(profile);
+        }
+
+#if CPU_PROFILE == CPU_PROFILE_ON
+        it("should count every instruction by opcode and address with the cycles it took") {
+            cpu_reset(cpu);
+            memcpy(cpu->memory.data, program, sizeof(program));
+            check(cpu_run(cpu, 28) == 28);
+
+            const Profile* profile = cpu->profile;
+            check(profile->opcodes[LDX_IMM].executions == 2 && profile->opcodes[LDX_IMM].cycles == 4);
+            check(profile->opcodes[LDA_ABS_X].executions == 4 && profile->opcodes[LDA_ABS_X].cycles == 18);
+            check(profile_page_crosses(profile, LDA_ABS_X) == 2);
+            check(profile->opcodes[JMP_ABS].executions == 2 && profile->opcodes[JMP_ABS].cycles == 6);
+            check(profile->addresses[0x0000] == 2 && profile->addresses[0x0002] == 2);
+            check(profile->addresses[0x0005] == 2 && profile->addresses[0x0008] == 2);
+            check(profile->addresses[0x0001] == 0 && profile->addresses[0x000B] == 0);
+        }
+#endif
+    }
+
+    describe("call stack") {
+        static Byte vectors[0x100];
+
+        before_each() {
+            memset(vectors, 0, sizeof(vectors));
+            vectors[0xFE] = 0x00;
+            vectors[0xFF] = 0x06;
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_PAGED
+            memory_map_rom(&cpu->memory, 0xFF, 1, vectors);
+#else
+            memcpy(cpu->memory.data + 0xFF00, vectors, sizeof(vectors));
+#endif
+            cpu_reset(cpu);
+            // $0000 calls $0400, which calls $0500, which breaks into the handler at $0600
+            Byte main[] = { JSR_ABS, 0x00, 0x04, JMP_ABS, 0x00, 0x00 };
+            Byte outer[] = { JSR_ABS, 0x00, 0x05, RTS };
+            Byte inner[] = { BRK, 0x00, RTS };
+            memcpy(cpu->memory.data, main, sizeof(main));
+            memcpy(cpu->memory.data + 0x400, outer, sizeof(outer));
+            memcpy(cpu->memory.data + 0x500, inner, sizeof(inner));
+            cpu->memory.data[0x600] = RTI;
+            cpu->call_stack = calloc(1, sizeof(CallStack));
+        }
+
+        it("should push a frame for each JSR and BRK and pop it on RTS and RTI") {
+            CallStack* calls = cpu->call_stack;
+            cpu_run(cpu, 6 + 6);
+            check(calls->depth == 2);
+            check(calls->frames[0].entry == 0x0400 && calls->frames[0].kind == CALL_SUBROUTINE);
+            check(calls->frames[1].entry == 0x0500 && calls->frames[1].stack_pointer == 0xFC);
+
+            cpu_run(cpu, CPU_INTERRUPT_CYCLES);
+            check(calls->depth == 3 && calls->frames[2].entry == 0x0600 && calls->frames[2].kind == CALL_BRK);
+            cpu_run(cpu, 6);
+            check(calls->depth == 2 && cpu->program_counter == 0x0502);
+            cpu_run(cpu, 6 + 6);
+            check(calls->depth == 0 && cpu->program_counter == 0x0003);
+            check(cpu->stack_pointer == 0x00);
+        }
+
+        it("should push a frame for a taken interrupt") {
+            cpu->memory.data[0] = LDA_IMM;
+            cpu_set_irq(cpu, 1, true);
+            cpu_run(cpu, CPU_INTERRUPT_CYCLES);
+            check(cpu->call_stack->depth == 1);
+            check(cpu->call_stack->frames[0].entry == 0x0600 && cpu->call_stack->frames[0].kind == CALL_IRQ);
+        }
+
+        it("should drop frames whose return address the guest took off the stack itself") {
+            cpu_run(cpu, 6 + 6);
+            check(cpu->call_stack->depth == 2);
+            // As a TXS would, with the program going on at the top
+            cpu->stack_pointer = 0x00;
+            cpu->program_counter = 0x0000;
+            cpu_run(cpu, 6);
+            check(cpu->call_stack->depth == 1 && cpu->call_stack->frames[0].entry == 0x0400);
+            check(cpu->call_stack->frames[0].stack_pointer == 0xFE);
+        }
+
+        it("should keep as many frames as the stack page holds and count the rest") {
+            Byte recurse[] = { JSR_ABS, 0x00, 0x08 };
+            memcpy(cpu->memory.data + 0x800, recurse, sizeof(recurse));
+            cpu->program_counter = 0x0800;
+            cpu_run(cpu, 6 * (CALL_STACK_DEPTH + 2));
+            check(cpu->call_stack->depth == CALL_STACK_DEPTH && cpu->call_stack->lost == 2);
+        }
+    }
+
+    describe("sampler") {
+        static Scheduler* scheduler = NULL;
+
+        before_each() {
+            cpu_reset(cpu);
+            // A 19 cycle loop that spends cycles 0 to 10 of each pass in the subroutine at $0400
+            Byte main[] = { JSR_ABS, 0x00, 0x04, JMP_ABS, 0x00, 0x00 };
+            Byte subroutine[] = { LDA_IMM, 0x01, LDA_IMM, 0x02, RTS };
+            memcpy(cpu->memory.data, main, sizeof(main));
+            memcpy(cpu->memory.data + 0x400, subroutine, sizeof(subroutine));
+            scheduler = scheduler_create();
+            cpu->scheduler = scheduler;
+        }
+
+        after_each() {
+            cpu->scheduler = NULL;
+            scheduler_destroy(scheduler);
+        }
+
+        it("should need a scheduler") {
+            Sampler* sampler = sampler_create(100);
+            cpu->scheduler = NULL;
+            check(!sampler_start(sampler, cpu));
+            cpu->scheduler = scheduler;
+            sampler_destroy(sampler);
+        }
+
+        it("should sample the call stack every period and write it collapsed") {
+            Sampler* sampler = sampler_create(19);
+            check(sampler_start(sampler, cpu));
+            cpu_run(cpu, 19 * 50);
+            check(sampler->samples == 50 && sampler->count == 1);
+
+            // Out of step with the loop, so samples land on both sides of the call
+            sampler_stop(sampler, cpu);
+            sampler_destroy(sampler);
+            sampler = sampler_create(3 * 19 + 6);
+            sampler_start(sampler, cpu);
+            cpu_run(cpu, 19 * 600);
+            check(sampler->samples == 19 * 600 / (3 * 19 + 6) && sampler->count == 2);
+
+            FILE* out = tmpfile();
+            sampler_write_collapsed(sampler, out);
+            rewind(out);
+            char line[64];
+            unsigned long long in_subroutine, in_main;
+            check(fgets(line, sizeof(line), out) != NULL && sscanf(line, "main;sub_0400 %llu", &in_subroutine) == 1);
+            check(fgets(line, sizeof(line), out) != NULL && sscanf(line, "main %llu", &in_main) == 1);
+            check(fgets(line, sizeof(line), out) == NULL);
+            check(in_subroutine + in_main == sampler->samples && in_subroutine > in_main);
+            fclose(out);
+
+            sampler_stop(sampler, cpu);
+            check(scheduler->count == 0);
+            sampler_destroy(sampler);
+        }
+    }
+
+    describe("spin loops") {
+        static CPU* stepped = NULL;
+        // Loads from zero page and across a page boundary, then back to the start
+        static Byte program[] = {
+            LDA_ZERO, 0x10, LDY_ABS_X, 0xF0, 0x04, LDX_IMM, 0x20, JMP_ABS, 0x00, 0x00
+        };
+
+        before_each() {
+            if(stepped != NULL) {
+                cpu_destroy(stepped);
+            }
+            stepped = cpu_create(MEMORY_SIZE_IN_BYTES);
+
+            CPU* cpus[] = { cpu, stepped };
+            for(int i = 0; i < 2; i++) {
+                cpu_reset(cpus[i]);
+                memcpy(cpus[i]->memory.data, program, sizeof(program));
+                cpus[i]->memory.data[0x10] = 0x20;
+                cpus[i]->memory.data[0x510] = 0x20;
+                cpus[i]->idx_reg_x = 0x20;
+            }
+        }
+
+        after() {
+            cpu_destroy(stepped);
+            stepped = NULL;
+        }
+
+        it("should skip a JMP to itself to the end of the budget") {
+            cpu->memory.data[0] = JMP_ABS;
+            cpu->memory.data[1] = 0x00;
+            cpu->memory.data[2] = 0x00;
+            check(cpu_run(cpu, 1000) == 1002);
+            check(cpu->clock == 1002);
+            check(cpu->program_counter == 0x0000);
+            check(cpu->spin_cycles_skipped > 0);
+        }
+
+        it("should take as many cycles as running every pass") {
+            for(int budget = 1; budget < 200; budget += 7) {
+                check(cpu_run(cpu, budget) == run_one_at_a_time(stepped, budget));
+                check(cpu->clock == stepped->clock);
+                check(cpu->program_counter == stepped->program_counter);
+                check(cpu->accumulator == 0x20 && cpu->idx_reg_x == stepped->idx_reg_x);
+                check(cpu->idx_reg_y == stepped->idx_reg_y);
+            }
+            check(cpu->spin_cycles_skipped > 0);
+        }
+
+        it("should stop skipping at the next event") {
+            cpu->memory.data[0] = JMP_ABS;
+            cpu->memory.data[1] = 0x00;
+            cpu->memory.data[2] = 0x00;
+            static int id = 0;
+            Scheduler* scheduler = scheduler_create();
+            cpu->scheduler = scheduler;
+            fired_count = 0;
+            scheduler_add(scheduler, cpu->clock + 500, record_event, &id);
+
+            check(cpu_run(cpu, 1000) == 1002);
+            cpu->scheduler = NULL;
+            scheduler_destroy(scheduler);
+            check(fired_count == 1);
+            check(fired_clocks[0] == 501);
+        }
+
+        it("should not skip a loop that comes back round with other registers") {
+            // X and Y alternate between 0 and 1
+            Byte alternating[] = { LDY_ZERO_X, 0x20, LDX_ZERO_Y, 0x30, JMP_ABS, 0x00, 0x00 };
+            memcpy(cpu->memory.data, alternating, sizeof(alternating));
+            cpu->memory.data[0x20] = 0x01;
+            cpu->memory.data[0x31] = 0x01;
+            cpu->idx_reg_x = 0;
+            cpu_run(cpu, 1000);
+            check(cpu->spin_cycles_skipped == 0);
+        }
+
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_PAGED
+        it("should not skip a loop that reads a device") {
+            memory_map_device(&cpu->memory, 0xD0, 1, read_latch, write_latch, &latch);
+            latch = 0x20;
+            latch_reads = 0;
+            Byte polling[] = { LDA_ABS, 0x00, 0xD0, JMP_ABS, 0x00, 0x00 };
+            memcpy(cpu->memory.data, polling, sizeof(polling));
+
+            check(cpu_run(cpu, 70) == 70);
+            check(latch_reads == 10);
+            check(cpu->spin_cycles_skipped == 0);
+        }
+#endif
+
+        it("should skip from native code") {
+            CPU* cpus[] = { cpu, stepped };
+            for(int i = 0; i < 2; i++) {
+                if(cpus[i]->block_cache == NULL) {
+                    cpus[i]->block_cache = block_cache_create();
+                }
+            }
+            if(cpu->jit == NULL) {
+                cpu->jit = jit_create();
+            }
+            if(cpu->jit == NULL) {
+                return;
+            }
+            for(int budget = 1; budget < 200; budget += 7) {
+                int jit_cycles = jit_run(cpu->jit, cpu->block_cache, cpu, budget);
+                int interpreted_cycles = 0;
+                while(interpreted_cycles < budget) {
+                    interpreted_cycles += block_cache_run(stepped->block_cache, stepped, 1);
+                }
+                check(jit_cycles == interpreted_cycles);
+                check(cpu->program_counter == stepped->program_counter);
+                check(cpu->idx_reg_x == stepped->idx_reg_x);
+            }
+            check(cpu->jit->native_runs > 0);
+            check(cpu->spin_cycles_skipped > 0);
+        }
+    }
+
+    describe("batch") {
+        static CPU* lanes[4];
+        static CPU* alone[4];
+
+        before_each() {
+            for(int lane = 0; lane < 4; lane++) {
+                CPU* pair[] = { lanes[lane] = cpu_create(MEMORY_SIZE_IN_BYTES), alone[lane] = cpu_create(MEMORY_SIZE_IN_BYTES) };
+                for(int i = 0; i < 2; i++) {
+                    cpu_reset(pair[i]);
+                    Byte program[] = {
+                        LDX_ZERO, 0x10, LDA_ZERO_X, 0x20, LDY_ABS_X, 0x30, 0x00, ILLEGAL_02,
+                        LDA_IND_Y, 0x40, LDA_IMM, 0x00, JMP_ABS, 0x00, 0x00
+                    };
+                    // The last lane loads another constant, so it leaves the batch on the first pass
+                    program[11] = lane == 3 ? 0x7F : 0x00;
+                    memcpy(pair[i]->memory.data, program, sizeof(program));
+                    pair[i]->memory.data[0x10] = lane;
+                    pair[i]->memory.data[0x20 + lane] = 0x80 | lane;
+                    pair[i]->memory.data[0x30 + lane] = lane * 2;
+                    pair[i]->memory.data[0x40] = 0x50;
+                    pair[i]->memory.data[0x50 + lane * 2] = 0x60 + lane;
+                }
+            }
+        }
+
+        after_each() {
+            for(int lane = 0; lane < 4; lane++) {
+                cpu_destroy(lanes[lane]);
+                cpu_destroy(alone[lane]);
+            }
+        }
+
+        it("should leave every lane as running it alone would") {
+            Batch* batch = batch_create(lanes, 4);
+            int total = batch_run(batch, 100);
+            int expected_total = 0;
+            for(int lane = 0; lane < 4; lane++) {
+                int cycles = cpu_run(alone[lane], 100);
+                expected_total += cycles;
+                check(batch->cycles_completed[lane] == cycles);
+                check(lanes[lane]->program_counter == alone[lane]->program_counter);
+                check(lanes[lane]->accumulator == alone[lane]->accumulator);
+                check(lanes[lane]->idx_reg_x == alone[lane]->idx_reg_x);
+                check(lanes[lane]->idx_reg_y == alone[lane]->idx_reg_y);
+                check(flags_to_byte(&lanes[lane]->flags, false) == flags_to_byte(&alone[lane]->flags, false));
+            }
+            check(total == expected_total);
+            check(batch->divergences == 1);
+            batch_destroy(batch);
+        }
+
+        it("should keep lanes running the same instructions in lock step") {
+            Batch* batch = batch_create(lanes, 3);
+            batch_run(batch, 100);
+            check(batch->divergences == 0);
+            check(batch->lockstep_instructions > 0);
+            check(batch->handler_instructions > 0);
+            check(lanes[2]->idx_reg_x == 2);
+            check(lanes[2]->idx_reg_y == 4);
+            batch_destroy(batch);
+        }
+
+        it("should take lanes that cross a page when the leader does not out of lock step") {
+            for(int lane = 0; lane < 4; lane++) {
+                CPU* pair[] = { lanes[lane], alone[lane] };
+                for(int i = 0; i < 2; i++) {
+                    Byte program[] = { LDX_ZERO, 0x10, LDA_ABS_X, 0xF0, 0x02, JMP_ABS, 0x00, 0x00 };
+                    memcpy(pair[i]->memory.data, program, sizeof(program));
+                    // Lanes 2 and 3 index past $02FF
+                    pair[i]->memory.data[0x10] = lane * 0x08;
+                }
+            }
+
+            Batch* batch = batch_create(lanes, 4);
+            batch_run(batch, 100);
+            for(int lane = 0; lane < 4; lane++) {
+                check(batch->cycles_completed[lane] == cpu_run(alone[lane], 100));
+                check(lanes[lane]->program_counter == alone[lane]->program_counter);
+            }
+            check(batch->divergences == 2);
+            batch_destroy(batch);
+        }
+    }
+
+    describe("cpu pool") {
+        static CpuPool* pool = NULL;
+
+        before_each() {
+            pool = cpu_pool_create(2, MEMORY_SIZE_IN_BYTES, CPU_POOL_SMALL_PAGES);
+        }
+
+        after_each() {
+            cpu_pool_destroy(pool);
+        }
+
+        it("should hand out page aligned CPUs until every slot is taken") {
+            CPU* first = cpu_pool_acquire(pool);
+            CPU* second = cpu_pool_acquire(pool);
+            check(first != NULL && second != NULL && first != second);
+            check(cpu_pool_acquire(pool) == NULL);
+            check((size_t)first % sysconf(_SC_PAGESIZE) == 0);
+            check((size_t)first->memory.data % sysconf(_SC_PAGESIZE) == 0);
+            check(read_faults(first->memory.data - 1));
+            check(read_faults(first->memory.data + MEMORY_ADDRESS_SPACE));
+            cpu_pool_release(pool, second);
+            check(cpu_pool_acquire(pool) == second);
+        }
+
+        it("should reset a reused CPU and only zero what it wrote") {
+            CPU* first = cpu_pool_acquire(pool);
+            Byte* data = first->memory.data;
+            first->accumulator = 0x12;
+            first->program_counter = 0x3456;
+            cpu_write_byte(first, 0x0300, 0x78);
+            // Written behind the bus, so the lazy reset does not know about it
+            data[0x0500] = 0x9A;
+            cpu_pool_release(pool, first);
+
+            CPU* again = cpu_pool_acquire(pool);
+            check(again == first);
+            check(again->accumulator == 0);
+            check(again->program_counter == 0);
+            check(data[0x0300] == 0);
+            check(data[0x0500] == 0x9A);
+            check(pool->reuses == 1);
+        }
+
+        it("should refuse CPUs it did not hand out or got back already") {
+            CPU* first = cpu_pool_acquire(pool);
+            CPU* other = cpu_create(MEMORY_SIZE_IN_BYTES);
+            check(!cpu_pool_release(pool, other));
+            check(!cpu_pool_release(pool, (CPU*)((Byte*)first + 1)));
+            check(cpu_pool_release(pool, first));
+            check(!cpu_pool_release(pool, first));
+            cpu_destroy(other);
+
+            CPU* again = cpu_pool_acquire(pool);
+            CPU* second = cpu_pool_acquire(pool);
+            check(again == first && second != first);
+            check(cpu_pool_acquire(pool) == NULL);
+        }
+
+        it("should start a reused CPU's clock again") {
+            CPU* first = cpu_pool_acquire(pool);
+            Scheduler* scheduler = scheduler_create();
+            first->scheduler = scheduler;
+            first->memory.data[0] = LDA_IMM;
+            cpu_run(first, 10);
+            first->spin_cycles_skipped = 3;
+            check(first->clock >= 10);
+            cpu_pool_release(pool, first);
+
+            CPU* again = cpu_pool_acquire(pool);
+            check(again == first);
+            check(again->clock == 0);
+            check(again->scheduler == NULL);
+            check(again->spin_cycles_skipped == 0);
+            scheduler_destroy(scheduler);
+        }
+
+        it("should stop keeping the call stack of a previous user") {
+            CPU* first = cpu_pool_acquire(pool);
+            first->call_stack = calloc(1, sizeof(CallStack));
+            first->call_stack->depth = 3;
+            first->call_stack->lost = 5;
+            cpu_reset(first);
+            check(first->call_stack->depth == 0);
+            check(first->call_stack->lost == 0);
+            cpu_pool_release(pool, first);
+
+            CPU* again = cpu_pool_acquire(pool);
+            check(again == first);
+            check(again->call_stack == NULL);
+        }
+
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_PAGED
+        it("should give a reused CPU plain RAM again") {
+            static const Byte rom[MEMORY_PAGE_SIZE] = { 0xEA };
+            CPU* first = cpu_pool_acquire(pool);
+            memory_map_rom(&first->memory, 0, 1, rom);
+            check(memory_read(&first->memory, 0) == 0xEA);
+            cpu_pool_release(pool, first);
+
+            CPU* again = cpu_pool_acquire(pool);
+            cpu_write_byte(again, 0, 0x11);
+            check(memory_read(&again->memory, 0) == 0x11);
+            check(again->memory.home_pages[0] == 0);
+        }
+#endif
+    }
+
+    describe("farm") {
+        static Byte images[8][0x0210];
+        static FarmJob jobs[8];
+
+        before_each() {
+            Byte program[] = { LDX_ZERO, 0x10, LDA_ZERO_X, 0x20, LDY_ABS, 0x00, 0x02, JMP_ABS, 0x00, 0x02 };
+            for(int i = 0; i < 8; i++) {
+                memset(images[i], 0, sizeof(images[i]));
+                memcpy(&images[i][0x0200], program, sizeof(program));
+                images[i][0x10] = i;
+                images[i][0x20 + i] = 0x80 | i;
+
+                memset(&jobs[i], 0, sizeof(FarmJob));
+                jobs[i].image = images[i];
+                jobs[i].image_size = sizeof(images[i]);
+                jobs[i].cycles = 100 + i;
+                jobs[i].program_counter = 0x0200;
+                jobs[i].idx_reg_y = 0x55;
+                flags_reset(&jobs[i].flags);
+            }
+        }
+
+        it("should leave every job as a CPU of its own would") {
+            Farm* farm = farm_create(3, MEMORY_SIZE_IN_BYTES);
+            for(int i = 0; i < 8; i++) {
+                farm_submit(farm, &jobs[i]);
+            }
+
+            int returned = 0;
+            FarmJob* job;
+            while((job = farm_wait(farm)) != NULL) {
+                int i = job - jobs;
+                cpu_reset(cpu);
+                memcpy(cpu->memory.data, images[i], sizeof(images[i]));
+                cpu->program_counter = 0x0200;
+                cpu->idx_reg_y = 0x55;
+                int cycles = cpu_run(cpu, 100 + i);
+
+                check(job->cycles_completed == cycles);
+                check(job->program_counter == cpu->program_counter);
+                check(job->accumulator == cpu->accumulator);
+                check(job->idx_reg_x == i);
+                check(job->idx_reg_y == cpu->idx_reg_y);
+                check(flags_to_byte(&job->flags, false) == flags_to_byte(&cpu->flags, false));
+                returned++;
+            }
+            check(returned == 8);
+            farm_destroy(farm);
+        }
+
+        it("should call finish before the CPU runs another job") {
+            Byte results[8];
+            Farm* farm = farm_create(2, MEMORY_SIZE_IN_BYTES);
+            for(int i = 0; i < 8; i++) {
+                jobs[i].finish = copy_loaded_byte;
+                jobs[i].user = &results[i];
+                farm_submit(farm, &jobs[i]);
+            }
+            while(farm_wait(farm) != NULL) {
+            }
+            for(int i = 0; i < 8; i++) {
+                check(results[i] == (0x80 | i));
+            }
+            check(farm->workers[0].jobs_run + farm->workers[1].jobs_run == 8);
+            farm_destroy(farm);
+        }
+    }
+
+    describe("jit") {
+        static CPU* interpreted = NULL;
+
+        before_each() {
+            if(interpreted != NULL) {
+                cpu_destroy(interpreted);
+            }
+            interpreted = cpu_create(MEMORY_SIZE_IN_BYTES);
+
+            CPU* cpus[] = { cpu, interpreted };
+            for(int i = 0; i < 2; i++) {
+                cpu_reset(cpus[i]);
+                if(cpus[i]->block_cache == NULL) {
+                    cpus[i]->block_cache = block_cache_create();
+                }
+
+                Byte* data = cpus[i]->memory.data;
+                Byte program[] = {
+                    LDA_IMM, 0x80, LDX_ZERO, 0x10, LDY_ABS, 0x00, 0x04,
+                    LDA_ZERO_X, 0x0F, LDA_ABS_Y, 0xFF, 0x03, LDA_IND_Y, 0x10,
+                    JMP_ABS, 0x00, 0x00
+                };
+                memcpy(data, program, sizeof(program));
+                data[0x10] = 1;
+                data[0x400] = 0x90;
+            }
+
+            if(cpu->jit == NULL) {
+                cpu->jit = jit_create();
+            }
+        }
+
+        after() {
+            cpu_destroy(interpreted);
+            interpreted = NULL;
+        }
+
+        it("should translate hot blocks") {
+            if(cpu->jit == NULL) {
+                return;
+            }
+            jit_run(cpu->jit, cpu->block_cache, cpu, 1000);
+            check(cpu->jit->blocks_compiled == 1);
+            check(cpu->jit->native_runs > 0);
+            // Code that can run cannot be written
+            check(write_faults(cpu->jit->code));
+        }
+
+        it("should match the interpreter for every budget") {
+            for(int budget = 1; budget < 100; budget++) {
+                int jit_cycles = jit_run(cpu->jit, cpu->block_cache, cpu, budget);
+                int interpreted_cycles = block_cache_run(interpreted->block_cache, interpreted, budget);
+
+                check(jit_cycles == interpreted_cycles);
+                check(cpu->program_counter == interpreted->program_counter);
+                check(cpu->accumulator == interpreted->accumulator);
+                check(cpu->idx_reg_x == interpreted->idx_reg_x);
+                check(cpu->idx_reg_y == interpreted->idx_reg_y);
+                check(flags_zero(&cpu->flags) == flags_zero(&interpreted->flags));
+                check(flags_negative(&cpu->flags) == flags_negative(&interpreted->flags));
+            }
+        }
+
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_PAGED
+        it("should read device pages from native code") {
+            memory_map_device(&cpu->memory, 0x04, 1, read_latch, write_latch, &latch);
+            latch = 0x90;
+            interpreted->memory.data[0x48F] = 0x90;
+
+            for(int budget = 1; budget < 100; budget++) {
+                int jit_cycles = jit_run(cpu->jit, cpu->block_cache, cpu, budget);
+                int interpreted_cycles = block_cache_run(interpreted->block_cache, interpreted, budget);
+
+                check(jit_cycles == interpreted_cycles);
+                check(cpu->accumulator == interpreted->accumulator);
+                check(cpu->idx_reg_y == interpreted->idx_reg_y);
+            }
+            memory_init(&cpu->memory, cpu->memory.data, cpu->memory.SIZE_IN_BYTES);
+        }
+#endif
+    }
+
+    describe("aot translator") {
+        static AotImage* image = NULL;
+        static char* source = NULL;
+
+        before_each() {
+            Byte rom[0x1000] = {
+                LDA_IMM, 0x42, LDX_ZERO, 0x10, JMP_ABS, 0x00, 0xF0,
+                LDA_IMM, 0x01
+            };
+            rom[0xFFC] = 0x00;
+            rom[0xFFD] = 0xF0;
+
+            image = malloc(sizeof(AotImage));
+            aot_load(image, rom, sizeof(rom), 0xF000);
+        }
+
+        after_each() {
+            free(image);
+            free(source);
+            source = NULL;
+        }
+
+        it("should only translate code reachable from the reset vector") {
+            check(aot_discover(image) == 3);
+            check(image->translated[0xF000]);
+            check(image->translated[0xF004]);
+            check(!image->translated[0xF007]);
+        }
+
+        it("should emit handler calls with constant operands") {
+            size_t length;
+            FILE* out = open_memstream(&source, &length);
+            aot_discover(image);
+            aot_emit(image, out, "rom_run");
+            fclose(out);
+
+            check(strstr(source, "int rom_run(CPU* cpu, int cycles)") != NULL);
+            check(strstr(source, "CHARGE(lda_imm(cpu, 0x42));") != NULL);
+            check(strstr(source, "CHARGE(ldx_zero(cpu, 0x10));") != NULL);
+            check(strstr(source, "goto L_F000;") != NULL);
+            check(strstr(source, "cpu_step(cpu)") != NULL);
+            check(strstr(source, "return cpu_run_engine(cpu, cycles, rom_run_engine);") != NULL);
+        }
+    }
+
+    describe("aot generated code") {
+        static LoaderImage* image = NULL;
+        static int id = 0;
+
+        /*
+            spec/aot_rom.bin, at $FFF0:
+            $FFF0 LDA #$01, JMP $FFF0 from reset and $FFF5 LDX #$02, JMP $FFF5 from NMI and IRQ
+        */
+        before_each() {
+            cpu_reset(cpu);
+            image = loader_open("spec/aot_rom.bin", LOADER_FORMAT_RAW, LOADER_ORIGIN_TOP);
+            loader_load(image, cpu);
+            fired_count = 0;
+        }
+
+        after_each() {
+            memory_init(&cpu->memory, cpu->memory.data, cpu->memory.SIZE_IN_BYTES);
+            loader_close(image);
+        }
+
+        it("should fire scheduled events at their cycle") {
+            Scheduler* scheduler = scheduler_create();
+            cpu->scheduler = scheduler;
+            u64 start = cpu->clock;
+            scheduler_add(scheduler, start + 4, record_event, &id);
+
+            int cycles = spec_rom_run(cpu, 20);
+            check(cpu->clock == start + cycles);
+            check(fired_count == 1);
+            check(fired_clocks[0] == start + 5);
+
+            cpu->scheduler = NULL;
+            scheduler_destroy(scheduler);
+        }
+
+        it("should take an interrupt already pending when it is called") {
+            cpu_set_irq(cpu, 1, true);
+            spec_rom_run(cpu, 20);
+            cpu_set_irq(cpu, 1, false);
+
+            check(cpu->idx_reg_x == 0x02);
+            check(cpu->accumulator == 0x00);
+        }
     }
 
     describe("instructions") {
@@ -114,7 +1721,7 @@ spec("CPU") {
                 }
 
                 it("should take two cpu cycles to run") {
-                    int cycles = cpu_run(cpu, 10);
+                    int cycles = cpu_run(cpu, 1);
                     check(cycles == 2);
                 }
 
@@ -134,7 +1741,7 @@ spec("CPU") {
                 }
 
                 it("should take three cpu cycles to run") {
-                    int cycles = cpu_run(cpu, 10);
+                    int cycles = cpu_run(cpu, 1);
                     check(cycles == 3);
                 }
 
@@ -157,7 +1764,7 @@ spec("CPU") {
                 }
 
                 it("should take four cpu cycles to run") {
-                    int cycles = cpu_run(cpu, 10);
+                    int cycles = cpu_run(cpu, 1);
                     check(cycles == 4);
                 }
             
@@ -176,7 +1783,7 @@ spec("CPU") {
                 }
 
                 it("should take four cpu cycles to run") {
-                    int cycles = cpu_run(cpu, 10);
+                    int cycles = cpu_run(cpu, 1);
                     check(cycles == 4);
                 }
 
@@ -198,10 +1805,27 @@ spec("CPU") {
                 }
 
                 it("should take four cpu cycles to run") {
-                    int cycles = cpu_run(cpu, 10);
+                    int cycles = cpu_run(cpu, 1);
                     check(cycles == 4);
                 }
 
+                it("should take a fifth cycle to load across a page boundary") {
+                    cpu->memory.data[1] = 0xF0;
+                    cpu->memory.data[0x04F0 + OFFSET] = POS_SENTINEL;
+                    int cycles = cpu_run(cpu, 1);
+                    check(cycles == 5);
+                    check(cpu->accumulator == POS_SENTINEL);
+                }
+
+                it("should take a fifth cycle when the address wraps around to the zero page") {
+                    cpu->memory.data[1] = 0xF0;
+                    cpu->memory.data[2] = 0xFF;
+                    cpu->memory.data[(Word)(0xFFF0 + OFFSET)] = POS_SENTINEL;
+                    int cycles = cpu_run(cpu, 1);
+                    check(cycles == 5);
+                    check(cpu->accumulator == POS_SENTINEL);
+                }
+
                 NZ_AUTO_FLAGS_CHECK(DESTINATION);
             }
 
@@ -226,10 +1850,18 @@ spec("CPU") {
                 }
 
                 it("should take four cpu cycles to run") {
-                    int cycles = cpu_run(cpu, 10);
+                    int cycles = cpu_run(cpu, 1);
                     check(cycles == 4);
                 }
 
+                it("should take a fifth cycle to load across a page boundary") {
+                    cpu->memory.data[1] = 0xF0;
+                    cpu->memory.data[0x04F0 + OFFSET] = POS_SENTINEL;
+                    int cycles = cpu_run(cpu, 1);
+                    check(cycles == 5);
+                    check(cpu->accumulator == POS_SENTINEL);
+                }
+
                 NZ_AUTO_FLAGS_CHECK(DESTINATION);
             }
 
@@ -252,7 +1884,7 @@ spec("CPU") {
                 }
 
                 it("should take six cpu cycles to run") {
-                    int cycles = cpu_run(cpu, 10);
+                    int cycles = cpu_run(cpu, 1);
                     check(cycles == 6);
                 }
 
@@ -278,10 +1910,19 @@ spec("CPU") {
                 }
 
                 it("should take six cpu cycles to run") {
-                    int cycles = cpu_run(cpu, 10);
+                    int cycles = cpu_run(cpu, 1);
                     check(cycles == 5);
                 }
 
+                it("should take a sixth cycle to load across a page boundary") {
+                    cpu->memory.data[TABLE_PTR] = 0xF0;
+                    cpu->memory.data[TABLE_PTR + 1] = 0x01;
+                    cpu->memory.data[0x01F0 + OFFSET] = POS_SENTINEL;
+                    int cycles = cpu_run(cpu, 1);
+                    check(cycles == 6);
+                    check(cpu->accumulator == POS_SENTINEL);
+                }
+
                 NZ_AUTO_FLAGS_CHECK(DESTINATION);
             }
         }
@@ -300,7 +1941,7 @@ spec("CPU") {
                 }
 
                 it("should take two cpu cycles to run") {
-                    int cycles = cpu_run(cpu, 10);
+                    int cycles = cpu_run(cpu, 1);
                     check(cycles == 2);
                 }
 
@@ -320,7 +1961,7 @@ spec("CPU") {
                 }
 
                 it("should take three cpu cycles to run") {
-                    int cycles = cpu_run(cpu, 10);
+                    int cycles = cpu_run(cpu, 1);
                     check(cycles == 3);
                 }
 
@@ -343,7 +1984,7 @@ spec("CPU") {
                 }
 
                 it("should take four cpu cycles to run") {
-                    int cycles = cpu_run(cpu, 10);
+                    int cycles = cpu_run(cpu, 1);
                     check(cycles == 4);
                 }
             
@@ -367,7 +2008,7 @@ spec("CPU") {
                 }
 
                 it("should take four cpu cycles to run") {
-                    int cycles = cpu_run(cpu, 10);
+                    int cycles = cpu_run(cpu, 1);
                     check(cycles == 4);
                 }
 
@@ -394,10 +2035,18 @@ spec("CPU") {
                 }
 
                 it("should take four cpu cycles to run") {
-                    int cycles = cpu_run(cpu, 10);
+                    int cycles = cpu_run(cpu, 1);
                     check(cycles == 4);
                 }
 
+                it("should take a fifth cycle to load across a page boundary") {
+                    cpu->memory.data[1] = 0xF0;
+                    cpu->memory.data[0x08F0 + OFFSET] = POS_SENTINEL;
+                    int cycles = cpu_run(cpu, 1);
+                    check(cycles == 5);
+                    check(cpu->idx_reg_x == POS_SENTINEL);
+                }
+
                 NZ_AUTO_FLAGS_CHECK(DESTINATION + OFFSET);
             }
         }
@@ -416,7 +2065,7 @@ spec("CPU") {
                 }
 
                 it("should take two cpu cycles to run") {
-                    int cycles = cpu_run(cpu, 10);
+                    int cycles = cpu_run(cpu, 1);
                     check(cycles == 2);
                 }
 
@@ -436,7 +2085,7 @@ spec("CPU") {
                 }
 
                 it("should take three cpu cycles to run") {
-                    int cycles = cpu_run(cpu, 10);
+                    int cycles = cpu_run(cpu, 1);
                     check(cycles == 3);
                 }
 
@@ -459,7 +2108,7 @@ spec("CPU") {
                 }
 
                 it("should take four cpu cycles to run") {
-                    int cycles = cpu_run(cpu, 10);
+                    int cycles = cpu_run(cpu, 1);
                     check(cycles == 4);
                 }
             
@@ -483,7 +2132,7 @@ spec("CPU") {
                 }
 
                 it("should take four cpu cycles to run") {
-                    int cycles = cpu_run(cpu, 10);
+                    int cycles = cpu_run(cpu, 1);
                     check(cycles == 4);
                 }
 
@@ -510,12 +2159,85 @@ spec("CPU") {
                 }
 
                 it("should take four cpu cycles to run") {
-                    int cycles = cpu_run(cpu, 10);
+                    int cycles = cpu_run(cpu, 1);
                     check(cycles == 4);
                 }
 
+                it("should take a fifth cycle to load across a page boundary") {
+                    cpu->memory.data[1] = 0xF0;
+                    cpu->memory.data[0x08F0 + OFFSET] = POS_SENTINEL;
+                    int cycles = cpu_run(cpu, 1);
+                    check(cycles == 5);
+                    check(cpu->idx_reg_y == POS_SENTINEL);
+                }
+
                 NZ_AUTO_FLAGS_CHECK(DESTINATION + OFFSET);
             }
         }
+
+        describe("JSR") {
+            describe("ABS") {
+                before_each() {
+                    cpu->memory.data[0x0200] = JSR_ABS;
+                    cpu->memory.data[0x0201] = 0x00;
+                    cpu->memory.data[0x0202] = 0x04;
+                    cpu->program_counter = 0x0200;
+                }
+
+                it("should push the address of its last byte and continue at the subroutine") {
+                    cpu_run(cpu, 1);
+                    check(cpu->program_counter == 0x0400);
+                    check(cpu->stack_pointer == 0xFE);
+                    check(cpu->memory.data[0x0100] == 0x02 && cpu->memory.data[0x01FF] == 0x02);
+                }
+
+                it("should take six cpu cycles to run") {
+                    int cycles = cpu_run(cpu, 6);
+                    check(cycles == 6);
+                }
+            }
+        }
+
+        describe("RTS") {
+            before_each() {
+                cpu->memory.data[0x0200] = JSR_ABS;
+                cpu->memory.data[0x0201] = 0x00;
+                cpu->memory.data[0x0202] = 0x04;
+                cpu->memory.data[0x0400] = RTS;
+                cpu->program_counter = 0x0200;
+            }
+
+            it("should continue after the JSR that called it") {
+                cpu_run(cpu, 6 + 1);
+                check(cpu->program_counter == 0x0203);
+                check(cpu->stack_pointer == 0x00);
+            }
+
+            it("should take six cpu cycles to run") {
+                cpu_run(cpu, 6);
+                int cycles = cpu_run(cpu, 6);
+                check(cycles == 6);
+            }
+        }
+
+        describe("JMP") {
+            describe("ABS") {
+                before_each() {
+                    cpu->memory.data[0] = JMP_ABS;
+                    cpu->memory.data[1] = 0x00;
+                    cpu->memory.data[2] = 0x04;
+                }
+
+                it("should continue execution at the specified address") {
+                    cpu_run(cpu, 1);
+                    check(cpu->program_counter == 0x0400);
+                }
+
+                it("should take three cpu cycles to run") {
+                    int cycles = cpu_run(cpu, 3);
+                    check(cycles == 3);
+                }
+            }
+        }
     }
 }
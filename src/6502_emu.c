@@ -1,9 +1,186 @@
 ﻿#include "cpu.h"
 #include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
 #include "instruction.h"
+#include "loader.h"
+#include "trace.h"
+#include "trace_sink.h"
+#include "profile.h"
+#include "sampler.h"
+#include "scheduler.h"
+
+#define DEFAULT_MEMORY_SIZE 0x8000
+#define DEFAULT_CYCLES 1000
+#define DEFAULT_SAMPLE_PERIOD 1000
+
+static int usage(const char* name) {
+	fprintf(stderr, "usage: %s [--format raw|hex|ines] [--origin <hex>] [--memory <bytes>] [--cycles <n>] [--trace <n>] [--crash-trace <file>] [--stream-trace <file>] [--profile <prefix>] [--samples <file>] [--sample-period <cycles>] [image]\n", name);
+	return 1;
+}
+
+// Writes prefix.opcodes.csv, prefix.addresses.csv, prefix.json and the annotated listing prefix.lst
+static bool write_profile(CPU* cpu, const char* prefix) {
+	if(cpu->profile == NULL) {
+		fprintf(stderr, "no profile, build with PROFILE=ON\n");
+		return true;
+	}
+	static void (*const writers[])(const Profile*, FILE*) = { profile_write_opcodes_csv, profile_write_addresses_csv, profile_write_json, NULL };
+	const char* extensions[] = { "opcodes.csv", "addresses.csv", "json", "lst" };
+	bool written = true;
+	for(int i = 0; i < 4; i++) {
+		char path[4096];
+		snprintf(path, sizeof(path), "%s.%s", prefix, extensions[i]);
+		FILE* out = fopen(path, "w");
+		if(out == NULL) {
+			written = false;
+			continue;
+		}
+		if(writers[i] != NULL) {
+			writers[i](cpu->profile, out);
+		} else {
+			profile_write_listing(cpu->profile, &cpu->memory, out);
+		}
+		written = fclose(out) == 0 && written;
+	}
+	return written;
+}
+
+/*
+    Loads image into a CPU with --memory bytes of RAM (default 32 KiB, with the rest of the
+    address space left for ROM), runs it for --cycles cycles and dumps the registers. The
+    format comes from the file extension unless given; a raw image ends at $FFFF unless given
+    an origin, as with rom2c. Builds with TRACE=ON can also disassemble the last --trace
+    instructions run, save them to --crash-trace for tracedump if the emulator crashes, and
+    stream every instruction of the run to --stream-trace. Builds with PROFILE=ON write the
+    profile of the run next to --profile, see write_profile. --samples writes the guest call
+    stack every --sample-period cycles in the collapsed format of flamegraph.pl.
+*/
+static int run_image(const char* name, const char* path, int format, int origin, int memory_size, int cycles,
+        int trace_count, const char* crash_trace, const char* stream_trace, const char* profile,
+        const char* samples, int sample_period) {
+	LoaderImage* image = loader_open(path, format, origin);
+	if(image == NULL) {
+		fprintf(stderr, "%s: cannot load %s\n", name, path);
+		return 1;
+	}
+
+	CPU* cpu = cpu_create(memory_size);
+	if(cpu == NULL) {
+		fprintf(stderr, "%s: cannot allocate a CPU\n", name);
+		loader_close(image);
+		return 1;
+	}
+	cpu_reset(cpu);
+	loader_load(image, cpu);
+	printf("Loaded %s, starting at $%04X\n", path, cpu->program_counter);
+	if(crash_trace != NULL) {
+		trace_dump_on_crash(cpu, crash_trace);
+	}
+	TraceSink* sink = NULL;
+	if(stream_trace != NULL && (sink = trace_sink_open(cpu, stream_trace)) == NULL) {
+		fprintf(stderr, "%s: cannot stream a trace to %s\n", name, stream_trace);
+	}
+	Sampler* sampler = NULL;
+	if(samples != NULL) {
+		cpu->scheduler = scheduler_create();
+		sampler = sampler_create(sample_period);
+		sampler_start(sampler, cpu);
+	}
+	printf("Ran %d cycles\n", cpu_run(cpu, cycles));
+	if(sampler != NULL) {
+		FILE* out = fopen(samples, "w");
+		if(out == NULL) {
+			fprintf(stderr, "%s: cannot write %s\n", name, samples);
+		} else {
+			sampler_write_collapsed(sampler, out);
+			fclose(out);
+		}
+		sampler_stop(sampler, cpu);
+		sampler_destroy(sampler);
+		scheduler_destroy(cpu->scheduler);
+		cpu->scheduler = NULL;
+	}
+	if(sink != NULL && !trace_sink_close(sink)) {
+		fprintf(stderr, "%s: cannot write %s\n", name, stream_trace);
+	}
+	cpu_dump_state(cpu);
+	if(trace_count > 0) {
+		printf("\n******Trace******\n");
+		trace_dump(cpu, stdout, trace_count);
+	}
+	if(profile != NULL && !write_profile(cpu, profile)) {
+		fprintf(stderr, "%s: cannot write the profile to %s.*\n", name, profile);
+	}
+
+	cpu_destroy(cpu);
+	loader_close(image);
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	const char* path = NULL;
+	int format = -1;
+	int origin = LOADER_ORIGIN_TOP;
+	int memory_size = DEFAULT_MEMORY_SIZE;
+	int cycles = DEFAULT_CYCLES;
+	int trace_count = 0;
+	const char* crash_trace = NULL;
+	const char* stream_trace = NULL;
+	const char* profile = NULL;
+	const char* samples = NULL;
+	int sample_period = DEFAULT_SAMPLE_PERIOD;
+	for(int i = 1; i < argc; i++) {
+		if(argv[i][0] != '-') {
+			path = argv[i];
+		} else if(i + 1 == argc) {
+			return usage(argv[0]);
+		} else if(strcmp(argv[i], "--format") == 0) {
+			const char* formats[] = { "raw", "hex", "ines" };
+			for(int f = 0; f < 3; f++) {
+				if(strcmp(argv[i + 1], formats[f]) == 0) {
+					format = f;
+				}
+			}
+			if(format < 0) {
+				return usage(argv[0]);
+			}
+			i++;
+		} else if(strcmp(argv[i], "--origin") == 0) {
+			origin = strtol(argv[++i], NULL, 16);
+		} else if(strcmp(argv[i], "--memory") == 0) {
+			memory_size = strtol(argv[++i], NULL, 0);
+		} else if(strcmp(argv[i], "--cycles") == 0) {
+			cycles = strtol(argv[++i], NULL, 0);
+		} else if(strcmp(argv[i], "--trace") == 0) {
+			trace_count = strtol(argv[++i], NULL, 0);
+		} else if(strcmp(argv[i], "--crash-trace") == 0) {
+			crash_trace = argv[++i];
+		} else if(strcmp(argv[i], "--stream-trace") == 0) {
+			stream_trace = argv[++i];
+		} else if(strcmp(argv[i], "--profile") == 0) {
+			profile = argv[++i];
+		} else if(strcmp(argv[i], "--samples") == 0) {
+			samples = argv[++i];
+		} else if(strcmp(argv[i], "--sample-period") == 0) {
+			sample_period = strtol(argv[++i], NULL, 0);
+		} else {
+			return usage(argv[0]);
+		}
+	}
+	if(sample_period <= 0) {
+		return usage(argv[0]);
+	}
+	if(path != NULL) {
+		return run_image(argv[0], path, format < 0 ? loader_format_from_path(path) : format, origin, memory_size, cycles,
+				trace_count, crash_trace, stream_trace, profile, samples, sample_period);
+	}
 
-int main() {
 	CPU* cpu = cpu_create(32);
+	if(cpu == NULL) {
+		fprintf(stderr, "%s: cannot allocate a CPU\n", argv[0]);
+		return 1;
+	}
 	cpu_reset(cpu);
 	cpu_dump_state(cpu);
     printf("Size of flags is: %ld\n", sizeof(struct Flags));
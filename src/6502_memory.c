@@ -0,0 +1,228 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "6502_memory.h"
+
+static size_t host_page_size(void) {
+    return sysconf(_SC_PAGESIZE);
+}
+
+// Maps a 64 KiB read/write region between two PROT_NONE guard pages, NULL if mmap fails
+Byte* memory_reserve(void) {
+    size_t guard = host_page_size();
+    Byte* base = mmap(NULL, MEMORY_ADDRESS_SPACE + 2 * guard, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED) {
+        return NULL;
+    }
+    if(mprotect(base + guard, MEMORY_ADDRESS_SPACE, PROT_READ | PROT_WRITE) != 0) {
+        munmap(base, MEMORY_ADDRESS_SPACE + 2 * guard);
+        return NULL;
+    }
+    return base + guard;
+}
+
+void memory_release(Byte* data) {
+    size_t guard = host_page_size();
+    munmap(data - guard, MEMORY_ADDRESS_SPACE + 2 * guard);
+}
+
+/*
+    Maps the file at path read-only and stores its length in size, NULL if it cannot be opened
+    or is empty. The mapping shares the page cache, so any number of instances can map the
+    image with memory_map_rom for the cost of loading it once. Past the end of the file the
+    last host page reads as zeroes, which covers a partial guest page.
+*/
+const Byte* memory_open_rom(const char* path, int* size) {
+    int file = open(path, O_RDONLY);
+    if(file < 0) {
+        return NULL;
+    }
+    struct stat status;
+    if(fstat(file, &status) != 0 || status.st_size == 0 || status.st_size > INT32_MAX) {
+        close(file);
+        return NULL;
+    }
+    Byte* rom = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, file, 0);
+    close(file);
+    if(rom == MAP_FAILED) {
+        return NULL;
+    }
+    *size = status.st_size;
+    return rom;
+}
+
+// Unmaps an image from memory_open_rom, once no Memory maps it any more
+void memory_close_rom(const Byte* rom, int size) {
+    munmap((void*)rom, size);
+}
+
+// Maps data (size bytes, a whole number of pages) as RAM from address 0 and leaves the rest unmapped
+void memory_init(Memory* memory, Byte* data, int size) {
+    memory->data = data;
+    memory->SIZE_IN_BYTES = size;
+    memset(memory->dirty_pages, 0, sizeof(memory->dirty_pages));
+    memset(memory->snapshot_dirty_pages, 0, sizeof(memory->snapshot_dirty_pages));
+    memory->snapshot_generation = 0;
+    memory_unmap(memory, 0, MEMORY_PAGES);
+    memory_map_ram(memory, 0, (size + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE, data);
+    // Nothing is known about what data holds yet, so the first clear or snapshot covers all of it
+    memory_mark_dirty(memory, 0, size);
+}
+
+/*
+    Sets the home pages of count pages from first_page, about to map host onwards. A page takes
+    the home of the first other page that already maps its storage, so mirrors share one. One
+    pass over the page table finds them for the whole range.
+*/
+static void memory_set_home_pages(Memory* memory, Byte first_page, int count, const Byte* host) {
+    if(first_page + count > MEMORY_PAGES) {
+        count = MEMORY_PAGES - first_page;
+    }
+    bool mirrored[MEMORY_PAGES] = { false };
+    for(int i = 0; i < count; i++) {
+        memory->home_pages[first_page + i] = first_page + i;
+    }
+    for(int page = 0; page < MEMORY_PAGES; page++) {
+        uintptr_t offset = (uintptr_t)memory->read_pages[page] - (uintptr_t)host;
+        if(memory->read_pages[page] == NULL || (page >= first_page && page < first_page + count)
+                || offset >= (uintptr_t)count * MEMORY_PAGE_SIZE || offset % MEMORY_PAGE_SIZE != 0) {
+            continue;
+        }
+        int mirror = offset / MEMORY_PAGE_SIZE;
+        if(!mirrored[mirror]) {
+            mirrored[mirror] = true;
+            memory->home_pages[first_page + mirror] = memory->home_pages[page];
+        }
+    }
+}
+
+void memory_map_ram(Memory* memory, Byte first_page, int count, Byte* host) {
+    memory_set_home_pages(memory, first_page, count, host);
+    for(int i = 0; i < count && first_page + i < MEMORY_PAGES; i++) {
+        memory->read_pages[first_page + i] = host + i * MEMORY_PAGE_SIZE;
+        memory->write_pages[first_page + i] = host + i * MEMORY_PAGE_SIZE;
+        memset(&memory->devices[first_page + i], 0, sizeof(MemoryDevice));
+    }
+}
+
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_PAGED
+void memory_map_rom(Memory* memory, Byte first_page, int count, const Byte* host) {
+    memory_set_home_pages(memory, first_page, count, host);
+    for(int i = 0; i < count && first_page + i < MEMORY_PAGES; i++) {
+        memory->read_pages[first_page + i] = (Byte*)host + i * MEMORY_PAGE_SIZE;
+        memory->write_pages[first_page + i] = NULL;
+        memset(&memory->devices[first_page + i], 0, sizeof(MemoryDevice));
+    }
+}
+
+void memory_map_device(Memory* memory, Byte first_page, int count, MemoryRead read, MemoryWrite write, void* context) {
+    memory_unmap(memory, first_page, count);
+    for(int i = 0; i < count && first_page + i < MEMORY_PAGES; i++) {
+        memory->devices[first_page + i] = (MemoryDevice){ read, write, context };
+    }
+}
+
+#endif
+
+// Sets the bit of page to in bits if the bit of page from is set
+static void copy_page_bit(u32* bits, Byte from, Byte to) {
+    if(bits[from >> 5] & 1u << (from & 31)) {
+        bits[to >> 5] |= 1u << (to & 31);
+    }
+}
+
+/*
+    Mirrors outside the range whose home was inside it take a new home among themselves, with
+    the dirty bits of the old one, or writes through them would mark a page nothing maps any
+    more and memory_clear would never zero their storage.
+*/
+void memory_unmap(Memory* memory, Byte first_page, int count) {
+    if(first_page + count > MEMORY_PAGES) {
+        count = MEMORY_PAGES - first_page;
+    }
+    for(int i = 0; i < count; i++) {
+        memory->read_pages[first_page + i] = NULL;
+        memory->write_pages[first_page + i] = NULL;
+        memory->home_pages[first_page + i] = first_page + i;
+        memset(&memory->devices[first_page + i], 0, sizeof(MemoryDevice));
+    }
+
+    Byte old_homes[MEMORY_PAGES];
+    bool moved[MEMORY_PAGES] = { false };
+    for(int page = 0; page < MEMORY_PAGES; page++) {
+        Byte home = memory->home_pages[page];
+        if((page < first_page || page >= first_page + count) && home >= first_page && home < first_page + count) {
+            old_homes[page] = home;
+            moved[page] = true;
+            memory->home_pages[page] = page;
+        }
+    }
+    // Highest first: the lowest page of each set of mirrors keeps its own home longest, so all take it
+    for(int page = MEMORY_PAGES - 1; page >= 0; page--) {
+        if(moved[page]) {
+            memory_set_home_pages(memory, page, 1, memory->read_pages[page]);
+        }
+    }
+    for(int page = 0; page < MEMORY_PAGES; page++) {
+        if(moved[page]) {
+            copy_page_bit(memory->dirty_pages, old_homes[page], memory->home_pages[page]);
+            copy_page_bit(memory->snapshot_dirty_pages, old_homes[page], memory->home_pages[page]);
+        }
+    }
+}
+
+void memory_mark_dirty(Memory* memory, Word address, int length) {
+    for(int page = address >> 8; page <= (address + length - 1) >> 8 && page < MEMORY_PAGES; page++) {
+        memory_mark_page_dirty(memory, page);
+    }
+}
+
+/*
+    Zeroes the RAM written since the last clear, it stays dirty for the next snapshot. The
+    storage a dirty page writes to is zeroed, so a page of data hidden behind ROM, a device or
+    nothing is never touched and keeps its dirty bit until it is mapped as RAM again.
+*/
+void memory_clear(Memory* memory) {
+    uintptr_t data = (uintptr_t)memory->data;
+    for(int word = 0; word < MEMORY_PAGES / 32; word++) {
+        u32 dirty = memory->dirty_pages[word];
+        u32 hidden = 0;
+        memory->snapshot_dirty_pages[word] |= dirty;
+        while(dirty != 0) {
+            int page = word * 32 + __builtin_ctz(dirty);
+            dirty &= dirty - 1;
+            uintptr_t host = (uintptr_t)memory->write_pages[page];
+            if(host == 0) {
+                hidden |= 1u << (page & 31);
+            } else if(host - data < (uintptr_t)memory->SIZE_IN_BYTES) {
+                memset((Byte*)host, 0, MEMORY_PAGE_SIZE);
+            }
+        }
+        memory->dirty_pages[word] = hidden;
+    }
+}
+
+// Slow path of memory_read: a device page, or open bus for unmapped pages
+Byte memory_read_device(Memory* memory, Word address) {
+    MemoryDevice* device = &memory->devices[address >> 8];
+    if(device->read == NULL) {
+        return 0;
+    }
+    return device->read(device->context, address);
+}
+
+// Slow path of memory_write: a device page, or a dropped write to ROM or unmapped pages
+void memory_write_device(Memory* memory, Word address, Byte value) {
+    MemoryDevice* device = &memory->devices[address >> 8];
+    if(device->write != NULL) {
+        device->write(device->context, address, value);
+    }
+}
@@ -1,11 +1,122 @@
 #include "types.h"
+#include <stddef.h>
 
 #ifndef MEMORY_H
 #define MEMORY_H
 
+// Memory layout, chosen at build time with -DMEMORY_LAYOUT=<layout>
+#define MEMORY_LAYOUT_PAGED 0
+#define MEMORY_LAYOUT_FLAT 1
+
+#ifndef MEMORY_LAYOUT
+#define MEMORY_LAYOUT MEMORY_LAYOUT_PAGED
+#endif
+
+#define MEMORY_PAGE_SIZE 256
+#define MEMORY_PAGES 256
+#define MEMORY_ADDRESS_SPACE (MEMORY_PAGE_SIZE * MEMORY_PAGES)
+
+typedef Byte (*MemoryRead)(void*, Word);
+typedef void (*MemoryWrite)(void*, Word, Byte);
+
+// Read/write callbacks for a page that is not backed by host memory
+typedef struct MemoryDevice {
+    MemoryRead read;
+    MemoryWrite write;
+    void* context;
+} MemoryDevice;
+
+/*
+    The 6502 address space as 256 pages. A page with a host pointer in read_pages/write_pages is
+    accessed directly; otherwise the access goes to the page's device. ROM pages have a read
+    pointer and no write pointer, writes to them are dropped. Pages with neither read as 0.
+    A ROM page points at the caller's storage, so one image, such as a file mapped with
+    memory_open_rom, can back any number of instances that only keep their RAM private.
+
+    Mirrors map several pages to the same host page. home_pages holds the first guest page that
+    maps each page's storage, so a write through any mirror reaches the block cache under the
+    same page as the code it overwrites.
+
+    data is the RAM mapped from address 0. It always starts a full 64 KiB reservation from
+    memory_reserve, with inaccessible guard pages on both sides, so any Word indexes it safely
+    and a stray host access past either end faults instead of corrupting the heap. Remapping a
+    page that already ran code needs a block_cache_flush.
+
+    dirty_pages has a bit for every page of data written through memory_write since the last
+    memory_clear, so a reset only zeroes what the guest touched. snapshot_dirty_pages does the
+    same since the last snapshot, see snapshot.h. Host code that writes data directly, such as a
+    loader, must call memory_mark_dirty for the range it wrote.
+
+    MEMORY_LAYOUT_FLAT makes the whole address space RAM and indexes data straight by address,
+    without the page table. ROM and device mappings are only available in the paged layout.
+*/
 typedef struct Memory {
     Byte* data;
     int SIZE_IN_BYTES;
+    Byte* read_pages[MEMORY_PAGES];
+    Byte* write_pages[MEMORY_PAGES];
+    MemoryDevice devices[MEMORY_PAGES];
+    Byte home_pages[MEMORY_PAGES];
+    u32 dirty_pages[MEMORY_PAGES / 32];
+    u32 snapshot_dirty_pages[MEMORY_PAGES / 32];
+    u32 snapshot_generation;
 } Memory;
 
-#endif
\ No newline at end of file
+Byte* memory_reserve(void);
+void memory_release(Byte*);
+void memory_init(Memory*, Byte*, int);
+void memory_map_ram(Memory*, Byte, int, Byte*);
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_PAGED
+void memory_map_rom(Memory*, Byte, int, const Byte*);
+void memory_map_device(Memory*, Byte, int, MemoryRead, MemoryWrite, void*);
+#endif
+const Byte* memory_open_rom(const char*, int*);
+void memory_close_rom(const Byte*, int);
+void memory_unmap(Memory*, Byte, int);
+void memory_mark_dirty(Memory*, Word, int);
+void memory_clear(Memory*);
+Byte memory_read_device(Memory*, Word);
+void memory_write_device(Memory*, Word, Byte);
+
+// Forced inline, the dispatch loops have enough call sites that GCC otherwise gives up on them
+#define MEMORY_INLINE static inline __attribute__((always_inline))
+
+MEMORY_INLINE void memory_mark_page_dirty(Memory* memory, Byte page) {
+    memory->dirty_pages[page >> 5] |= 1u << (page & 31);
+    memory->snapshot_dirty_pages[page >> 5] |= 1u << (page & 31);
+}
+
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_FLAT
+
+MEMORY_INLINE Byte memory_read(Memory* memory, Word address) {
+    return memory->data[address];
+}
+
+MEMORY_INLINE void memory_write(Memory* memory, Word address, Byte value) {
+    memory->data[address] = value;
+    memory_mark_page_dirty(memory, address >> 8);
+}
+
+#else
+
+MEMORY_INLINE Byte memory_read(Memory* memory, Word address) {
+    Byte* page = memory->read_pages[address >> 8];
+    if(__builtin_expect(page != NULL, 1)) {
+        return page[address & 0xFF];
+    }
+    return memory_read_device(memory, address);
+}
+
+MEMORY_INLINE void memory_write(Memory* memory, Word address, Byte value) {
+    Byte* page = memory->write_pages[address >> 8];
+    if(__builtin_expect(page != NULL, 1)) {
+        page[address & 0xFF] = value;
+        memory_mark_page_dirty(memory, memory->home_pages[address >> 8]);
+        return;
+    }
+    memory_write_device(memory, address, value);
+}
+
+#endif
+
+#endif
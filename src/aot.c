@@ -0,0 +1,175 @@
+#include <stdlib.h>
+#include <string.h>
+#include "aot.h"
+#include "cpu.h"
+#include "opcodes.h"
+
+#define HANDLER_NAME(op, name, mnemonic, mode, base_cycles, page_cross, handler) [name] = #handler,
+
+static const char* const handler_names[256] = { OPCODE_TABLE(HANDLER_NAME) };
+
+void aot_load(AotImage* image, const Byte* data, int size, Word origin) {
+    memset(image, 0, sizeof(AotImage));
+    memcpy(&image->memory[origin], data, size);
+    image->origin = origin;
+    image->size = size;
+}
+
+static bool in_image(AotImage* image, Word address, int length) {
+    return address >= image->origin && address + length <= image->origin + image->size;
+}
+
+static bool is_implemented(Byte opcode) {
+    return strcmp(handler_names[opcode], "unimplemented") != 0;
+}
+
+static Word read_word(AotImage* image, Word address) {
+    return image->memory[address] | image->memory[(Word)(address + 1)] << 8;
+}
+
+/*
+    Marks every instruction reachable from the vectors. Returns the number of instructions
+    found.
+*/
+int aot_discover(AotImage* image) {
+    static const Word vectors[] = { CPU_NMI_VECTOR, CPU_RESET_VECTOR, CPU_IRQ_VECTOR };
+    Word* worklist = malloc(0x10000 * sizeof(Word));
+    int pending = 0;
+    int found = 0;
+
+    for(size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        if(in_image(image, vectors[i], 2)) {
+            worklist[pending++] = read_word(image, vectors[i]);
+        }
+    }
+
+    while(pending > 0) {
+        Word address = worklist[--pending];
+
+        while(!image->translated[address]) {
+            Byte opcode = image->memory[address];
+            int length = opcode_length(opcode);
+            if(!in_image(image, address, length) || !is_implemented(opcode)) {
+                break;
+            }
+
+            image->translated[address] = true;
+            found++;
+
+            if(opcode == JMP_ABS) {
+                Word target = read_word(image, address + 1);
+                if(!image->jump_target[target] && pending < 0x10000) {
+                    image->jump_target[target] = true;
+                    worklist[pending++] = target;
+                }
+                break;
+            }
+            // A subroutine returns to the instruction after its JSR
+            if(opcode == JSR_ABS && pending < 0x10000 - 1) {
+                worklist[pending++] = read_word(image, address + 1);
+                worklist[pending++] = address + length;
+                break;
+            }
+            // BRK continues at a vector, which is walked from already, and RTI at an unknown address
+            if(opcode_ends_block(opcode)) {
+                break;
+            }
+            address += length;
+        }
+    }
+
+    free(worklist);
+    return found;
+}
+
+static void emit_operand(AotImage* image, FILE* out, Word address) {
+    Byte opcode = image->memory[address];
+    switch(opcode_length(opcode)) {
+        case 3: fprintf(out, "0x%04X", read_word(image, address + 1)); break;
+        case 2: fprintf(out, "0x%02X", image->memory[(Word)(address + 1)]); break;
+        default: fprintf(out, "0"); break;
+    }
+}
+
+/*
+    Writes the C source of a run function with the same contract as cpu_run. The translated
+    code is an engine that counts down cpu->budget like the built-in ones, and the function
+    runs it through cpu_run_engine, so scheduled events fire at their cycle and interrupts are
+    taken between slices exactly as under cpu_run.
+*/
+void aot_emit(AotImage* image, FILE* out, const char* function_name) {
+    fprintf(out, "// Generated by rom2c, do not edit\n");
+    fprintf(out, "#include \"cpu.h\"\n#include \"instruction.h\"\n\n");
+    fprintf(out, "#define CHARGE(instr) { \\\n");
+    fprintf(out, "    int c = instr; \\\n");
+    fprintf(out, "    cycles_completed += c; \\\n");
+    fprintf(out, "    cpu->budget -= BUDGET_COST(c); \\\n");
+    fprintf(out, "    if(cpu->budget <= 0) goto done; \\\n");
+    fprintf(out, "}\n\n");
+    fprintf(out, "static int %s_engine(CPU* cpu, int cycles) {\n", function_name);
+    fprintf(out, "    int cycles_completed = 0;\n");
+    fprintf(out, "    cpu_set_budget(cpu, cycles);\n\n");
+    fprintf(out, "    while(cpu->budget > 0) {\n");
+    fprintf(out, "        switch(cpu->program_counter) {\n");
+
+    for(int address = 0; address < 0x10000; address++) {
+        if(!image->translated[address]) {
+            continue;
+        }
+
+        Byte opcode = image->memory[address];
+        char text[32];
+        Byte bytes[3] = { opcode, image->memory[(Word)(address + 1)], image->memory[(Word)(address + 2)] };
+        Word next_address = address + opcode_disassemble(address, bytes, text, sizeof(text));
+
+        fprintf(out, "        case 0x%04X:", address);
+        if(image->jump_target[address]) {
+            fprintf(out, " L_%04X:", address);
+        }
+        fprintf(out, " // %s\n", text);
+        fprintf(out, "            cpu->program_counter = 0x%04X;\n", next_address);
+        fprintf(out, "            CHARGE(%s(cpu, ", handler_names[opcode]);
+        emit_operand(image, out, address);
+        fprintf(out, "));\n");
+
+        if(opcode == JMP_ABS) {
+            Word target = read_word(image, address + 1);
+            if(image->translated[target]) {
+                fprintf(out, "            goto L_%04X;\n", target);
+                continue;
+            }
+            fprintf(out, "            break;\n");
+            continue;
+        }
+        if(opcode_ends_block(opcode)) {
+            fprintf(out, "            break;\n");
+            continue;
+        }
+
+        // Fall through into the next case only if it is the instruction that follows
+        int next_case = address + 1;
+        while(next_case < 0x10000 && !image->translated[next_case]) {
+            next_case++;
+        }
+        if(next_case != next_address) {
+            fprintf(out, "            break;\n");
+        } else {
+            fprintf(out, "            // fall through\n");
+        }
+    }
+
+    fprintf(out, "        default: {\n");
+    fprintf(out, "            // Not reached by the translator, interpret one instruction\n");
+    fprintf(out, "            int c = cpu_step(cpu);\n");
+    fprintf(out, "            cycles_completed += c;\n");
+    fprintf(out, "            cpu->budget -= BUDGET_COST(c);\n");
+    fprintf(out, "        }\n");
+    fprintf(out, "        }\n");
+    fprintf(out, "    }\n\n");
+    fprintf(out, "done:\n");
+    fprintf(out, "    return cycles_completed;\n");
+    fprintf(out, "}\n\n");
+    fprintf(out, "int %s(CPU* cpu, int cycles) {\n", function_name);
+    fprintf(out, "    return cpu_run_engine(cpu, cycles, %s_engine);\n", function_name);
+    fprintf(out, "}\n");
+}
@@ -0,0 +1,27 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include "types.h"
+
+#ifndef AOT_H
+#define AOT_H
+
+/*
+    Ahead-of-time translation of a fixed ROM image into C. Control flow is recovered by walking
+    from the interrupt vectors the image covers; every reachable instruction inside the image
+    becomes a call to its instruction.h handler with a constant operand. The generated run
+    function interprets with cpu_step wherever the walk could not follow (indirect jumps,
+    returns, RAM, unimplemented opcodes).
+*/
+typedef struct AotImage {
+    Byte memory[0x10000];
+    Word origin;
+    int size;
+    bool translated[0x10000];
+    bool jump_target[0x10000];
+} AotImage;
+
+void aot_load(AotImage*, const Byte*, int, Word);
+int aot_discover(AotImage*);
+void aot_emit(AotImage*, FILE*, const char*);
+
+#endif
@@ -0,0 +1,313 @@
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "instruction.h"
+#include "opcodes.h"
+#include "scheduler.h"
+
+Batch* batch_create(CPU** cpus, int lanes) {
+    if(lanes < 1 || lanes > BATCH_MAX_LANES) {
+        return NULL;
+    }
+
+    Batch* batch = malloc(sizeof(Batch));
+    memset(batch, 0, sizeof(Batch));
+    batch->lanes = lanes;
+    memcpy(batch->cpus, cpus, lanes * sizeof(CPU*));
+
+    for(int opcode = 0; opcode < 256; opcode++) {
+        const char* mnemonic = opcode_mnemonics[opcode];
+        if(strcmp(mnemonic, "LDA") == 0) {
+            batch->load_targets[opcode] = batch->accumulator;
+        } else if(strcmp(mnemonic, "LDX") == 0) {
+            batch->load_targets[opcode] = batch->idx_reg_x;
+        } else if(strcmp(mnemonic, "LDY") == 0) {
+            batch->load_targets[opcode] = batch->idx_reg_y;
+        }
+    }
+    return batch;
+}
+
+void batch_destroy(Batch* batch) {
+    free(batch);
+}
+
+static void load_lane(Batch* batch, int lane) {
+    CPU* cpu = batch->cpus[lane];
+    batch->accumulator[lane] = cpu->accumulator;
+    batch->idx_reg_x[lane] = cpu->idx_reg_x;
+    batch->idx_reg_y[lane] = cpu->idx_reg_y;
+}
+
+static void store_lane(Batch* batch, int lane, Word program_counter) {
+    CPU* cpu = batch->cpus[lane];
+    cpu->program_counter = program_counter;
+    cpu->accumulator = batch->accumulator[lane];
+    cpu->idx_reg_x = batch->idx_reg_x[lane];
+    cpu->idx_reg_y = batch->idx_reg_y[lane];
+    if(batch->nz_pending) {
+        flags_set_nz(&cpu->flags, batch->nz_result[lane]);
+    }
+}
+
+// Takes a stored lane out of lock step and runs the rest of its budget on the scalar core
+static void leave(Batch* batch, u32* in_step, int lane, int completed, int cycles) {
+    *in_step &= ~(1u << lane);
+    batch->divergences++;
+    batch->cpus[lane]->clock += completed;
+    batch->cycles_completed[lane] = completed + cpu_run(batch->cpus[lane], cycles);
+}
+
+// Lanes that raised an interrupt leave, so cpu_run takes it right after the last instruction
+static void leave_interrupted(Batch* batch, u32* in_step, Word program_counter, int completed, int cycles) {
+    for(u32 lanes = *in_step; lanes != 0; lanes &= lanes - 1) {
+        int lane = __builtin_ctz(lanes);
+        if(cpu_interrupt_pending(batch->cpus[lane])) {
+            store_lane(batch, lane, program_counter);
+            leave(batch, in_step, lane, completed, cycles);
+        }
+    }
+}
+
+// Only read through pages with a host pointer, so comparing code never triggers a device
+static Byte code_byte(Memory* memory, Word address) {
+    return memory->read_pages[address >> 8][address & 0xFF];
+}
+
+static bool same_instruction(Memory* lane, Memory* leader, Word address, int length) {
+    for(int i = 0; i < length; i++) {
+        Word byte_address = address + i;
+        const Byte* page = lane->read_pages[byte_address >> 8];
+        if(page == leader->read_pages[byte_address >> 8]) {
+            continue;
+        }
+        if(page == NULL || page[byte_address & 0xFF] != code_byte(leader, byte_address)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool page_bit(const u32* pages, Byte page) {
+    return (pages[page >> 5] >> (page & 31)) & 1;
+}
+
+static void set_page_bit(u32* pages, Byte page) {
+    pages[page >> 5] |= 1u << (page & 31);
+}
+
+// Forgets which pages matched, for when the leader changes or a handler may have written memory
+static void forget_pages(Batch* batch) {
+    memset(batch->same_pages, 0, sizeof(batch->same_pages));
+    memset(batch->different_pages, 0, sizeof(batch->different_pages));
+}
+
+/*
+    Whether every lane in lock step holds the leader's bytes on page. Comparing a whole page
+    once is much cheaper than comparing each instruction in each lane, and only handlers can
+    write memory during a run, so the answer holds until the next one.
+*/
+static bool same_page(Batch* batch, u32 in_step, Memory* leader, Byte page) {
+    if(page_bit(batch->same_pages, page)) {
+        return true;
+    }
+    if(page_bit(batch->different_pages, page)) {
+        return false;
+    }
+
+    const Byte* bytes = leader->read_pages[page];
+    for(u32 lanes = in_step; lanes != 0; lanes &= lanes - 1) {
+        const Byte* lane_bytes = batch->cpus[__builtin_ctz(lanes)]->memory.read_pages[page];
+        if(lane_bytes != bytes && (lane_bytes == NULL || memcmp(lane_bytes, bytes, MEMORY_PAGE_SIZE) != 0)) {
+            set_page_bit(batch->different_pages, page);
+            return false;
+        }
+    }
+    set_page_bit(batch->same_pages, page);
+    return true;
+}
+
+/*
+    Loads into every lane with the addressing helpers the handlers use. The reads are one per
+    lane, but the register and N/Z updates run over all BATCH_MAX_LANES at once: lanes out of
+    lock step hold stale copies that are never stored, so they need no mask. Returns the lanes
+    whose indexed address crossed a page, which took the penalty cycle.
+*/
+// Reads value[lane] = expression for every lane in lock step, with cpu set to the lane's CPU
+#define GATHER(expression) \
+    for(u32 lanes = in_step; lanes != 0; lanes &= lanes - 1) { \
+        int lane = __builtin_ctz(lanes); \
+        CPU* cpu = batch->cpus[lane]; \
+        value[lane] = expression; \
+    }
+
+// GATHER for indexed modes, also setting the lane's bit in crossed if it paid the page penalty
+#define GATHER_INDEXED(load) \
+    for(u32 lanes = in_step; lanes != 0; lanes &= lanes - 1) { \
+        int lane = __builtin_ctz(lanes); \
+        CPU* cpu = batch->cpus[lane]; \
+        int penalty; \
+        value[lane] = load; \
+        crossed |= (u32)penalty << lane; \
+    }
+
+static u32 run_load(Batch* batch, u32 in_step, Byte opcode, Word operand) {
+    Byte* value = batch->value;
+    Byte mode = opcode_addressing_modes[opcode];
+    u32 crossed = 0;
+
+    switch(mode) {
+        case ADDR_IMMEDIATE: memset(value, operand, BATCH_MAX_LANES); break;
+        case ADDR_ZERO: GATHER(load_zero_page_value(cpu, operand, 0)); break;
+        case ADDR_ZERO_X: GATHER(load_zero_page_value(cpu, operand, batch->idx_reg_x[lane])); break;
+        case ADDR_ZERO_Y: GATHER(load_zero_page_value(cpu, operand, batch->idx_reg_y[lane])); break;
+        case ADDR_ABS: GATHER(load_absolute_value(cpu, operand, 0)); break;
+        case ADDR_ABS_X: GATHER_INDEXED(load_absolute_indexed(cpu, operand, batch->idx_reg_x[lane], &penalty)); break;
+        case ADDR_ABS_Y: GATHER_INDEXED(load_absolute_indexed(cpu, operand, batch->idx_reg_y[lane], &penalty)); break;
+        case ADDR_IND_X: GATHER(load_indexed_indirect(cpu, operand, batch->idx_reg_x[lane])); break;
+        case ADDR_IND_Y: GATHER_INDEXED(load_indirect_indexed(cpu, operand, batch->idx_reg_y[lane], &penalty)); break;
+    }
+
+    Byte* target = batch->load_targets[opcode];
+    for(int lane = 0; lane < BATCH_MAX_LANES; lane++) {
+        target[lane] = value[lane];
+        batch->nz_result[lane] = value[lane];
+    }
+    batch->nz_pending = true;
+    return crossed;
+}
+
+/*
+    Runs an instruction without a lane-wise translation through its handler on every lane. The
+    first lane leads: lanes that end at another program counter or took other cycles leave.
+    Returns the cycles the leader took.
+*/
+static int run_handler(Batch* batch, u32* in_step, Byte opcode, Word operand, Word* program_counter, int completed, int cycles) {
+    Word next = *program_counter + opcode_length(opcode);
+    int leader = __builtin_ctz(*in_step);
+    int leader_cycles = 0;
+    Word leader_next = next;
+
+    for(u32 lanes = *in_step; lanes != 0; lanes &= lanes - 1) {
+        int lane = __builtin_ctz(lanes);
+        CPU* cpu = batch->cpus[lane];
+        store_lane(batch, lane, next);
+        int c = cpu_opcode_handlers[opcode](cpu, operand);
+        if(lane == leader) {
+            leader_cycles = c;
+            leader_next = cpu->program_counter;
+        } else if(c != leader_cycles || cpu->program_counter != leader_next) {
+            leave(batch, in_step, lane, completed + c, cycles - BUDGET_COST(c));
+            continue;
+        }
+        load_lane(batch, lane);
+    }
+
+    batch->nz_pending = false;
+    forget_pages(batch);
+    batch->handler_instructions += __builtin_popcount(*in_step);
+    *program_counter = leader_next;
+    return leader_cycles;
+}
+
+/*
+    Runs every lane as cpu_run(lane, cycles) would and stores what each one completed in
+    cycles_completed. Lanes start in lock step with the first lane if they share its program
+    counter. Returns the cycles completed by all lanes together.
+*/
+int batch_run(Batch* batch, int cycles) {
+    Word program_counter = batch->cpus[0]->program_counter;
+    u32 in_step = 0;
+    int completed = 0;
+    Memory* previous_leader = NULL;
+
+    batch->nz_pending = false;
+    for(int lane = 0; lane < batch->lanes; lane++) {
+        Scheduler* scheduler = batch->cpus[lane]->scheduler;
+        // Events need their slices cut by cpu_run, which also takes pending interrupts
+        if(batch->cpus[lane]->program_counter == program_counter && (scheduler == NULL || scheduler->count == 0)
+                && !cpu_interrupt_pending(batch->cpus[lane])) {
+            in_step |= 1u << lane;
+            load_lane(batch, lane);
+        } else {
+            leave(batch, &in_step, lane, 0, cycles);
+        }
+    }
+
+    while(cycles > 0 && in_step != 0) {
+        Memory* leader = &batch->cpus[__builtin_ctz(in_step)]->memory;
+        // Fetching from a device is a side effect the lanes must do themselves
+        if(leader->read_pages[program_counter >> 8] == NULL) {
+            break;
+        }
+        Byte opcode = code_byte(leader, program_counter);
+        int length = opcode_length(opcode);
+        if(leader->read_pages[(Word)(program_counter + length - 1) >> 8] == NULL) {
+            break;
+        }
+
+        if(leader != previous_leader) {
+            forget_pages(batch);
+            previous_leader = leader;
+        }
+        Byte last_page = (Word)(program_counter + length - 1) >> 8;
+        if(!same_page(batch, in_step, leader, program_counter >> 8) || !same_page(batch, in_step, leader, last_page)) {
+            for(u32 lanes = in_step; lanes != 0; lanes &= lanes - 1) {
+                int lane = __builtin_ctz(lanes);
+                if(!same_instruction(&batch->cpus[lane]->memory, leader, program_counter, length)) {
+                    store_lane(batch, lane, program_counter);
+                    leave(batch, &in_step, lane, completed, cycles);
+                }
+            }
+        }
+
+        Word operand = 0;
+        switch(length) {
+            case 2: operand = code_byte(leader, program_counter + 1); break;
+            case 3: operand = code_byte(leader, program_counter + 1) | code_byte(leader, program_counter + 2) << 8; break;
+        }
+
+        int c;
+        bool may_interrupt = true;
+        if(batch->load_targets[opcode] != NULL) {
+            u32 crossed = run_load(batch, in_step, opcode, operand);
+            program_counter += length;
+            batch->lockstep_instructions += __builtin_popcount(in_step);
+            // Lanes that crossed a page when the leader did not, or the other way round, took
+            // another number of cycles
+            int leader_crossed = crossed >> __builtin_ctz(in_step) & 1;
+            c = opcode_cycles[opcode] + leader_crossed * opcode_page_cross_penalty[opcode];
+            int other_cycles = opcode_cycles[opcode] + !leader_crossed * opcode_page_cross_penalty[opcode];
+            for(u32 lanes = (leader_crossed ? ~crossed : crossed) & in_step; lanes != 0; lanes &= lanes - 1) {
+                int lane = __builtin_ctz(lanes);
+                store_lane(batch, lane, program_counter);
+                leave(batch, &in_step, lane, completed + other_cycles, cycles - other_cycles);
+            }
+            // Only a read from a device can raise an interrupt
+            may_interrupt = MEMORY_LAYOUT != MEMORY_LAYOUT_FLAT && opcode_addressing_modes[opcode] != ADDR_IMMEDIATE;
+        } else if(opcode == JMP_ABS) {
+            program_counter = operand;
+            c = opcode_cycles[opcode];
+            batch->lockstep_instructions += __builtin_popcount(in_step);
+            may_interrupt = false;
+        } else {
+            c = run_handler(batch, &in_step, opcode, operand, &program_counter, completed, cycles);
+        }
+        completed += c;
+        cycles -= BUDGET_COST(c);
+        if(may_interrupt) {
+            leave_interrupted(batch, &in_step, program_counter, completed, cycles);
+        }
+    }
+
+    int total = 0;
+    for(int lane = 0; lane < batch->lanes; lane++) {
+        if(in_step & (1u << lane)) {
+            store_lane(batch, lane, program_counter);
+            batch->cpus[lane]->clock += completed;
+            batch->cycles_completed[lane] = completed + cpu_run(batch->cpus[lane], cycles);
+        }
+        total += batch->cycles_completed[lane];
+    }
+    return total;
+}
@@ -0,0 +1,51 @@
+#include <stddef.h>
+#include "types.h"
+#include "cpu.h"
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#define BATCH_MAX_LANES 32
+
+/*
+    Runs up to BATCH_MAX_LANES CPUs in lock step. While the lanes are at the same program
+    counter and hold the same instruction there, it is fetched and decoded once and the
+    registers of all lanes are updated together from structure-of-arrays copies, which the
+    compiler vectorizes. Each lane keeps its own memory, so a load is still one read per lane.
+
+    A lane whose instruction, next program counter or cycle count stops agreeing with the
+    others leaves the batch and finishes its budget on the scalar cpu_run. Instructions
+    without a lane-wise translation are run by calling their handler on every lane. A lane
+    with scheduled events or a pending interrupt runs on cpu_run from the start, which fires
+    them on time, and one that raises an interrupt leaves right after that instruction.
+*/
+typedef struct Batch {
+    int lanes;
+    CPU* cpus[BATCH_MAX_LANES];
+    int cycles_completed[BATCH_MAX_LANES];
+
+    // Registers of the lanes in lock step, N and Z are kept as the last result until written back
+    Byte accumulator[BATCH_MAX_LANES];
+    Byte idx_reg_x[BATCH_MAX_LANES];
+    Byte idx_reg_y[BATCH_MAX_LANES];
+    Byte nz_result[BATCH_MAX_LANES];
+    Byte value[BATCH_MAX_LANES];
+    bool nz_pending;
+
+    // Pages known to hold the same bytes in every lane in lock step, and pages known not to
+    u32 same_pages[MEMORY_PAGES / 32];
+    u32 different_pages[MEMORY_PAGES / 32];
+
+    // The register array each load opcode writes, NULL for every other opcode
+    Byte* load_targets[256];
+
+    unsigned long long lockstep_instructions;
+    unsigned long long handler_instructions;
+    unsigned long long divergences;
+} Batch;
+
+Batch* batch_create(CPU**, int);
+void batch_destroy(Batch*);
+int batch_run(Batch*, int);
+
+#endif
@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+#include "block_cache.h"
+#include "opcodes.h"
+#include "instruction.h"
+#include "trace.h"
+#include "profile.h"
+
+// Handlers are inlined into the block loop, an indirect call per instruction costs more than
+// the fetch it saves
+#define DECODED_CASE(op, name, mnemonic, mode, base_cycles, page_cross, handler) case name: c = handler(cpu, instruction->operand); break;
+
+BlockCache* block_cache_create(void) {
+    BlockCache* cache = malloc(sizeof(BlockCache));
+    memset(cache, 0, sizeof(BlockCache));
+    return cache;
+}
+
+void block_cache_destroy(BlockCache* cache) {
+    free(cache);
+}
+
+void block_cache_flush(BlockCache* cache) {
+    for(int i = 0; i < BLOCK_CACHE_ENTRIES; i++) {
+        cache->blocks[i].valid = false;
+    }
+    memset(cache->page_has_code, 0, sizeof(cache->page_has_code));
+}
+
+// Called for every guest write. Only pages that hold decoded code pay for more than a load.
+void block_cache_invalidate(BlockCache* cache, Word address) {
+    Byte page = address >> 8;
+    if(cache->page_has_code[page]) {
+        cache->page_generations[page]++;
+        cache->page_has_code[page] = false;
+        cache->invalidations++;
+    }
+}
+
+double block_cache_hit_rate(BlockCache* cache) {
+    unsigned long long lookups = cache->hits + cache->misses;
+    return lookups == 0 ? 0.0 : (double)cache->hits / lookups;
+}
+
+// Only RAM and ROM pages are decoded, device reads can have side effects and change under the cache
+static bool is_decodable(Memory* memory, Word address, int length) {
+    return memory->read_pages[address >> 8] != NULL
+        && memory->read_pages[(Word)(address + length - 1) >> 8] != NULL;
+}
+
+static void block_decode(BlockCache* cache, Block* block, CPU* cpu, Word start_address) {
+    Word address = start_address;
+    Memory* memory = &cpu->memory;
+
+    block->start_address = start_address;
+    block->count = 0;
+    block->native = NULL;
+    block->executions = 0;
+
+    while(block->count < BLOCK_MAX_INSTRUCTIONS && is_decodable(memory, address, 1)) {
+        Byte opcode = memory_read(memory, address);
+        int length = opcode_length(opcode);
+        if(!is_decodable(memory, address, length)) {
+            break;
+        }
+        Byte lo = memory_read(memory, address + 1);
+        Byte hi = memory_read(memory, address + 2);
+
+        DecodedInstruction* instruction = &block->instructions[block->count++];
+        instruction->opcode = opcode;
+        instruction->length = length;
+        instruction->operand = length == 3 ? (hi << 8) | lo : length == 2 ? lo : 0;
+
+        address += length;
+        if(opcode_ends_block(opcode)) {
+            break;
+        }
+    }
+
+    // Mirrors of a page share its generation, see home_pages
+    block->pages[0] = memory->home_pages[start_address >> 8];
+    block->pages[1] = memory->home_pages[(Word)(address - 1) >> 8];
+    for(int i = 0; i < 2; i++) {
+        block->page_generations[i] = cache->page_generations[block->pages[i]];
+        cache->page_has_code[block->pages[i]] = true;
+    }
+    block->valid = true;
+}
+
+Block* block_cache_lookup(BlockCache* cache, CPU* cpu, Word address) {
+    Block* block = &cache->blocks[address % BLOCK_CACHE_ENTRIES];
+
+    if(block->valid
+            && block->start_address == address
+            && block->page_generations[0] == cache->page_generations[block->pages[0]]
+            && block->page_generations[1] == cache->page_generations[block->pages[1]]) {
+        cache->hits++;
+        return block;
+    }
+
+    cache->misses++;
+    block_decode(cache, block, cpu, address);
+    return block;
+}
+
+/*
+    Runs the decoded instructions of block from index first until the block ends, cpu->budget
+    runs out or the block overwrites decoded code. The program counter must point at
+    instruction first. Returns the cycles completed.
+*/
+int block_cache_execute(BlockCache* cache, Block* block, CPU* cpu, int first) {
+    int cycles_completed = 0;
+    unsigned long long invalidations = cache->invalidations;
+
+    if(block->count == 0) {
+        // The program counter is in device memory, interpret through the bus
+        int c = cpu_step(cpu);
+        cpu->budget -= BUDGET_COST(c);
+        return c;
+    }
+
+    for(int i = first; i < block->count && cpu->budget > 0; i++) {
+        DecodedInstruction* instruction = &block->instructions[i];
+        cpu->program_counter += instruction->length;
+        TRACE_INSTRUCTION(cpu, instruction->opcode, instruction->operand, cycles_completed);
+        PROFILE_INSTRUCTION(cpu, instruction->opcode);
+        int c;
+        switch(instruction->opcode) {
+            OPCODE_TABLE(DECODED_CASE)
+        }
+        PROFILE_CYCLES(cpu, instruction->opcode, c);
+        cycles_completed += c;
+        cpu->budget -= BUDGET_COST(c);
+
+        // The block wrote over decoded code, decode again from the new program counter
+        if(cache->invalidations != invalidations) {
+            break;
+        }
+    }
+
+    TRACE_CYCLES(cpu, cycles_completed);
+    return cycles_completed;
+}
+
+int block_cache_run(BlockCache* cache, CPU* cpu, int cycles) {
+    int cycles_completed = 0;
+
+    cpu_set_budget(cpu, cycles);
+    while(cpu->budget > 0) {
+        Block* block = block_cache_lookup(cache, cpu, cpu->program_counter);
+        cycles_completed += block_cache_execute(cache, block, cpu, 0);
+    }
+
+    return cycles_completed;
+}
@@ -0,0 +1,62 @@
+#include "types.h"
+#include "cpu.h"
+
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#define BLOCK_CACHE_ENTRIES 1024
+#define BLOCK_MAX_INSTRUCTIONS 16
+
+/*
+    A predecoded instruction: the operand is fetched once when the block is built, so running
+    it costs no memory reads for the opcode or operand.
+*/
+typedef struct DecodedInstruction {
+    Word operand;
+    Byte opcode;
+    Byte length;
+} DecodedInstruction;
+
+typedef int (*NativeBlock)(CPU*);
+
+/*
+    A straight-line run of instructions starting at start_address. It ends at the first
+    instruction that can change the program counter or after BLOCK_MAX_INSTRUCTIONS. A block
+    spans at most two pages; it stays valid while the write generation of both pages is
+    unchanged.
+*/
+typedef struct Block {
+    Word start_address;
+    bool valid;
+    Byte count;
+    Byte pages[2];
+    u32 page_generations[2];
+    DecodedInstruction instructions[BLOCK_MAX_INSTRUCTIONS];
+
+    // Filled in by the JIT once the block is hot: native code for the first native_count
+    // instructions, safe to enter while the remaining budget is at least native_min_budget
+    NativeBlock native;
+    Byte native_count;
+    u16 native_min_budget;
+    u32 executions;
+} Block;
+
+typedef struct BlockCache {
+    Block blocks[BLOCK_CACHE_ENTRIES];
+    u32 page_generations[256];
+    bool page_has_code[256];
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long invalidations;
+} BlockCache;
+
+BlockCache* block_cache_create(void);
+void block_cache_destroy(BlockCache*);
+void block_cache_flush(BlockCache*);
+void block_cache_invalidate(BlockCache*, Word);
+Block* block_cache_lookup(BlockCache*, CPU*, Word);
+int block_cache_execute(BlockCache*, Block*, CPU*, int);
+int block_cache_run(BlockCache*, CPU*, int);
+double block_cache_hit_rate(BlockCache*);
+
+#endif
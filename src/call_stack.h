@@ -0,0 +1,77 @@
+#include <stdbool.h>
+#include "types.h"
+#include "cpu.h"
+
+#ifndef CALL_STACK_H
+#define CALL_STACK_H
+
+// More return addresses than page 1 can hold are never live at once
+#define CALL_STACK_DEPTH 128
+
+// How a frame was entered, which is how a return from it is recognised
+enum CallKind {
+    CALL_SUBROUTINE,
+    CALL_IRQ,
+    CALL_NMI,
+    CALL_BRK
+};
+
+typedef struct CallFrame {
+    // Where the subroutine or interrupt handler starts
+    Word entry;
+    // cpu->stack_pointer once the return address was pushed
+    Byte stack_pointer;
+    Byte kind;
+} CallFrame;
+
+/*
+    The subroutines and interrupt handlers a CPU is in, innermost last, for the sampler in
+    sampler.h. JSR, BRK and taken interrupts push a frame and RTS and RTI pop it. A frame is
+    matched by where its return address sits on the guest stack rather than by the returning
+    instruction, so guest code that drops a return address with PLA, or returns through RTS
+    to somewhere it pushed itself, leaves no stale frames behind: any frame whose return
+    address is above the stack pointer is gone. Frames past CALL_STACK_DEPTH are not kept and
+    counted in lost. Only tracked while cpu->call_stack is set, see sampler_start.
+*/
+typedef struct CallStack {
+    CallFrame frames[CALL_STACK_DEPTH];
+    int depth;
+    unsigned long long lost;
+} CallStack;
+
+// Pops the frames whose return address is no longer on the stack at stack_pointer
+static inline void call_stack_unwind(CallStack* calls, Byte stack_pointer) {
+    // The stack wraps within page 1, so above means less than half a page above, worked out
+    // in Byte arithmetic so it does not depend on whether the host's char is signed
+    while(calls->depth > 0) {
+        Byte above = stack_pointer - calls->frames[calls->depth - 1].stack_pointer;
+        if(above == 0 || above >= 0x80) {
+            break;
+        }
+        calls->depth--;
+    }
+}
+
+// After pushing pushed bytes of return address and flags, enters the code at entry
+static inline void call_stack_enter(CPU* cpu, Word entry, int kind, int pushed) {
+    CallStack* calls = cpu->call_stack;
+    if(__builtin_expect(calls == NULL, 1)) {
+        return;
+    }
+    call_stack_unwind(calls, cpu->stack_pointer + pushed);
+    if(calls->depth == CALL_STACK_DEPTH) {
+        calls->lost++;
+        return;
+    }
+    calls->frames[calls->depth++] = (CallFrame){ entry, cpu->stack_pointer, kind };
+}
+
+// After pulling a return address
+static inline void call_stack_leave(CPU* cpu) {
+    CallStack* calls = cpu->call_stack;
+    if(__builtin_expect(calls != NULL, 0)) {
+        call_stack_unwind(calls, cpu->stack_pointer);
+    }
+}
+
+#endif
@@ -1,20 +1,110 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include "cpu.h"
 #include "instruction.h"
+#include "block_cache.h"
+#include "jit.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "profile.h"
 
 
+// Sets up cpu with memory_size bytes of RAM in data, which must be MEMORY_ADDRESS_SPACE zero bytes
+/*
+    Starts the clock again and forgets the scheduler, interrupt lines and budget of whoever ran
+    the CPU before, for a new CPU and one a pool hands out again. Memory and registers are
+    left to cpu_reset.
+*/
+void cpu_clear_run_state(CPU* cpu) {
+	cpu->clock = 0;
+	cpu->scheduler = NULL;
+	cpu->budget = 0;
+	cpu->budget_held = 0;
+	cpu->irq_lines = 0;
+	cpu->nmi_pending = false;
+	cpu->spin_address = CPU_NO_SPIN;
+	cpu->spin_cycles_skipped = 0;
+	cpu->trace_clock = 0;
+}
+
+void cpu_init(CPU* cpu, Byte* data, int memory_size) {
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_FLAT
+	// The flat layout is always the full address space
+	(void)memory_size;
+	int size = MEMORY_ADDRESS_SPACE;
+#else
+	// The bus maps RAM a page at a time, so round up to whole pages
+	int size = (memory_size + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE * MEMORY_PAGE_SIZE;
+	if(size > MEMORY_ADDRESS_SPACE) {
+		size = MEMORY_ADDRESS_SPACE;
+	}
+#endif
+
+	memory_init(&cpu->memory, data, size);
+	// Fresh anonymous memory is already zero, leaving it clean keeps the pages the guest never
+	// writes from being touched by a reset, so they are never backed
+	memset(cpu->memory.dirty_pages, 0, sizeof(cpu->memory.dirty_pages));
+	cpu_clear_run_state(cpu);
+#if CPU_DISPATCH == CPU_DISPATCH_CACHED || CPU_DISPATCH == CPU_DISPATCH_JIT
+	cpu->block_cache = block_cache_create();
+#else
+	cpu->block_cache = NULL;
+#endif
+#if CPU_DISPATCH == CPU_DISPATCH_JIT
+	cpu->jit = jit_create();
+#else
+	cpu->jit = NULL;
+#endif
+#if CPU_TRACE == CPU_TRACE_ON
+	cpu->trace = trace_create();
+#else
+	cpu->trace = NULL;
+#endif
+#if CPU_PROFILE == CPU_PROFILE_ON
+	cpu->profile = profile_create();
+#else
+	cpu->profile = NULL;
+#endif
+	cpu->call_stack = NULL;
+}
+
+// Frees what cpu_init allocated, but not the CPU or its memory
+void cpu_release(CPU* cpu) {
+	free(cpu->call_stack);
+	if(cpu->profile != NULL) {
+		profile_destroy(cpu->profile);
+	}
+	if(cpu->trace != NULL) {
+		trace_destroy(cpu->trace);
+	}
+	if(cpu->jit != NULL) {
+		jit_destroy(cpu->jit);
+	}
+	if(cpu->block_cache != NULL) {
+		block_cache_destroy(cpu->block_cache);
+	}
+}
+
+// A CPU with memory_size bytes of RAM, NULL if the host has no memory for it
 CPU* cpu_create(int memory_size) {
     CPU* cpu = malloc(sizeof(CPU));
-	Memory memory = { malloc(memory_size), memory_size };
-
-    cpu->memory = memory;
+	if(cpu == NULL) {
+		return NULL;
+	}
+	Byte* data = memory_reserve();
+	if(data == NULL) {
+		free(cpu);
+		return NULL;
+	}
+	cpu_init(cpu, data, memory_size);
     return cpu;
 }
 
 void cpu_destroy(CPU* cpu) {
-	free(cpu->memory.data);
+	cpu_release(cpu);
+	memory_release(cpu->memory.data);
 	free(cpu);
 	cpu = NULL;
 }
@@ -29,88 +119,426 @@ void cpu_dump_state(CPU* cpu) {
 			cpu->idx_reg_y
 		  );
 	
-	struct Flags* flags = &cpu->flags;
+	Flags* flags = &cpu->flags;
 	printf("\n******Flags******\n");
 	printf(" C: %d,  Z: %d, ID: %d\nDM: %d, BC: %d,  O: %d\n N: %d\n",
-			flags->carry,
-			flags->zero,
-			flags->interrupt_disable,
-			flags->decimal_mode,
-			flags->break_command,
-			flags->overflow,
-			flags->negative
+			flags_carry(flags),
+			flags_zero(flags),
+			flags_interrupt_disable(flags),
+			flags_decimal_mode(flags),
+			flags_break_command(flags),
+			flags_overflow(flags),
+			flags_negative(flags)
 		  );
 }
 
+// Clears RAM and registers and starts from the reset vector, which reads 0 unless ROM sets it
 void cpu_reset(CPU* cpu) {
-	cpu->program_counter = 0;
 	cpu->stack_pointer = 0;
 	cpu->accumulator = 0;
 	cpu->idx_reg_x = 0;
 	cpu->idx_reg_y = 0;
-	cpu->flags.carry = 0;
-	cpu->flags.zero = 0;
-	cpu->flags.interrupt_disable = 0;
-	cpu->flags.decimal_mode = 0;
-	cpu->flags.break_command = 0;
-	cpu->flags.overflow = 0;
-	cpu->flags.negative = 0;
+	flags_reset(&cpu->flags);
+	// Devices keep holding their IRQ lines through a reset, an NMI edge is lost
+	cpu->nmi_pending = false;
+
+	memory_clear(&cpu->memory);
+	cpu->program_counter = memory_read(&cpu->memory, CPU_RESET_VECTOR) | memory_read(&cpu->memory, CPU_RESET_VECTOR + 1) << 8;
+	if(cpu->call_stack != NULL) {
+		cpu->call_stack->depth = 0;
+		cpu->call_stack->lost = 0;
+	}
+
+	if(cpu->block_cache != NULL) {
+		block_cache_flush(cpu->block_cache);
+	}
+}
 
-    for(int i = 0; i < cpu->memory.SIZE_IN_BYTES; i++) {
-		cpu->memory.data[i] = 0;
+// Every write to guest memory must come through here so predecoded blocks stay coherent
+void cpu_write_byte(CPU* cpu, Word address, Byte value) {
+	memory_write(&cpu->memory, address, value);
+	if(cpu->block_cache != NULL) {
+		block_cache_invalidate(cpu->block_cache, cpu->memory.home_pages[address >> 8] << 8);
 	}
 }
 
 
+/*
+    The dispatch loops fetch through these so the bus stays inlined into every opcode. The
+    program counter is stored after the read: a device call on the slow path could change any
+    memory, and storing last lets the compiler keep the new program counter in a register.
+*/
+MEMORY_INLINE Byte fetch_byte(CPU* cpu) {
+	Word address = cpu->program_counter;
+	Byte value = memory_read(&cpu->memory, address);
+	cpu->program_counter = address + 1;
+	return value;
+}
+
+MEMORY_INLINE Word fetch_word(CPU* cpu) {
+	Byte lo = fetch_byte(cpu);
+	Byte hi = fetch_byte(cpu);
+	return (hi << 8) | lo;
+}
+
 Byte cpu_load_next_byte(CPU* cpu) {
-    return cpu->memory.data[cpu->program_counter++];
+    return fetch_byte(cpu);
 }
 
 // Loads the next byte (Little Endian)
 Word cpu_load_next_word(CPU* cpu) {
-	Byte lo = cpu_load_next_byte(cpu);
-	Byte hi = cpu_load_next_byte(cpu);
-	Word word = (hi << 8) | lo;
-	return word;
+	return fetch_word(cpu);
+}
+
+// Interprets the single instruction at the program counter and returns the cycles it took
+int cpu_step(CPU* cpu) {
+	Byte opcode = fetch_byte(cpu);
+	Word operand = 0;
+
+	switch(opcode_length(opcode)) {
+		case 2: operand = fetch_byte(cpu); break;
+		case 3: operand = fetch_word(cpu); break;
+	}
+	TRACE_INSTRUCTION(cpu, opcode, operand, 0);
+	PROFILE_INSTRUCTION(cpu, opcode);
+	int c = cpu_opcode_handlers[opcode](cpu, operand);
+	TRACE_CYCLES(cpu, c);
+	PROFILE_CYCLES(cpu, opcode, c);
+	return c;
+}
+
+const char* cpu_dispatch_name(void) {
+#if CPU_DISPATCH == CPU_DISPATCH_THREADED
+	return "threaded";
+#elif CPU_DISPATCH == CPU_DISPATCH_TAILCALL
+	return "tailcall";
+#elif CPU_DISPATCH == CPU_DISPATCH_CACHED
+	return "cached";
+#elif CPU_DISPATCH == CPU_DISPATCH_JIT
+	return "jit";
+#else
+	return "switch";
+#endif
+}
+
+#define HANDLER_ENTRY(op, name, mnemonic, mode, base_cycles, page_cross, handler) [name] = handler,
+
+const OpcodeHandler cpu_opcode_handlers[256] = {
+	OPCODE_TABLE(HANDLER_ENTRY)
+};
+
+/*
+    Every dispatch engine is generated from OPCODE_TABLE and runs the same handlers from
+    instruction.h. The operand is fetched according to the addressing mode before the handler
+    runs.
+*/
+#define OPERAND_ADDR_IMPLIED(cpu) 0
+#define OPERAND_ADDR_ACCUMULATOR(cpu) 0
+#define OPERAND_ADDR_IMMEDIATE(cpu) fetch_byte(cpu)
+#define OPERAND_ADDR_ZERO(cpu) fetch_byte(cpu)
+#define OPERAND_ADDR_ZERO_X(cpu) fetch_byte(cpu)
+#define OPERAND_ADDR_ZERO_Y(cpu) fetch_byte(cpu)
+#define OPERAND_ADDR_ABS(cpu) fetch_word(cpu)
+#define OPERAND_ADDR_ABS_X(cpu) fetch_word(cpu)
+#define OPERAND_ADDR_ABS_Y(cpu) fetch_word(cpu)
+#define OPERAND_ADDR_INDIRECT(cpu) fetch_word(cpu)
+#define OPERAND_ADDR_IND_X(cpu) fetch_byte(cpu)
+#define OPERAND_ADDR_IND_Y(cpu) fetch_byte(cpu)
+#define OPERAND_ADDR_RELATIVE(cpu) fetch_byte(cpu)
+#define OPERAND(mode, cpu) OPERAND_##mode(cpu)
+
+#if CPU_DISPATCH == CPU_DISPATCH_THREADED
+
+/*
+    Direct-threaded code: each handler ends with its own indirect jump to the next opcode
+    (GCC labels-as-values), so the host predicts every dispatch site separately.
+*/
+#define THREADED_LABEL(op, name, mnemonic, mode, base_cycles, page_cross, handler) [name] = &&op_##name,
+#define THREADED_HANDLER(op, name, mnemonic, mode, base_cycles, page_cross, handler) op_##name: { \
+							  Word operand = OPERAND(mode, cpu);\
+							  TRACE_INSTRUCTION(cpu, name, operand, cycles_completed);\
+							  PROFILE_INSTRUCTION(cpu, name);\
+							  int c = handler(cpu, operand);\
+							  PROFILE_CYCLES(cpu, name, c);\
+							  cycles_completed += c;\
+							  cpu->budget -= BUDGET_COST(c);\
+							  THREADED_DISPATCH();\
+						   }
+#define THREADED_DISPATCH() {  \
+							  if(cpu->budget <= 0) return cycles_completed;\
+							  goto *dispatch_table[fetch_byte(cpu)];\
+						   }
+
+static int run_engine(CPU* cpu, int cycles) {
+	int cycles_completed = 0;
+	cpu_set_budget(cpu, cycles);
+
+	static const void* const dispatch_table[256] = {
+		OPCODE_TABLE(THREADED_LABEL)
+	};
+
+	THREADED_DISPATCH();
+
+	OPCODE_TABLE(THREADED_HANDLER)
 }
 
-#define CYCLE_COUNT(instr) {  \
+#elif CPU_DISPATCH == CPU_DISPATCH_TAILCALL
+
+/*
+    One function per opcode that finishes by tail calling the handler of the next opcode.
+    This relies on sibling call optimisation (-O2 and up); unoptimised builds recurse once
+    per instruction, which is only acceptable for small budgets such as the specs use.
+*/
+typedef int (*TailHandler)(CPU*, int);
+static const TailHandler tail_dispatch_table[256];
+
+#define TAIL_DISPATCH() {  \
+							  if(cpu->budget <= 0) return cycles_completed;\
+							  return tail_dispatch_table[fetch_byte(cpu)](cpu, cycles_completed);\
+						   }
+#define TAIL_HANDLER(op, name, mnemonic, mode, base_cycles, page_cross, handler) \
+	static int tail_##name(CPU* cpu, int cycles_completed) { \
+		Word operand = OPERAND(mode, cpu); \
+		TRACE_INSTRUCTION(cpu, name, operand, cycles_completed); \
+		PROFILE_INSTRUCTION(cpu, name); \
+		int c = handler(cpu, operand); \
+		PROFILE_CYCLES(cpu, name, c); \
+		cycles_completed += c; \
+		cpu->budget -= BUDGET_COST(c); \
+		TAIL_DISPATCH(); \
+	}
+#define TAIL_ENTRY(op, name, mnemonic, mode, base_cycles, page_cross, handler) [name] = tail_##name,
+
+OPCODE_TABLE(TAIL_HANDLER)
+
+static const TailHandler tail_dispatch_table[256] = {
+	OPCODE_TABLE(TAIL_ENTRY)
+};
+
+static int run_engine(CPU* cpu, int cycles) {
+	int cycles_completed = 0;
+	cpu_set_budget(cpu, cycles);
+	TAIL_DISPATCH();
+}
+
+#elif CPU_DISPATCH == CPU_DISPATCH_CACHED
+
+static int run_engine(CPU* cpu, int cycles) {
+	return block_cache_run(cpu->block_cache, cpu, cycles);
+}
+
+#elif CPU_DISPATCH == CPU_DISPATCH_JIT
+
+static int run_engine(CPU* cpu, int cycles) {
+	return jit_run(cpu->jit, cpu->block_cache, cpu, cycles);
+}
+
+#else
+
+#define CYCLE_COUNT(name, instr) {  \
 							  int c = instr;\
+							  PROFILE_CYCLES(cpu, name, c);\
 							  cycles_completed += c;\
-							  cycles -= c;\
+							  cpu->budget -= BUDGET_COST(c);\
 							  break;\
 						   }
 
-int cpu_run(CPU* cpu, int cycles) {
+#define SWITCH_CASE(op, name, mnemonic, mode, base_cycles, page_cross, handler) case name: { \
+							  Word operand = OPERAND(mode, cpu);\
+							  TRACE_INSTRUCTION(cpu, name, operand, cycles_completed);\
+							  PROFILE_INSTRUCTION(cpu, name);\
+							  CYCLE_COUNT(name, handler(cpu, operand));\
+						   }
+
+static int run_engine(CPU* cpu, int cycles) {
 	int cycles_completed = 0;
+	cpu_set_budget(cpu, cycles);
 
-    while(cycles > 0) {
+    while(cpu->budget > 0) {
 
-        Byte next_byte = cpu_load_next_byte(cpu);
+        Byte next_byte = fetch_byte(cpu);
 
         switch(next_byte) {
-            case LDA_IMM: CYCLE_COUNT(lda_imm(cpu));
-			case LDA_ZERO: CYCLE_COUNT(lda_zero(cpu));
-			case LDA_ZERO_X: CYCLE_COUNT(lda_zero_x(cpu));
-			case LDA_ABS: CYCLE_COUNT(lda_absolute(cpu));
-			case LDA_ABS_X: CYCLE_COUNT(lda_absolute_x(cpu));
-			case LDA_ABS_Y: CYCLE_COUNT(lda_absolute_y(cpu));
-			case LDA_IND_X: CYCLE_COUNT(lda_indirect_x(cpu));
-			case LDA_IND_Y: CYCLE_COUNT(lda_indirect_y(cpu));
-			case LDX_IMM: CYCLE_COUNT(ldx_imm(cpu));
-			case LDX_ZERO: CYCLE_COUNT(ldx_zero(cpu));
-			case LDX_ZERO_Y: CYCLE_COUNT(ldx_zero_y(cpu));
-			case LDX_ABS: CYCLE_COUNT(ldx_abs(cpu));
-			case LDX_ABS_Y: CYCLE_COUNT(ldx_abs_y(cpu));
-			case LDY_IMM: CYCLE_COUNT(ldy_imm(cpu));
-			case LDY_ZERO: CYCLE_COUNT(ldy_zero(cpu));
-			case LDY_ZERO_X: CYCLE_COUNT(ldy_zero_x(cpu));
-			case LDY_ABS: CYCLE_COUNT(ldy_abs(cpu));
-			case LDY_ABS_X: CYCLE_COUNT(ldy_abs_x(cpu));
-			default:
-				cycles--;
+			OPCODE_TABLE(SWITCH_CASE)
         }
     }
 
 	return cycles_completed;
-}
\ No newline at end of file
+}
+
+#endif
+
+// Whether the loop from start up to the JMP at end only loads, and only from RAM and ROM
+static bool is_idle_loop(Memory* memory, Word start, Word end) {
+	int address = start;
+	while(address < end) {
+		if(memory->read_pages[address >> 8] == NULL || memory->read_pages[(Word)(address + 2) >> 8] == NULL) {
+			return false;
+		}
+		Byte opcode = memory_read(memory, address);
+		if(!opcode_only_reads(opcode)) {
+			return false;
+		}
+		Word operand = memory_read(memory, address + 1) | memory_read(memory, address + 2) << 8;
+		switch(opcode_addressing_modes[opcode]) {
+			case ADDR_IMMEDIATE:
+				break;
+			case ADDR_ZERO:
+			case ADDR_ZERO_X:
+			case ADDR_ZERO_Y:
+				if(memory->read_pages[0] == NULL) {
+					return false;
+				}
+				break;
+			case ADDR_ABS:
+				if(memory->read_pages[operand >> 8] == NULL) {
+					return false;
+				}
+				break;
+			case ADDR_ABS_X:
+			case ADDR_ABS_Y:
+				if(memory->read_pages[operand >> 8] == NULL || memory->read_pages[(Word)(operand + 0xFF) >> 8] == NULL) {
+					return false;
+				}
+				break;
+			default:
+				// A pointer read at run time could lead anywhere, a device included
+				return false;
+		}
+		address += opcode_length(opcode);
+	}
+	return address == end;
+}
+
+/*
+    Called by the JMP at jmp_address back to target, before its cycles are taken from
+    cpu->budget. The loop spins when its body only loads from RAM and ROM, so it neither
+    writes nor touches a device, and it comes back to this JMP with the registers and flags it
+    had the last time round: every further pass is then the same one again, taking as many
+    cycles as the last. Returns the cycles of as many whole passes as fit in the budget without
+    using it up, so the run still ends where it would have. cpu_run ends the budget where the
+    next event is due, which is the only thing that could change what the loop reads.
+*/
+int cpu_skip_spin(CPU* cpu, Word jmp_address, Word target) {
+	u32 state = cpu->accumulator | cpu->idx_reg_x << 8 | cpu->idx_reg_y << 16 | (u32)flags_to_byte(&cpu->flags, false) << 24;
+	if(cpu->spin_address != jmp_address || cpu->spin_state != state) {
+		cpu->spin_address = jmp_address;
+		cpu->spin_state = state;
+		cpu->spin_budget = cpu->budget;
+		return 0;
+	}
+
+	int pass = cpu->spin_budget - cpu->budget;
+	int passes = pass > 0 ? (cpu->budget - opcode_cycles[JMP_ABS] - 1) / pass : 0;
+	if(passes <= 0 || !is_idle_loop(&cpu->memory, target, jmp_address)) {
+		cpu->spin_budget = cpu->budget;
+		return 0;
+	}
+	int skipped = passes * pass;
+	cpu->spin_budget = cpu->budget - skipped;
+	cpu->spin_cycles_skipped += skipped;
+	return skipped;
+}
+
+// Stops the running engine after the current instruction by holding back the rest of its budget
+static void cut_budget(CPU* cpu) {
+	if(cpu->budget > 0) {
+		cpu->budget_held += cpu->budget;
+		cpu->budget = 0;
+	}
+}
+
+// Cuts the budget if an interrupt should be taken at the next instruction boundary
+void cpu_poll_interrupts(CPU* cpu) {
+	if(cpu_interrupt_pending(cpu)) {
+		cut_budget(cpu);
+	}
+}
+
+// Asserts or releases the IRQ lines in mask; the IRQ is taken while any is held and I is clear
+void cpu_set_irq(CPU* cpu, u32 mask, bool asserted) {
+	if(asserted) {
+		cpu->irq_lines |= mask;
+	} else {
+		cpu->irq_lines &= ~mask;
+	}
+	cpu_poll_interrupts(cpu);
+}
+
+// Signals an NMI edge, which is taken once whatever the I flag says
+void cpu_nmi(CPU* cpu) {
+	cpu->nmi_pending = true;
+	cut_budget(cpu);
+}
+
+/*
+    Runs the engine in slices that end where the next event of cpu->scheduler is due or where
+    an interrupt is raised, firing events and taking interrupts in between. A slice only ends
+    at an instruction boundary, so an interrupt is taken right after the instruction that
+    raised it and an event fires at the first boundary at or after its cycle.
+*/
+static int run_slices(CPU* cpu, int cycles, CpuEngine engine) {
+	Scheduler* scheduler = cpu->scheduler;
+	int cycles_completed = 0;
+
+	while(cycles > 0) {
+		if(scheduler != NULL) {
+			scheduler_fire_due(scheduler, cpu);
+		}
+		if(cpu_interrupt_pending(cpu)) {
+			Word vector = cpu->nmi_pending ? CPU_NMI_VECTOR : CPU_IRQ_VECTOR;
+			cpu->nmi_pending = false;
+			int c = enter_interrupt(cpu, cpu->program_counter, vector, false);
+			cpu->clock += c;
+			cycles_completed += c;
+			cycles -= c;
+			continue;
+		}
+
+		int slice = cycles;
+		if(scheduler != NULL && scheduler->count > 0 && scheduler->events[0].when - cpu->clock < (u64)slice) {
+			slice = scheduler->events[0].when - cpu->clock;
+		}
+		cpu->budget_held = 0;
+		int completed = engine(cpu, slice);
+		cpu->clock += completed;
+		cycles_completed += completed;
+		// What the slice used is what it was given less what is left, held back or not
+		cycles -= slice - (cpu->budget_held + cpu->budget);
+	}
+	if(scheduler != NULL) {
+		scheduler_fire_due(scheduler, cpu);
+	}
+	return cycles_completed;
+}
+
+/*
+    Without events or interrupts this is a single engine call, which only checks the budget
+    once per instruction: raising an interrupt cuts the budget to zero, so the engine stops at
+    the next boundary and the rest of the run is sliced.
+*/
+static inline int run(CPU* cpu, int cycles, CpuEngine engine) {
+	Scheduler* scheduler = cpu->scheduler;
+	if(__builtin_expect((scheduler == NULL || scheduler->count == 0) && !cpu_interrupt_pending(cpu), 1)) {
+		cpu->budget_held = 0;
+		int completed = engine(cpu, cycles);
+		cpu->clock += completed;
+		if(__builtin_expect(cpu->budget_held == 0, 1)) {
+			return completed;
+		}
+		return completed + run_slices(cpu, cpu->budget_held + cpu->budget, engine);
+	}
+	return run_slices(cpu, cycles, engine);
+}
+
+int cpu_run(CPU* cpu, int cycles) {
+	return run(cpu, cycles, run_engine);
+}
+
+/*
+    cpu_run with an engine from outside, such as the run function rom2c generates, which gets
+    the same events and interrupts between slices as the built-in one.
+*/
+int cpu_run_engine(CPU* cpu, int cycles, CpuEngine engine) {
+	return run(cpu, cycles, engine);
+}
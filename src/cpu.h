@@ -7,6 +7,48 @@
 #ifndef CPU_H
 #define CPU_H
 
+// Dispatch engine used by cpu_run, chosen at build time with -DCPU_DISPATCH=<engine>
+#define CPU_DISPATCH_SWITCH 0
+#define CPU_DISPATCH_THREADED 1
+#define CPU_DISPATCH_TAILCALL 2
+#define CPU_DISPATCH_CACHED 3
+#define CPU_DISPATCH_JIT 4
+
+#ifndef CPU_DISPATCH
+#define CPU_DISPATCH CPU_DISPATCH_SWITCH
+#endif
+
+// Execution tracer, chosen at build time with -DCPU_TRACE=<mode>, see trace.h
+#define CPU_TRACE_OFF 0
+#define CPU_TRACE_ON 1
+
+#ifndef CPU_TRACE
+#define CPU_TRACE CPU_TRACE_OFF
+#endif
+
+// Execution profiler, chosen at build time with -DCPU_PROFILE=<mode>, see profile.h
+#define CPU_PROFILE_OFF 0
+#define CPU_PROFILE_ON 1
+
+#ifndef CPU_PROFILE
+#define CPU_PROFILE CPU_PROFILE_OFF
+#endif
+
+// Where NMI, cpu_reset and IRQ or BRK read the address to continue from
+#define CPU_NMI_VECTOR 0xFFFA
+#define CPU_RESET_VECTOR 0xFFFC
+#define CPU_IRQ_VECTOR 0xFFFE
+
+// The stack lives on page 1, stack_pointer is the offset of the next free byte
+#define CPU_STACK_PAGE 0x0100
+
+// Cycles taken to push the return address and flags and read the vector of an IRQ or NMI
+#define CPU_INTERRUPT_CYCLES 7
+
+// Longest loop, from the jump target to the JMP closing it, checked for spinning
+#define CPU_SPIN_MAX_BYTES 32
+#define CPU_NO_SPIN -1
+
 typedef struct CPU {
 	Word program_counter;
 	Byte stack_pointer;
@@ -15,14 +57,80 @@ typedef struct CPU {
 	Byte idx_reg_y;
 	Flags flags;
     Memory memory;
+	struct BlockCache* block_cache;
+	struct Jit* jit;
+	// Cycles completed since cpu_init, and the events due at them (NULL for none)
+	u64 clock;
+	struct Scheduler* scheduler;
+	// Budget left to the running engine and what a pending interrupt cut from it, see cpu_run
+	int budget;
+	int budget_held;
+	// IRQ lines held low by devices, a bit each, and an NMI edge not taken yet
+	u32 irq_lines;
+	bool nmi_pending;
+	// The last short backward JMP in this run, with the registers and flags and the budget it
+	// saw, to spot a loop that comes back round unchanged, see cpu_skip_spin
+	int spin_address;
+	u32 spin_state;
+	int spin_budget;
+	unsigned long long spin_cycles_skipped;
+	// The last instructions run and the clock at the one running, in traced builds only
+	struct TraceRing* trace;
+	u64 trace_clock;
+	// Instructions and cycles per opcode and address, in profiled builds only
+	struct Profile* profile;
+	// The subroutines and interrupt handlers being run, while sampled (NULL otherwise)
+	struct CallStack* call_stack;
 } CPU;
 
+typedef int (*OpcodeHandler)(CPU*, Word);
+
+/*
+    Runs instructions until cpu->budget, set with cpu_set_budget, runs out, and returns the
+    cycles they took. It leaves what is left of the budget in cpu->budget and does not advance
+    cpu->clock, which cpu_run and cpu_run_engine do around it.
+*/
+typedef int (*CpuEngine)(CPU*, int);
+
+/*
+    An unimplemented opcode completes no cycles, but still consumes one cycle of the budget so
+    that cpu_run always terminates.
+*/
+#define BUDGET_COST(c) ((c) + ((c) == 0))
+
+extern const OpcodeHandler cpu_opcode_handlers[256];
+
+// Gives a dispatch engine cycles to spend. A spinning loop is only recognised within one run.
+static inline void cpu_set_budget(CPU* cpu, int cycles) {
+	cpu->budget = cycles;
+	cpu->spin_address = CPU_NO_SPIN;
+#if CPU_TRACE == CPU_TRACE_ON
+	cpu->trace_clock = cpu->clock;
+#endif
+}
+
+// Whether an NMI or an unmasked IRQ is waiting for the next instruction boundary
+static inline bool cpu_interrupt_pending(const CPU* cpu) {
+	return cpu->nmi_pending || (cpu->irq_lines != 0 && !flags_interrupt_disable(&cpu->flags));
+}
+
 CPU* cpu_create(int);
 void cpu_destroy(CPU*);
+void cpu_init(CPU*, Byte*, int);
+void cpu_clear_run_state(CPU*);
+void cpu_release(CPU*);
 void cpu_dump_state(CPU*);
 Byte cpu_load_next_byte(CPU*);
 Word cpu_load_next_word(CPU*);
 void cpu_reset(CPU*);
+void cpu_write_byte(CPU*, Word, Byte);
 int cpu_run(CPU*, int);
+int cpu_run_engine(CPU*, int, CpuEngine);
+int cpu_step(CPU*);
+void cpu_set_irq(CPU*, u32, bool);
+void cpu_nmi(CPU*);
+void cpu_poll_interrupts(CPU*);
+int cpu_skip_spin(CPU*, Word, Word);
+const char* cpu_dispatch_name(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,203 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "cpu_pool.h"
+#include "trace.h"
+#include "profile.h"
+
+static size_t round_up(size_t size, size_t unit) {
+    return (size + unit - 1) / unit * unit;
+}
+
+// A 2 MiB aligned anonymous mapping of size bytes, NULL if mmap fails
+static Byte* map_huge_aligned(size_t size, bool explicit_pages) {
+#ifdef MAP_HUGETLB
+    if(explicit_pages) {
+        Byte* arena = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        return arena == MAP_FAILED ? NULL : arena;
+    }
+#else
+    if(explicit_pages) {
+        return NULL;
+    }
+#endif
+
+    // Over-allocate by one huge page and trim both ends to the aligned part
+    Byte* base = mmap(NULL, size + CPU_POOL_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(base == MAP_FAILED) {
+        return NULL;
+    }
+    Byte* arena = (Byte*)round_up((size_t)base, CPU_POOL_HUGE_PAGE_SIZE);
+    if(arena > base) {
+        munmap(base, arena - base);
+    }
+    munmap(arena + size, base + CPU_POOL_HUGE_PAGE_SIZE - arena);
+#ifdef MADV_HUGEPAGE
+    madvise(arena, size, MADV_HUGEPAGE);
+#endif
+    return arena;
+}
+
+// Slots of guard page, memory, guard page and CPU, with everything but the guards read/write
+static Byte* map_guarded(CpuPool* pool) {
+    Byte* arena = mmap(NULL, pool->arena_size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(arena == MAP_FAILED) {
+        return NULL;
+    }
+    for(int slot = 0; slot < pool->slots; slot++) {
+        Byte* base = arena + slot * pool->slot_size;
+        if(mprotect(base + pool->data_offset, MEMORY_ADDRESS_SPACE, PROT_READ | PROT_WRITE) != 0
+                || mprotect(base + pool->cpu_offset, pool->slot_size - pool->cpu_offset, PROT_READ | PROT_WRITE) != 0) {
+            munmap(arena, pool->arena_size);
+            return NULL;
+        }
+    }
+    return arena;
+}
+
+/*
+    Reserves slots CPUs with memory_size bytes of RAM each on pages of the given kind.
+    Explicit huge pages fall back to transparent ones when none are configured; pool->pages
+    holds the kind actually used.
+*/
+CpuPool* cpu_pool_create(int slots, int memory_size, int pages) {
+    if(slots < 1) {
+        return NULL;
+    }
+
+    CpuPool* pool = malloc(sizeof(CpuPool));
+    memset(pool, 0, sizeof(CpuPool));
+    pool->slots = slots;
+    pool->memory_size = memory_size;
+    pool->pages = pages;
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    // One spare page leaves room to colour the CPUs, see slot_cpu
+    size_t cpu_size = round_up(sizeof(CPU), page) + page;
+    if(pages == CPU_POOL_SMALL_PAGES) {
+        pool->data_offset = page;
+        pool->cpu_offset = page + MEMORY_ADDRESS_SPACE + page;
+        pool->slot_size = pool->cpu_offset + cpu_size;
+        pool->arena_size = slots * pool->slot_size;
+        pool->arena = map_guarded(pool);
+    } else {
+        pool->data_offset = 0;
+        pool->cpu_offset = MEMORY_ADDRESS_SPACE;
+        pool->slot_size = pool->cpu_offset + cpu_size;
+        pool->arena_size = round_up(slots * pool->slot_size, CPU_POOL_HUGE_PAGE_SIZE);
+        pool->arena = map_huge_aligned(pool->arena_size, pages == CPU_POOL_EXPLICIT_HUGE_PAGES);
+        if(pool->arena == NULL && pages == CPU_POOL_EXPLICIT_HUGE_PAGES) {
+            pool->pages = CPU_POOL_TRANSPARENT_HUGE_PAGES;
+            pool->arena = map_huge_aligned(pool->arena_size, false);
+        }
+    }
+    if(pool->arena == NULL) {
+        free(pool);
+        return NULL;
+    }
+
+    pool->ready = calloc(slots, sizeof(bool));
+    pool->in_use = calloc(slots, sizeof(bool));
+    pool->free_slots = malloc(slots * sizeof(int));
+    // Slot 0 is on top, so a fresh pool hands out its slots in address order
+    for(int i = 0; i < slots; i++) {
+        pool->free_slots[i] = slots - 1 - i;
+    }
+    pool->free_count = slots;
+    return pool;
+}
+
+/*
+    Every slot starts on a page boundary, so CPUs at the same offset in each would share L1
+    sets and evict each other when many are run in turn. Each CPU is moved along by a
+    different number of cache lines instead.
+*/
+static CPU* slot_cpu(CpuPool* pool, int slot) {
+    size_t colour = (slot % CPU_POOL_PAGE_COLOURS) * CPU_POOL_CACHE_LINE;
+    return (CPU*)(pool->arena + slot * pool->slot_size + pool->cpu_offset + colour);
+}
+
+void cpu_pool_destroy(CpuPool* pool) {
+    for(int slot = 0; slot < pool->slots; slot++) {
+        if(pool->ready[slot]) {
+            cpu_release(slot_cpu(pool, slot));
+        }
+    }
+    munmap(pool->arena, pool->arena_size);
+    free(pool->ready);
+    free(pool->in_use);
+    free(pool->free_slots);
+    free(pool);
+}
+
+// A previous user may have mapped ROM or devices. Plain RAM is only checked, which is cheaper
+// than rebuilding the page table and its home pages
+static void restore_ram_mapping(Memory* memory) {
+    int pages = memory->SIZE_IN_BYTES / MEMORY_PAGE_SIZE;
+    for(int page = 0; page < MEMORY_PAGES; page++) {
+        Byte* host = page < pages ? memory->data + page * MEMORY_PAGE_SIZE : NULL;
+        if(memory->read_pages[page] != host || memory->write_pages[page] != host || memory->home_pages[page] != page
+                || memory->devices[page].read != NULL || memory->devices[page].write != NULL) {
+            memory_unmap(memory, 0, MEMORY_PAGES);
+            memory_map_ram(memory, 0, pages, memory->data);
+            return;
+        }
+    }
+}
+
+// Hands out a reset CPU in O(1), NULL when every slot is taken
+CPU* cpu_pool_acquire(CpuPool* pool) {
+    if(pool->free_count == 0) {
+        return NULL;
+    }
+    int slot = pool->free_slots[--pool->free_count];
+    CPU* cpu = slot_cpu(pool, slot);
+
+    if(!pool->ready[slot]) {
+        cpu_init(cpu, pool->arena + slot * pool->slot_size + pool->data_offset, pool->memory_size);
+        pool->ready[slot] = true;
+    } else {
+        restore_ram_mapping(&cpu->memory);
+        // Snapshots of the previous user must not count as current for this one
+        cpu->memory.snapshot_generation = 0;
+        cpu_clear_run_state(cpu);
+        if(cpu->trace != NULL) {
+            cpu->trace->written = 0;
+        }
+        if(cpu->profile != NULL) {
+            profile_reset(cpu->profile);
+        }
+        // Only a sampler of the previous user asked for call tracking, see sampler_start
+        free(cpu->call_stack);
+        cpu->call_stack = NULL;
+        pool->reuses++;
+    }
+    cpu_reset(cpu);
+    pool->in_use[slot] = true;
+    pool->acquisitions++;
+    return cpu;
+}
+
+/*
+    Takes back a CPU this pool handed out. A CPU from elsewhere, or one released already, would
+    let two users share a slot, so it is refused with false and the pool is left as it was.
+*/
+bool cpu_pool_release(CpuPool* pool, CPU* cpu) {
+    uintptr_t offset = (uintptr_t)cpu - (uintptr_t)pool->arena;
+    if(offset >= pool->arena_size) {
+        return false;
+    }
+    int slot = offset / pool->slot_size;
+    if(slot >= pool->slots || slot_cpu(pool, slot) != cpu || !pool->in_use[slot]) {
+        return false;
+    }
+    pool->in_use[slot] = false;
+    pool->free_slots[pool->free_count++] = slot;
+    return true;
+}
@@ -0,0 +1,50 @@
+#include <stddef.h>
+#include "types.h"
+#include "cpu.h"
+
+#ifndef CPU_POOL_H
+#define CPU_POOL_H
+
+// Backing pages of a pool
+#define CPU_POOL_SMALL_PAGES 0
+#define CPU_POOL_TRANSPARENT_HUGE_PAGES 1
+#define CPU_POOL_EXPLICIT_HUGE_PAGES 2
+
+#define CPU_POOL_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define CPU_POOL_CACHE_LINE 64
+#define CPU_POOL_PAGE_COLOURS 64
+
+/*
+    CPUs carved out of one arena. Each slot holds a page aligned CPU next to its 64 KiB of
+    memory, so acquiring and releasing one is a push or pop on a free list instead of a
+    malloc, an mmap and the engine allocations of cpu_create.
+
+    Released CPUs keep their memory as it was: acquire resets the CPU, which only zeroes the
+    pages written since its last reset. With small pages every slot's memory sits between
+    guard pages, as with cpu_create. Huge pages leave the guards out, which would split them.
+    Pool CPUs go back with cpu_pool_release, never cpu_destroy.
+*/
+typedef struct CpuPool {
+    Byte* arena;
+    size_t arena_size;
+    size_t slot_size;
+    size_t data_offset;
+    size_t cpu_offset;
+    int slots;
+    int memory_size;
+    int pages;
+    bool* ready;
+    // Handed out and not released yet
+    bool* in_use;
+    int* free_slots;
+    int free_count;
+    unsigned long long acquisitions;
+    unsigned long long reuses;
+} CpuPool;
+
+CpuPool* cpu_pool_create(int, int, int);
+void cpu_pool_destroy(CpuPool*);
+CPU* cpu_pool_acquire(CpuPool*);
+bool cpu_pool_release(CpuPool*, CPU*);
+
+#endif
@@ -0,0 +1,258 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "farm.h"
+
+int farm_default_threads(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if(cores < 1) {
+        return 1;
+    }
+    return cores > FARM_MAX_THREADS ? FARM_MAX_THREADS : cores;
+}
+
+static void deque_init(FarmDeque* deque) {
+    pthread_mutex_init(&deque->lock, NULL);
+    deque->capacity = FARM_DEQUE_INITIAL_SIZE;
+    deque->jobs = malloc(deque->capacity * sizeof(FarmJob*));
+    deque->top = 0;
+    deque->bottom = 0;
+}
+
+static void deque_destroy(FarmDeque* deque) {
+    free(deque->jobs);
+    pthread_mutex_destroy(&deque->lock);
+}
+
+// top and bottom only grow, a job lives at index % capacity
+static void deque_push(FarmDeque* deque, FarmJob* job) {
+    pthread_mutex_lock(&deque->lock);
+    if(deque->bottom - deque->top == deque->capacity) {
+        FarmJob** jobs = malloc(2 * deque->capacity * sizeof(FarmJob*));
+        for(int i = deque->top; i < deque->bottom; i++) {
+            jobs[i % (2 * deque->capacity)] = deque->jobs[i % deque->capacity];
+        }
+        free(deque->jobs);
+        deque->jobs = jobs;
+        deque->capacity *= 2;
+    }
+    deque->jobs[deque->bottom % deque->capacity] = job;
+    deque->bottom++;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+static FarmJob* deque_pop(FarmDeque* deque) {
+    FarmJob* job = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if(deque->bottom != deque->top) {
+        deque->bottom--;
+        job = deque->jobs[deque->bottom % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+static FarmJob* deque_steal(FarmDeque* deque) {
+    FarmJob* job = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if(deque->bottom != deque->top) {
+        job = deque->jobs[deque->top % deque->capacity];
+        deque->top++;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return job;
+}
+
+// Pops the worker's own next job, or steals the oldest job of another worker
+static FarmJob* take_job(FarmWorker* worker) {
+    FarmJob* job = deque_pop(&worker->deque);
+    Farm* farm = worker->farm;
+    for(int i = 1; job == NULL && i < farm->threads; i++) {
+        job = deque_steal(&farm->workers[(worker->index + i) % farm->threads].deque);
+        if(job != NULL) {
+            worker->steals++;
+        }
+    }
+    return job;
+}
+
+static void run_job(CPU* cpu, FarmJob* job) {
+    cpu_reset(cpu);
+
+    // Whatever does not fit in RAM is dropped, as writes past it would be
+    int size = job->image_size;
+    if(job->load_address + size > cpu->memory.SIZE_IN_BYTES) {
+        size = cpu->memory.SIZE_IN_BYTES - job->load_address;
+    }
+    if(size > 0) {
+        memcpy(cpu->memory.data + job->load_address, job->image, size);
+        memory_mark_dirty(&cpu->memory, job->load_address, size);
+    }
+
+    cpu->program_counter = job->program_counter;
+    cpu->stack_pointer = job->stack_pointer;
+    cpu->accumulator = job->accumulator;
+    cpu->idx_reg_x = job->idx_reg_x;
+    cpu->idx_reg_y = job->idx_reg_y;
+    cpu->flags = job->flags;
+
+    job->cycles_completed = cpu_run(cpu, job->cycles);
+
+    job->program_counter = cpu->program_counter;
+    job->stack_pointer = cpu->stack_pointer;
+    job->accumulator = cpu->accumulator;
+    job->idx_reg_x = cpu->idx_reg_x;
+    job->idx_reg_y = cpu->idx_reg_y;
+    job->flags = cpu->flags;
+    if(job->finish != NULL) {
+        job->finish(job, cpu);
+    }
+}
+
+static void* worker_main(void* argument) {
+    FarmWorker* worker = argument;
+    Farm* farm = worker->farm;
+
+    for(;;) {
+        FarmJob* job = take_job(worker);
+        if(job == NULL) {
+            pthread_mutex_lock(&farm->lock);
+            while(farm->queued == 0 && !farm->stopping) {
+                pthread_cond_wait(&farm->work_available, &farm->lock);
+            }
+            bool stop = farm->queued == 0 && farm->stopping;
+            pthread_mutex_unlock(&farm->lock);
+            if(stop) {
+                return NULL;
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&farm->lock);
+        farm->queued--;
+        pthread_mutex_unlock(&farm->lock);
+
+        run_job(worker->cpu, job);
+        worker->jobs_run++;
+
+        pthread_mutex_lock(&farm->lock);
+        job->next = NULL;
+        if(farm->completed_tail != NULL) {
+            farm->completed_tail->next = job;
+        } else {
+            farm->completed_head = job;
+        }
+        farm->completed_tail = job;
+        pthread_cond_signal(&farm->job_completed);
+        pthread_mutex_unlock(&farm->lock);
+    }
+}
+
+// Stops the first started worker threads once there is no work left for them
+static void stop_workers(Farm* farm, int started) {
+    pthread_mutex_lock(&farm->lock);
+    farm->stopping = true;
+    pthread_cond_broadcast(&farm->work_available);
+    pthread_mutex_unlock(&farm->lock);
+
+    for(int i = 0; i < started; i++) {
+        pthread_join(farm->workers[i].thread, NULL);
+    }
+}
+
+// Frees a farm whose threads are stopped and whose first ready workers have a CPU and a deque
+static void free_farm(Farm* farm, int ready) {
+    for(int i = 0; i < ready; i++) {
+        cpu_pool_release(farm->cpus, farm->workers[i].cpu);
+        deque_destroy(&farm->workers[i].deque);
+    }
+    cpu_pool_destroy(farm->cpus);
+    pthread_cond_destroy(&farm->job_completed);
+    pthread_cond_destroy(&farm->work_available);
+    pthread_mutex_destroy(&farm->lock);
+    free(farm);
+}
+
+// Starts threads workers (farm_default_threads() if 0) with memory_size bytes of RAM each, NULL if that fails
+Farm* farm_create(int threads, int memory_size) {
+    if(threads == 0) {
+        threads = farm_default_threads();
+    }
+    if(threads < 1 || threads > FARM_MAX_THREADS) {
+        return NULL;
+    }
+
+    Farm* farm = malloc(sizeof(Farm));
+    memset(farm, 0, sizeof(Farm));
+    farm->threads = threads;
+    farm->cpus = cpu_pool_create(threads, memory_size, CPU_POOL_SMALL_PAGES);
+    if(farm->cpus == NULL) {
+        free(farm);
+        return NULL;
+    }
+    pthread_mutex_init(&farm->lock, NULL);
+    pthread_cond_init(&farm->work_available, NULL);
+    pthread_cond_init(&farm->job_completed, NULL);
+
+    for(int i = 0; i < threads; i++) {
+        FarmWorker* worker = &farm->workers[i];
+        worker->farm = farm;
+        worker->index = i;
+        worker->cpu = cpu_pool_acquire(farm->cpus);
+        if(worker->cpu == NULL) {
+            free_farm(farm, i);
+            return NULL;
+        }
+        deque_init(&worker->deque);
+    }
+    for(int i = 0; i < threads; i++) {
+        if(pthread_create(&farm->workers[i].thread, NULL, worker_main, &farm->workers[i]) != 0) {
+            stop_workers(farm, i);
+            free_farm(farm, threads);
+            return NULL;
+        }
+    }
+    return farm;
+}
+
+// Lets the workers finish every submitted job, then stops them
+void farm_destroy(Farm* farm) {
+    stop_workers(farm, farm->threads);
+    free_farm(farm, farm->threads);
+}
+
+void farm_submit(Farm* farm, FarmJob* job) {
+    // Jobs are dealt in turn; farm_submit is called from one thread at a time
+    FarmWorker* worker = &farm->workers[farm->next_worker];
+    farm->next_worker = (farm->next_worker + 1) % farm->threads;
+
+    // Counted before it can be taken, so a worker that takes it never finds queued at 0
+    pthread_mutex_lock(&farm->lock);
+    farm->queued++;
+    farm->outstanding++;
+    deque_push(&worker->deque, job);
+    pthread_cond_signal(&farm->work_available);
+    pthread_mutex_unlock(&farm->lock);
+}
+
+// Blocks until a job finishes and returns it, NULL once every submitted job has been returned
+FarmJob* farm_wait(Farm* farm) {
+    pthread_mutex_lock(&farm->lock);
+    while(farm->completed_head == NULL && farm->outstanding > 0) {
+        pthread_cond_wait(&farm->job_completed, &farm->lock);
+    }
+    FarmJob* job = farm->completed_head;
+    if(job != NULL) {
+        farm->completed_head = job->next;
+        if(farm->completed_head == NULL) {
+            farm->completed_tail = NULL;
+        }
+        farm->outstanding--;
+    }
+    pthread_mutex_unlock(&farm->lock);
+    return job;
+}
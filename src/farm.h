@@ -0,0 +1,91 @@
+#include <pthread.h>
+#include <stddef.h>
+#include "types.h"
+#include "cpu.h"
+#include "cpu_pool.h"
+
+#ifndef FARM_H
+#define FARM_H
+
+#define FARM_MAX_THREADS 64
+#define FARM_DEQUE_INITIAL_SIZE 64
+
+/*
+    One program to run: image is copied to load_address in a freshly reset CPU, which then
+    starts from the registers below and runs for cycles. When the job comes back from
+    farm_wait the registers hold the final state and cycles_completed what cpu_run returned.
+    finish, if set, runs on the worker before its CPU is reused, to read back memory.
+*/
+typedef struct FarmJob {
+    const Byte* image;
+    int image_size;
+    Word load_address;
+    int cycles;
+
+    Word program_counter;
+    Byte stack_pointer;
+    Byte accumulator;
+    Byte idx_reg_x;
+    Byte idx_reg_y;
+    Flags flags;
+
+    void (*finish)(struct FarmJob*, CPU*);
+    void* user;
+
+    int cycles_completed;
+    struct FarmJob* next;
+} FarmJob;
+
+/*
+    A ring of jobs owned by one worker. The owner pushes and pops at the bottom, idle workers
+    steal from the top, so a thief takes the job its owner would have run last.
+*/
+typedef struct FarmDeque {
+    pthread_mutex_t lock;
+    FarmJob** jobs;
+    int capacity;
+    int top;
+    int bottom;
+} FarmDeque;
+
+typedef struct FarmWorker {
+    struct Farm* farm;
+    int index;
+    pthread_t thread;
+    CPU* cpu;
+    FarmDeque deque;
+    unsigned long long jobs_run;
+    unsigned long long steals;
+} FarmWorker;
+
+/*
+    Runs jobs on a pool of threads, each with its own CPU from a CpuPool that is reset and
+    reused for every job. Submitted jobs are dealt to the workers' deques in turn; a worker
+    whose deque runs dry steals from the others. Finished jobs are handed back through a
+    completion queue in the order they finish.
+*/
+typedef struct Farm {
+    int threads;
+    CpuPool* cpus;
+    FarmWorker workers[FARM_MAX_THREADS];
+    int next_worker;
+
+    // Guards queued, outstanding, stopping and the completion queue. queued counts the jobs in
+    // the deques: a job is pushed under this lock once counted, and uncounted once taken.
+    pthread_mutex_t lock;
+    pthread_cond_t work_available;
+    pthread_cond_t job_completed;
+    int queued;
+    int outstanding;
+    bool stopping;
+    FarmJob* completed_head;
+    FarmJob* completed_tail;
+} Farm;
+
+int farm_default_threads(void);
+Farm* farm_create(int, int);
+void farm_destroy(Farm*);
+void farm_submit(Farm*, FarmJob*);
+FarmJob* farm_wait(Farm*);
+
+#endif
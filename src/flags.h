@@ -4,28 +4,126 @@
 #ifndef FLAGS_H
 #define FLAGS_H
 
+// Bits of the 6502 status register P
+#define FLAG_CARRY 0x01
+#define FLAG_ZERO 0x02
+#define FLAG_INTERRUPT_DISABLE 0x04
+#define FLAG_DECIMAL_MODE 0x08
+#define FLAG_BREAK_COMMAND 0x10
+#define FLAG_UNUSED 0x20
+#define FLAG_OVERFLOW 0x40
+#define FLAG_NEGATIVE 0x80
+
+// How N and Z are kept, chosen at build time with -DFLAGS_EVALUATION=<mode>
+#define FLAGS_EVALUATION_EAGER 0
+#define FLAGS_EVALUATION_LAZY 1
+
+#ifndef FLAGS_EVALUATION
+#define FLAGS_EVALUATION FLAGS_EVALUATION_EAGER
+#endif
+
+#define NZ_ENTRY(v) (Byte)(((v) == 0 ? FLAG_ZERO : 0) | ((v) & FLAG_NEGATIVE))
+#define NZ_ENTRIES_4(v) NZ_ENTRY(v), NZ_ENTRY((v) + 1), NZ_ENTRY((v) + 2), NZ_ENTRY((v) + 3)
+#define NZ_ENTRIES_16(v) NZ_ENTRIES_4(v), NZ_ENTRIES_4((v) + 4), NZ_ENTRIES_4((v) + 8), NZ_ENTRIES_4((v) + 12)
+#define NZ_ENTRIES_64(v) NZ_ENTRIES_16(v), NZ_ENTRIES_16((v) + 16), NZ_ENTRIES_16((v) + 32), NZ_ENTRIES_16((v) + 48)
+
+// N and Z as set by loading each byte value
+static const Byte flags_nz_table[256] = {
+	NZ_ENTRIES_64(0), NZ_ENTRIES_64(64), NZ_ENTRIES_64(128), NZ_ENTRIES_64(192)
+};
+
+#if FLAGS_EVALUATION == FLAGS_EVALUATION_LAZY
+
+/*
+    Lazy evaluation records the last result instead of N and Z, and only works them out when
+    they are read. Z is set when the low byte of nz_result is 0 and N is bit 7 of either byte,
+    so setting them from a result is a single 16 bit store, and 0x8000 stands for both set,
+    which no result gives. p holds every other flag with its N and Z bits clear.
+*/
 typedef struct Flags {
-	bool carry: 1;
-	bool zero: 1;
-	bool interrupt_disable: 1;
-	bool decimal_mode: 1;
-	bool break_command: 1;
-	bool overflow: 1;
-	bool negative: 1;
+	Byte p;
+	Word nz_result;
 } Flags;
 
 static inline void flags_set_nz(Flags* flags, Byte accumulator_byte) {
-    if(accumulator_byte == 0) {
-        flags->zero = true;
-    } else {
-        flags->zero = false;
-    }
-
-    if((s8)accumulator_byte < 0) {
-        flags->negative = true;
-    } else {
-        flags->negative = false;
-    }
+	flags->nz_result = accumulator_byte;
+}
+
+// N and Z in their P bit positions
+static inline Byte flags_nz(const Flags* flags) {
+	return ((flags->nz_result | flags->nz_result >> 8) & FLAG_NEGATIVE) | ((flags->nz_result & 0xFF) == 0 ? FLAG_ZERO : 0);
 }
 
+// Sets N and Z from their P bit positions in nz
+static inline void flags_store_nz(Flags* flags, Byte nz) {
+	flags->nz_result = (nz & FLAG_ZERO) ? (nz & FLAG_NEGATIVE) << 8 : (nz & FLAG_NEGATIVE) | 1;
+}
+
+#else
+
+/*
+    The status register packed the way PHP pushes it. Bit 5 has no flip-flop and always reads
+    as 1. B only exists in the pushed copy: PHP and BRK push it set, IRQ and NMI clear, and PLP
+    and RTI ignore it, so it is kept out of p by flags_from_byte.
+*/
+typedef struct Flags {
+	Byte p;
+} Flags;
+
+static inline void flags_set_nz(Flags* flags, Byte accumulator_byte) {
+	flags->p = (flags->p & ~(FLAG_NEGATIVE | FLAG_ZERO)) | flags_nz_table[accumulator_byte];
+}
+
+static inline Byte flags_nz(const Flags* flags) {
+	return flags->p & (FLAG_NEGATIVE | FLAG_ZERO);
+}
+
+static inline void flags_store_nz(Flags* flags, Byte nz) {
+	flags->p = (flags->p & ~(FLAG_NEGATIVE | FLAG_ZERO)) | (nz & (FLAG_NEGATIVE | FLAG_ZERO));
+}
+
+#endif
+
+static inline void flags_reset(Flags* flags) {
+	flags->p = FLAG_UNUSED;
+	flags_store_nz(flags, 0);
+}
+
+// The byte PHP and BRK (break_command true) or IRQ and NMI (false) push
+static inline Byte flags_to_byte(const Flags* flags, bool break_command) {
+	return flags->p | flags_nz(flags) | FLAG_UNUSED | (break_command ? FLAG_BREAK_COMMAND : 0);
+}
+
+// Loads P from a byte pulled by PLP or RTI
+static inline void flags_from_byte(Flags* flags, Byte value) {
+	flags->p = (value & ~(FLAG_BREAK_COMMAND | FLAG_NEGATIVE | FLAG_ZERO)) | FLAG_UNUSED;
+	flags_store_nz(flags, value);
+}
+
+// Field-style accessors, flags_<name>(flags) and flags_set_<name>(flags, value)
+#define FLAG_ACCESSORS(name, bit) \
+	static inline bool flags_##name(const Flags* flags) { \
+		return (flags->p & (bit)) != 0; \
+	} \
+	static inline void flags_set_##name(Flags* flags, bool value) { \
+		flags->p = value ? flags->p | (bit) : flags->p & ~(bit); \
+	}
+
+// The same for N and Z, which lazy evaluation keeps outside p
+#define NZ_FLAG_ACCESSORS(name, bit) \
+	static inline bool flags_##name(const Flags* flags) { \
+		return (flags_nz(flags) & (bit)) != 0; \
+	} \
+	static inline void flags_set_##name(Flags* flags, bool value) { \
+		flags_store_nz(flags, value ? flags_nz(flags) | (bit) : flags_nz(flags) & ~(bit)); \
+	}
+
+FLAG_ACCESSORS(carry, FLAG_CARRY)
+NZ_FLAG_ACCESSORS(zero, FLAG_ZERO)
+FLAG_ACCESSORS(interrupt_disable, FLAG_INTERRUPT_DISABLE)
+FLAG_ACCESSORS(decimal_mode, FLAG_DECIMAL_MODE)
+FLAG_ACCESSORS(break_command, FLAG_BREAK_COMMAND)
+FLAG_ACCESSORS(overflow, FLAG_OVERFLOW)
+NZ_FLAG_ACCESSORS(negative, FLAG_NEGATIVE)
+
 #endif
\ No newline at end of file
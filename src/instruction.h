@@ -1,6 +1,8 @@
 #include "cpu.h"
 #include "flags.h"
 #include "types.h"
+#include "opcodes.h"
+#include "call_stack.h"
 
 #ifndef INSTRUCTION_H
 #define INSTRUCTION_H
@@ -11,193 +13,283 @@
          control on a situational basis.
 */
 
-enum Instruction {
-    LDA_IMM = 0xA9,
-    LDA_ZERO = 0xA5,
-    LDA_ZERO_X = 0xB5,
-    LDA_ABS = 0xAD,
-    LDA_ABS_X = 0xBD,
-    LDA_ABS_Y = 0xB9,
-    LDA_IND_X = 0xA1,
-    LDA_IND_Y = 0xB1,
-    LDX_IMM = 0xA2,
-    LDX_ZERO = 0xA6,
-    LDX_ZERO_Y = 0xB6,
-    LDX_ABS = 0xAE,
-    LDX_ABS_Y = 0xBE,
-    LDY_IMM = 0xA0,
-    LDY_ZERO = 0xA4,
-    LDY_ZERO_X = 0xB4,
-    LDY_ABS = 0xAC,
-    LDY_ABS_X = 0xBC
-};
-
-static inline Byte load_zero_page_value(CPU* cpu, Byte offset) {
-    Byte zero_page_addr = cpu_load_next_byte(cpu);
+/*
+    Handlers receive their operand already fetched by the dispatcher: the immediate or zero page
+    byte, or the absolute word. Every access to guest memory goes through the bus in
+    6502_memory.h. By the time a handler runs the program counter points at the next
+    instruction, so predecoded and translated code can call handlers with a constant operand.
+*/
+
+// Stands in for every opcode in OPCODE_TABLE that has no handler yet
+static inline int unimplemented(CPU* cpu, Word operand) {
+    (void)cpu;
+    (void)operand;
+    return 0;
+}
+
+static inline Byte load_zero_page_value(CPU* cpu, Byte zero_page_addr, Byte offset) {
     // The size of Byte is u8, so this wraps at 255
     Byte effective_addr = zero_page_addr + offset;
-    return cpu->memory.data[effective_addr];
+    return memory_read(&cpu->memory, effective_addr);
 }
 
-static inline Byte load_absolute_value(CPU* cpu, Byte offset) {
-    Word base_addr = cpu_load_next_word(cpu);
+static inline Byte load_absolute_value(CPU* cpu, Word base_addr, Byte offset) {
     Word effective_addr = base_addr + offset;
-    return cpu->memory.data[effective_addr];
+    return memory_read(&cpu->memory, effective_addr);
 }
 
-static inline Byte load_indexed_indirect(CPU* cpu, Byte offset) {
-    Byte begin_byte = cpu_load_next_byte(cpu);
+/*
+    The indexed addressing helpers return the effective address and store in penalty the cycle
+    the 6502 adds when the index carries into the high byte. The carry is bit 8 of
+    base ^ effective, so the penalty needs no branch.
+*/
+static inline int page_cross_penalty(Word base_addr, Word effective_addr) {
+    return ((base_addr ^ effective_addr) >> 8) & 1;
+}
+
+static inline Word absolute_indexed_address(Word base_addr, Byte offset, int* penalty) {
+    Word effective_addr = base_addr + offset;
+    *penalty = page_cross_penalty(base_addr, effective_addr);
+    return effective_addr;
+}
+
+// A pointer stored in the zero page, whose high byte wraps around to $00 after $FF
+static inline Word load_zero_page_pointer(CPU* cpu, Byte zero_page_addr) {
+    Byte lo = memory_read(&cpu->memory, zero_page_addr);
+    Byte hi = memory_read(&cpu->memory, (Byte)(zero_page_addr + 1));
+    return hi << 8 | lo;
+}
+
+static inline Word indirect_indexed_address(CPU* cpu, Byte zero_page_addr, Byte offset, int* penalty) {
+    return absolute_indexed_address(load_zero_page_pointer(cpu, zero_page_addr), offset, penalty);
+}
+
+static inline Byte load_absolute_indexed(CPU* cpu, Word base_addr, Byte offset, int* penalty) {
+    return memory_read(&cpu->memory, absolute_indexed_address(base_addr, offset, penalty));
+}
+
+// (zp,X) indexes the pointer, which stays in the zero page, so it never crosses a page
+static inline Byte load_indexed_indirect(CPU* cpu, Byte begin_byte, Byte offset) {
     Byte indirect_addr = begin_byte + offset;
-    Byte effective_addr = cpu->memory.data[indirect_addr];
-    return cpu->memory.data[effective_addr];
+    return memory_read(&cpu->memory, load_zero_page_pointer(cpu, indirect_addr));
 }
 
-static inline Byte load_indexed_indirect_x(CPU* cpu) {
-    return load_indexed_indirect(cpu, cpu->idx_reg_x);
+static inline Byte load_indexed_indirect_x(CPU* cpu, Byte begin_byte) {
+    return load_indexed_indirect(cpu, begin_byte, cpu->idx_reg_x);
 }
 
-static inline Byte load_indirect_indexed(CPU* cpu, Byte offset) {
-    Byte begin_byte = cpu_load_next_byte(cpu);
-    Byte effective_addr = cpu->memory.data[begin_byte] + offset;
-    return cpu->memory.data[effective_addr];
+static inline Byte load_indirect_indexed(CPU* cpu, Byte begin_byte, Byte offset, int* penalty) {
+    return memory_read(&cpu->memory, indirect_indexed_address(cpu, begin_byte, offset, penalty));
 }
 
-static inline Byte load_indirect_indexed_y(CPU* cpu) {
-    return load_indirect_indexed(cpu, cpu->idx_reg_y);
+static inline Byte load_indirect_indexed_y(CPU* cpu, Byte begin_byte, int* penalty) {
+    return load_indirect_indexed(cpu, begin_byte, cpu->idx_reg_y, penalty);
 }
 
-static inline int lda_imm(CPU* cpu) {
+static inline int lda_imm(CPU* cpu, Word operand) {
     // Sets zero and negative flags
-    Byte accumulator_byte = cpu_load_next_byte(cpu);
+    Byte accumulator_byte = operand;
     cpu->accumulator = accumulator_byte;
     flags_set_nz(&cpu->flags, accumulator_byte);
     return 2;
 }
 
-static inline int lda_zero(CPU* cpu) {
-    Byte accumulator_byte = load_zero_page_value(cpu, 0);
+static inline int lda_zero(CPU* cpu, Word operand) {
+    Byte accumulator_byte = load_zero_page_value(cpu, operand, 0);
     cpu->accumulator = accumulator_byte;
     flags_set_nz(&cpu->flags, accumulator_byte);
     return 3;
 }
 
-static inline int lda_zero_x(CPU* cpu) {
-    Byte accumulator_byte = load_zero_page_value(cpu, cpu->idx_reg_x);
+static inline int lda_zero_x(CPU* cpu, Word operand) {
+    Byte accumulator_byte = load_zero_page_value(cpu, operand, cpu->idx_reg_x);
     cpu->accumulator = accumulator_byte;
     flags_set_nz(&cpu->flags, accumulator_byte);
     return 4;
 }
 
-static inline int lda_absolute(CPU* cpu) {
-    Byte accumulator_byte = load_absolute_value(cpu, 0);
+static inline int lda_absolute(CPU* cpu, Word operand) {
+    Byte accumulator_byte = load_absolute_value(cpu, operand, 0);
     cpu->accumulator = accumulator_byte;
     flags_set_nz(&cpu->flags, accumulator_byte);
     return 4;
 }
 
-/* TODO (ctfloyd) Check (and increase cycle count) if load crosses page boundary */
-static inline int lda_absolute_x(CPU* cpu) {
-    Byte accumulator_byte = load_absolute_value(cpu, cpu->idx_reg_x);
+static inline int lda_absolute_x(CPU* cpu, Word operand) {
+    int penalty;
+    Byte accumulator_byte = load_absolute_indexed(cpu, operand, cpu->idx_reg_x, &penalty);
     cpu->accumulator = accumulator_byte;
     flags_set_nz(&cpu->flags, accumulator_byte);
-    return 4;
+    return 4 + penalty;
 }
 
-/* TODO (ctfloyd) Check (and increase cycle count) if load crosses page boundary */
-static inline int lda_absolute_y(CPU* cpu) {
-    Byte accumulator_byte = load_absolute_value(cpu, cpu->idx_reg_y);
+static inline int lda_absolute_y(CPU* cpu, Word operand) {
+    int penalty;
+    Byte accumulator_byte = load_absolute_indexed(cpu, operand, cpu->idx_reg_y, &penalty);
     cpu->accumulator = accumulator_byte;
     flags_set_nz(&cpu->flags, accumulator_byte);
-    return 4;
+    return 4 + penalty;
 }
 
-static inline int lda_indirect_x(CPU* cpu) {
-    Byte accumulator_byte = load_indexed_indirect_x(cpu);
+static inline int lda_indirect_x(CPU* cpu, Word operand) {
+    Byte accumulator_byte = load_indexed_indirect_x(cpu, operand);
     cpu->accumulator = accumulator_byte;
     flags_set_nz(&cpu->flags, accumulator_byte);
     return 6;
 }
 
-/* TODO (ctfloyd) Check (and increase cycle count) if load crosses page boundary */
-static inline int lda_indirect_y(CPU* cpu) {
-    Byte accumulator_byte = load_indirect_indexed_y(cpu);
+static inline int lda_indirect_y(CPU* cpu, Word operand) {
+    int penalty;
+    Byte accumulator_byte = load_indirect_indexed_y(cpu, operand, &penalty);
     cpu->accumulator = accumulator_byte;
     flags_set_nz(&cpu->flags, accumulator_byte);
-    return 5;
+    return 5 + penalty;
 }
 
-static inline int ldx_imm(CPU* cpu) {
-    Byte x_byte = cpu_load_next_byte(cpu);
+static inline int ldx_imm(CPU* cpu, Word operand) {
+    Byte x_byte = operand;
     cpu->idx_reg_x = x_byte;
     flags_set_nz(&cpu->flags, x_byte);
     return 2;
 }
 
-static inline int ldx_zero(CPU* cpu) {
-    Byte x_byte = load_zero_page_value(cpu, 0);
+static inline int ldx_zero(CPU* cpu, Word operand) {
+    Byte x_byte = load_zero_page_value(cpu, operand, 0);
     cpu->idx_reg_x = x_byte;
     flags_set_nz(&cpu->flags, x_byte);
     return 3;
 }
 
-static inline int ldx_zero_y(CPU* cpu) {
-    Byte x_byte = load_zero_page_value(cpu, cpu->idx_reg_y);
+static inline int ldx_zero_y(CPU* cpu, Word operand) {
+    Byte x_byte = load_zero_page_value(cpu, operand, cpu->idx_reg_y);
     cpu->idx_reg_x = x_byte;
     flags_set_nz(&cpu->flags, x_byte);
     return 4;
 }
 
-static inline int ldx_abs(CPU* cpu) {
-    Byte x_byte = load_absolute_value(cpu, 0);
+static inline int ldx_abs(CPU* cpu, Word operand) {
+    Byte x_byte = load_absolute_value(cpu, operand, 0);
     cpu->idx_reg_x = x_byte;
     flags_set_nz(&cpu->flags, x_byte);
     return 4;
 }
 
 
-/* TODO (ctfloyd): Increase cycle count by one if page boundary is crossed */
-static inline int ldx_abs_y(CPU* cpu) {
-    Byte x_byte = load_absolute_value(cpu, cpu->idx_reg_y);
+static inline int ldx_abs_y(CPU* cpu, Word operand) {
+    int penalty;
+    Byte x_byte = load_absolute_indexed(cpu, operand, cpu->idx_reg_y, &penalty);
     cpu->idx_reg_x = x_byte;
     flags_set_nz(&cpu->flags, x_byte);
-    return 4;
+    return 4 + penalty;
 }
 
-static inline int ldy_imm(CPU* cpu) {
-    Byte y_byte = cpu_load_next_byte(cpu);
+static inline int ldy_imm(CPU* cpu, Word operand) {
+    Byte y_byte = operand;
     cpu->idx_reg_y = y_byte;
     flags_set_nz(&cpu->flags, y_byte);
     return 2;
 }
 
-static inline int ldy_zero(CPU* cpu) {
-    Byte y_byte = load_zero_page_value(cpu, 0);
+static inline int ldy_zero(CPU* cpu, Word operand) {
+    Byte y_byte = load_zero_page_value(cpu, operand, 0);
     cpu->idx_reg_y = y_byte;
     flags_set_nz(&cpu->flags, y_byte);
     return 3;
 }
 
-static inline int ldy_zero_x(CPU* cpu) {
-    Byte y_byte = load_zero_page_value(cpu, cpu->idx_reg_x);
+static inline int ldy_zero_x(CPU* cpu, Word operand) {
+    Byte y_byte = load_zero_page_value(cpu, operand, cpu->idx_reg_x);
     cpu->idx_reg_y = y_byte;
     flags_set_nz(&cpu->flags, y_byte);
     return 4;
 }
 
-static inline int ldy_abs(CPU* cpu) {
-    Byte y_byte = load_absolute_value(cpu, 0);
+static inline int ldy_abs(CPU* cpu, Word operand) {
+    Byte y_byte = load_absolute_value(cpu, operand, 0);
     cpu->idx_reg_y = y_byte;
     flags_set_nz(&cpu->flags, y_byte);
     return 4;
 }
 
 
-/* TODO (ctfloyd): Increase cycle count by one if page boundary is crossed */
-static inline int ldy_abs_x(CPU* cpu) {
-    Byte y_byte = load_absolute_value(cpu, cpu->idx_reg_x);
+static inline int ldy_abs_x(CPU* cpu, Word operand) {
+    int penalty;
+    Byte y_byte = load_absolute_indexed(cpu, operand, cpu->idx_reg_x, &penalty);
     cpu->idx_reg_y = y_byte;
     flags_set_nz(&cpu->flags, y_byte);
-    return 4;
+    return 4 + penalty;
+}
+
+// Jumping back a short way may close a loop that spins, which is skipped ahead, see cpu_skip_spin
+static inline int jmp_absolute(CPU* cpu, Word operand) {
+    Word jmp_address = cpu->program_counter - 3;
+    cpu->program_counter = operand;
+    if(operand <= jmp_address && jmp_address - operand <= CPU_SPIN_MAX_BYTES) {
+        return 3 + cpu_skip_spin(cpu, jmp_address, operand);
+    }
+    return 3;
+}
+
+// The stack grows down through page 1 and wraps within it
+static inline void push_byte(CPU* cpu, Byte value) {
+    cpu_write_byte(cpu, CPU_STACK_PAGE | cpu->stack_pointer, value);
+    cpu->stack_pointer--;
+}
+
+static inline Byte pull_byte(CPU* cpu) {
+    cpu->stack_pointer++;
+    return memory_read(&cpu->memory, CPU_STACK_PAGE | cpu->stack_pointer);
+}
+
+/*
+    Pushes return_address and the flags, masks IRQs and continues from the address at vector.
+    BRK, IRQ and NMI only differ in the vector and the break bit of the pushed flags.
+*/
+static inline int enter_interrupt(CPU* cpu, Word return_address, Word vector, bool break_command) {
+    push_byte(cpu, return_address >> 8);
+    push_byte(cpu, return_address & 0xFF);
+    push_byte(cpu, flags_to_byte(&cpu->flags, break_command));
+    flags_set_interrupt_disable(&cpu->flags, true);
+    cpu->program_counter = memory_read(&cpu->memory, vector) | memory_read(&cpu->memory, vector + 1) << 8;
+    call_stack_enter(cpu, cpu->program_counter, break_command ? CALL_BRK : vector == CPU_NMI_VECTOR ? CALL_NMI : CALL_IRQ, 3);
+    return CPU_INTERRUPT_CYCLES;
+}
+
+// BRK is followed by a padding byte, the return address skips it
+static inline int break_interrupt(CPU* cpu, Word operand) {
+    (void)operand;
+    return enter_interrupt(cpu, cpu->program_counter + 1, CPU_IRQ_VECTOR, true);
+}
+
+// Restoring the flags can unmask an IRQ that is still held, which is then taken right after
+static inline int return_from_interrupt(CPU* cpu, Word operand) {
+    (void)operand;
+    flags_from_byte(&cpu->flags, pull_byte(cpu));
+    Byte lo = pull_byte(cpu);
+    Byte hi = pull_byte(cpu);
+    cpu->program_counter = hi << 8 | lo;
+    call_stack_leave(cpu);
+    cpu_poll_interrupts(cpu);
+    return 6;
+}
+
+// The return address pushed is that of the JSR's last byte, RTS adds the one back
+static inline int jump_to_subroutine(CPU* cpu, Word operand) {
+    Word return_address = cpu->program_counter - 1;
+    push_byte(cpu, return_address >> 8);
+    push_byte(cpu, return_address & 0xFF);
+    cpu->program_counter = operand;
+    call_stack_enter(cpu, operand, CALL_SUBROUTINE, 2);
+    return 6;
+}
+
+static inline int return_from_subroutine(CPU* cpu, Word operand) {
+    (void)operand;
+    Byte lo = pull_byte(cpu);
+    Byte hi = pull_byte(cpu);
+    cpu->program_counter = (hi << 8 | lo) + 1;
+    call_stack_leave(cpu);
+    return 6;
 }
 
 #endif
@@ -0,0 +1,499 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "jit.h"
+#include "opcodes.h"
+
+// Native code records no trace or profile, so traced and profiled builds interpret every block
+#if defined(__x86_64__) && CPU_TRACE == CPU_TRACE_OFF && CPU_PROFILE == CPU_PROFILE_OFF
+
+// Upper bound on the code emitted for one block, checked before compiling
+#define JIT_MAX_BLOCK_CODE 4096
+
+typedef struct Emitter {
+    Byte* cursor;
+} Emitter;
+
+static void emit(Emitter* e, int count, ...) {
+    va_list bytes;
+    va_start(bytes, count);
+    for(int i = 0; i < count; i++) {
+        *e->cursor++ = (Byte)va_arg(bytes, int);
+    }
+    va_end(bytes);
+}
+
+static void emit_u16(Emitter* e, u16 value) {
+    memcpy(e->cursor, &value, sizeof(value));
+    e->cursor += sizeof(value);
+}
+
+static void emit_u32(Emitter* e, u32 value) {
+    memcpy(e->cursor, &value, sizeof(value));
+    e->cursor += sizeof(value);
+}
+
+static void emit_u64(Emitter* e, unsigned long long value) {
+    memcpy(e->cursor, &value, sizeof(value));
+    e->cursor += sizeof(value);
+}
+
+/*
+    Register use inside a native block:
+        rbx  CPU*
+        r12d cycles completed by handlers called out to and page crossing penalties
+        r13  &cpu->memory, or cpu->memory.data in the flat memory layout
+*/
+static void emit_prologue(Emitter* e) {
+    emit(e, 5, 0x53, 0x41, 0x54, 0x41, 0x55);               // push rbx; push r12; push r13
+    emit(e, 3, 0x48, 0x89, 0xFB);                           // mov rbx, rdi
+    emit(e, 3, 0x45, 0x31, 0xE4);                           // xor r12d, r12d
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_FLAT
+    emit(e, 3, 0x4C, 0x8B, 0xAB);                           // mov r13, [rbx + data]
+    emit_u32(e, offsetof(CPU, memory) + offsetof(Memory, data));
+#else
+    emit(e, 3, 0x4C, 0x8D, 0xAB);                           // lea r13, [rbx + memory]
+    emit_u32(e, offsetof(CPU, memory));
+#endif
+}
+
+static void emit_epilogue(Emitter* e, int constant_cycles) {
+    emit(e, 3, 0x44, 0x89, 0xE0);                           // mov eax, r12d
+    emit(e, 1, 0x05);                                       // add eax, constant_cycles
+    emit_u32(e, constant_cycles);
+    emit(e, 6, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3);         // pop r13; pop r12; pop rbx; ret
+}
+
+static void emit_store_program_counter(Emitter* e, Word address) {
+    emit(e, 3, 0x66, 0xC7, 0x83);                           // mov word [rbx + pc], address
+    emit_u32(e, offsetof(CPU, program_counter));
+    emit_u16(e, address);
+}
+
+// Emits a jump with an 8 bit displacement to be filled in by patch_jump
+static Byte* emit_jump(Emitter* e, Byte opcode) {
+    emit(e, 2, opcode, 0x00);
+    return e->cursor;
+}
+
+static void patch_jump(Emitter* e, Byte* after_jump) {
+    after_jump[-1] = (Byte)(e->cursor - after_jump);
+}
+
+/*
+    An interrupt raised by a device or a handler cuts cpu->budget to zero. Native code never
+    counts the budget down, so it is positive until then, and once it is not the block is left
+    right after the instruction ending at next_address with the cycles completed so far.
+*/
+static void emit_budget_check(Emitter* e, Word next_address, int constant_cycles) {
+    emit(e, 2, 0x83, 0xBB);                                 // cmp dword [rbx + budget], 0
+    emit_u32(e, offsetof(CPU, budget));
+    emit(e, 1, 0x00);
+    Byte* to_next = emit_jump(e, 0x7F);                     // jg next
+    emit_store_program_counter(e, next_address);
+    emit_epilogue(e, constant_cycles);
+    patch_jump(e, to_next);
+}
+
+#if FLAGS_EVALUATION == FLAGS_EVALUATION_LAZY
+
+#define NZ_RESULT_OFFSET (offsetof(CPU, flags) + offsetof(Flags, nz_result))
+
+// Stores al into the register at register_offset and records it as the N and Z result
+static void emit_store_and_set_nz(Emitter* e, int register_offset) {
+    emit(e, 2, 0x88, 0x83);                                 // mov [rbx + register], al
+    emit_u32(e, register_offset);
+    emit(e, 3, 0x0F, 0xB6, 0xC0);                           // movzx eax, al
+    emit(e, 3, 0x66, 0x89, 0x83);                           // mov word [rbx + nz_result], ax
+    emit_u32(e, NZ_RESULT_OFFSET);
+}
+
+static void emit_load_immediate(Emitter* e, int register_offset, Byte value) {
+    emit(e, 2, 0xC6, 0x83);                                 // mov byte [rbx + register], value
+    emit_u32(e, register_offset);
+    emit(e, 1, value);
+    emit(e, 3, 0x66, 0xC7, 0x83);                           // mov word [rbx + nz_result], value
+    emit_u32(e, NZ_RESULT_OFFSET);
+    emit_u16(e, value);
+}
+
+#else
+
+// Stores al into the register at register_offset and sets N and Z from it with flags_nz_table
+static void emit_store_and_set_nz(Emitter* e, int register_offset) {
+    emit(e, 2, 0x88, 0x83);                                 // mov [rbx + register], al
+    emit_u32(e, register_offset);
+    emit(e, 3, 0x0F, 0xB6, 0xC0);                           // movzx eax, al
+    emit(e, 2, 0x48, 0xBA);                                 // mov rdx, flags_nz_table
+    emit_u64(e, (unsigned long long)(size_t)flags_nz_table);
+    emit(e, 4, 0x0F, 0xB6, 0x14, 0x02);                     // movzx edx, byte [rdx + rax]
+    emit(e, 2, 0x80, 0xA3);                                 // and byte [rbx + flags], ~(N | Z)
+    emit_u32(e, offsetof(CPU, flags));
+    emit(e, 1, (Byte)~(FLAG_NEGATIVE | FLAG_ZERO));
+    emit(e, 2, 0x08, 0x93);                                 // or [rbx + flags], dl
+    emit_u32(e, offsetof(CPU, flags));
+}
+
+// A load of a constant folds the flag computation into the translation
+static void emit_load_immediate(Emitter* e, int register_offset, Byte value) {
+    emit(e, 2, 0xC6, 0x83);                                 // mov byte [rbx + register], value
+    emit_u32(e, register_offset);
+    emit(e, 1, value);
+    emit(e, 2, 0x80, 0xA3);                                 // and byte [rbx + flags], ~(N | Z)
+    emit_u32(e, offsetof(CPU, flags));
+    emit(e, 1, (Byte)~(FLAG_NEGATIVE | FLAG_ZERO));
+    if(flags_nz_table[value] != 0) {
+        emit(e, 2, 0x80, 0x8B);                             // or byte [rbx + flags], flags
+        emit_u32(e, offsetof(CPU, flags));
+        emit(e, 1, flags_nz_table[value]);
+    }
+}
+
+#endif
+
+static void emit_load_index(Emitter* e, int index_offset) {
+    emit(e, 3, 0x0F, 0xB6, 0x8B);                           // movzx ecx, byte [rbx + index]
+    emit_u32(e, index_offset);
+}
+
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_FLAT
+
+// The flat layout covers every Word, so loads index data without a check
+static void emit_load_from(Emitter* e, Word address) {
+    emit(e, 4, 0x41, 0x0F, 0xB6, 0x85);                     // movzx eax, byte [r13 + address]
+    emit_u32(e, address);
+}
+
+// Loads the byte at the address in ecx
+static void emit_load_from_index(Emitter* e) {
+    emit(e, 6, 0x41, 0x0F, 0xB6, 0x44, 0x0D, 0x00);         // movzx eax, byte [r13 + rcx]
+}
+
+#else
+
+// Device pages have no host pointer, their reads call memory_read_device with the address in esi
+static void emit_device_read(Emitter* e) {
+    emit(e, 3, 0x4C, 0x89, 0xEF);                           // mov rdi, r13
+    emit(e, 2, 0x48, 0xB8);                                 // mov rax, memory_read_device
+    emit_u64(e, (unsigned long long)(size_t)memory_read_device);
+    emit(e, 2, 0xFF, 0xD0);                                 // call rax
+}
+
+// The page of a constant address is known, so only its pointer is loaded at run time
+static void emit_load_from(Emitter* e, Word address) {
+    emit(e, 3, 0x49, 0x8B, 0x85);                           // mov rax, [r13 + read_pages[page]]
+    emit_u32(e, offsetof(Memory, read_pages) + (address >> 8) * sizeof(Byte*));
+    emit(e, 3, 0x48, 0x85, 0xC0);                           // test rax, rax
+    Byte* to_device = emit_jump(e, 0x74);                   // jz device
+    emit(e, 3, 0x0F, 0xB6, 0x80);                           // movzx eax, byte [rax + offset]
+    emit_u32(e, address & 0xFF);
+    Byte* to_done = emit_jump(e, 0xEB);                     // jmp done
+    patch_jump(e, to_device);
+    emit(e, 1, 0xBE);                                       // device: mov esi, address
+    emit_u32(e, address);
+    emit_device_read(e);
+    patch_jump(e, to_done);
+}
+
+// Loads the byte at the address in ecx
+static void emit_load_from_index(Emitter* e) {
+    emit(e, 2, 0x89, 0xCA);                                 // mov edx, ecx
+    emit(e, 3, 0xC1, 0xEA, 0x08);                           // shr edx, 8
+    emit(e, 4, 0x49, 0x8B, 0x84, 0xD5);                     // mov rax, [r13 + rdx * 8 + read_pages]
+    emit_u32(e, offsetof(Memory, read_pages));
+    emit(e, 3, 0x48, 0x85, 0xC0);                           // test rax, rax
+    Byte* to_device = emit_jump(e, 0x74);                   // jz device
+    emit(e, 3, 0x0F, 0xB6, 0xD1);                           // movzx edx, cl
+    emit(e, 4, 0x0F, 0xB6, 0x04, 0x10);                     // movzx eax, byte [rax + rdx]
+    Byte* to_done = emit_jump(e, 0xEB);                     // jmp done
+    patch_jump(e, to_device);
+    emit(e, 2, 0x89, 0xCE);                                 // device: mov esi, ecx
+    emit_device_read(e);
+    patch_jump(e, to_done);
+}
+
+#endif
+
+// Adds the page crossing cycle of the indexed address in ecx to r12d, see page_cross_penalty
+static void emit_page_cross_penalty(Emitter* e, Word base) {
+    emit(e, 2, 0x89, 0xCA);                                 // mov edx, ecx
+    emit(e, 2, 0x81, 0xF2);                                 // xor edx, base
+    emit_u32(e, base);
+    emit(e, 3, 0xC1, 0xEA, 0x08);                           // shr edx, 8
+    emit(e, 3, 0x83, 0xE2, 0x01);                           // and edx, 1
+    emit(e, 3, 0x41, 0x01, 0xD4);                           // add r12d, edx
+}
+
+// Runs the interpreter's handler for instructions the JIT has no translation for
+static void emit_call_handler(Emitter* e, Byte opcode, Word operand, Word next_address) {
+    emit_store_program_counter(e, next_address);
+    emit(e, 3, 0x48, 0x89, 0xDF);                           // mov rdi, rbx
+    emit(e, 1, 0xBE);                                       // mov esi, operand
+    emit_u32(e, operand);
+    emit(e, 2, 0x48, 0xB8);                                 // mov rax, handler
+    emit_u64(e, (unsigned long long)(size_t)cpu_opcode_handlers[opcode]);
+    emit(e, 2, 0xFF, 0xD0);                                 // call rax
+    emit(e, 3, 0x41, 0x01, 0xC4);                           // add r12d, eax
+}
+
+/*
+    A short backward JMP may skip a spinning loop ahead by what is left of cpu->budget, see
+    cpu_skip_spin. Native code only charges the budget when it returns, so the cycles completed
+    before the jump are taken off for the call and given back after it.
+*/
+static void emit_spin_jump(Emitter* e, Word operand, Word next_address, int constant_cycles) {
+    emit(e, 3, 0x44, 0x89, 0xE1);                           // mov ecx, r12d
+    emit(e, 2, 0x81, 0xC1);                                 // add ecx, constant_cycles
+    emit_u32(e, constant_cycles);
+    emit(e, 2, 0x29, 0x8B);                                 // sub [rbx + budget], ecx
+    emit_u32(e, offsetof(CPU, budget));
+    emit_call_handler(e, JMP_ABS, operand, next_address);
+    emit(e, 3, 0x44, 0x89, 0xE1);                           // mov ecx, r12d
+    emit(e, 2, 0x29, 0xC1);                                 // sub ecx, eax
+    emit(e, 2, 0x81, 0xC1);                                 // add ecx, constant_cycles
+    emit_u32(e, constant_cycles);
+    emit(e, 2, 0x01, 0x8B);                                 // add [rbx + budget], ecx
+    emit_u32(e, offsetof(CPU, budget));
+}
+
+static int load_target(Byte opcode) {
+    const char* mnemonic = opcode_mnemonics[opcode];
+    if(strcmp(mnemonic, "LDA") == 0) {
+        return offsetof(CPU, accumulator);
+    } else if(strcmp(mnemonic, "LDX") == 0) {
+        return offsetof(CPU, idx_reg_x);
+    } else if(strcmp(mnemonic, "LDY") == 0) {
+        return offsetof(CPU, idx_reg_y);
+    }
+    return -1;
+}
+
+/*
+    Emits one instruction. Cycles of inlined instructions are added to constant_cycles, called
+    out handlers add theirs at run time. Returns false if the instruction has no translation.
+*/
+static bool emit_instruction(Emitter* e, DecodedInstruction* instruction, Word next_address, int* constant_cycles) {
+    Byte opcode = instruction->opcode;
+    Word operand = instruction->operand;
+    Word jmp_address = next_address - 3;
+    if(opcode == JMP_ABS && operand <= jmp_address && jmp_address - operand <= CPU_SPIN_MAX_BYTES) {
+        emit_spin_jump(e, operand, next_address, *constant_cycles);
+        return true;
+    }
+    if(opcode == JMP_ABS) {
+        emit_store_program_counter(e, operand);
+        *constant_cycles += opcode_cycles[opcode];
+        return true;
+    }
+
+    int target = load_target(opcode);
+    if(target < 0) {
+        return false;
+    }
+
+    switch(opcode_addressing_modes[opcode]) {
+        case ADDR_IMMEDIATE:
+            emit_load_immediate(e, target, operand);
+            break;
+        case ADDR_ZERO:
+        case ADDR_ABS:
+            emit_load_from(e, operand);
+            emit_store_and_set_nz(e, target);
+            break;
+        case ADDR_ZERO_X:
+        case ADDR_ZERO_Y:
+            emit_load_index(e, opcode_addressing_modes[opcode] == ADDR_ZERO_X
+                ? offsetof(CPU, idx_reg_x) : offsetof(CPU, idx_reg_y));
+            emit(e, 3, 0x80, 0xC1, operand);                // add cl, operand
+            emit_load_from_index(e);
+            emit_store_and_set_nz(e, target);
+            break;
+        case ADDR_ABS_X:
+        case ADDR_ABS_Y:
+            emit_load_index(e, opcode_addressing_modes[opcode] == ADDR_ABS_X
+                ? offsetof(CPU, idx_reg_x) : offsetof(CPU, idx_reg_y));
+            emit(e, 2, 0x81, 0xC1);                         // add ecx, operand
+            emit_u32(e, operand);
+            emit(e, 3, 0x0F, 0xB7, 0xC9);                   // movzx ecx, cx
+            emit_page_cross_penalty(e, operand);
+            emit_load_from_index(e);
+            emit_store_and_set_nz(e, target);
+            break;
+        default:
+            emit_call_handler(e, opcode, operand, next_address);
+            if(!opcode_ends_block(opcode)) {
+                emit_budget_check(e, next_address, *constant_cycles);
+            }
+            return true;
+    }
+
+    *constant_cycles += opcode_cycles[opcode];
+#if MEMORY_LAYOUT != MEMORY_LAYOUT_FLAT
+    // Only loads from memory can reach a device
+    if(opcode_addressing_modes[opcode] != ADDR_IMMEDIATE) {
+        emit_budget_check(e, next_address, *constant_cycles);
+    }
+#endif
+    return true;
+}
+
+static bool is_self_modifying(BlockCache* cache, Block* block) {
+    return cache->page_generations[block->pages[0]] >= JIT_SELF_MODIFYING_LIMIT
+        || cache->page_generations[block->pages[1]] >= JIT_SELF_MODIFYING_LIMIT;
+}
+
+/*
+    The code buffer is never writable and executable at once: it is only made writable while a
+    block is translated, so a stray host write can never land in code that is about to run.
+*/
+static bool set_code_writable(Jit* jit, bool writable) {
+    return mprotect(jit->code, JIT_CODE_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+}
+
+static void jit_compile(Jit* jit, BlockCache* cache, Block* block) {
+    if(is_self_modifying(cache, block)) {
+        return;
+    }
+
+    if(JIT_CODE_SIZE - jit->used < JIT_MAX_BLOCK_CODE) {
+        jit_flush(jit, cache);
+    }
+    if(!set_code_writable(jit, true)) {
+        return;
+    }
+
+    Emitter e = { jit->code + jit->used };
+    Byte* entry = e.cursor;
+    int constant_cycles = 0;
+    int max_cycles = 0;
+    int last_max_cycles = 0;
+    int count = 0;
+    Word address = block->start_address;
+
+    emit_prologue(&e);
+    for(; count < block->count; count++) {
+        DecodedInstruction* instruction = &block->instructions[count];
+        Word next_address = address + instruction->length;
+        Byte* rollback = e.cursor;
+
+        if(!emit_instruction(&e, instruction, next_address, &constant_cycles)) {
+            e.cursor = rollback;
+            break;
+        }
+
+        last_max_cycles = opcode_cycles[instruction->opcode] + opcode_page_cross_penalty[instruction->opcode];
+        max_cycles += last_max_cycles;
+        address = next_address;
+    }
+
+    if(count == 0) {
+        set_code_writable(jit, false);
+        return;
+    }
+
+    // An instruction that ends a block is always its last and has set the program counter already
+    if(!opcode_ends_block(block->instructions[count - 1].opcode)) {
+        emit_store_program_counter(&e, address);
+    }
+    emit_epilogue(&e, constant_cycles);
+    // Left out of the buffer if it cannot run, the next translation writes over it
+    if(!set_code_writable(jit, false)) {
+        return;
+    }
+
+    jit->used = e.cursor - jit->code;
+    jit->blocks_compiled++;
+    block->native = (NativeBlock)(void*)entry;
+    block->native_count = count;
+    // The interpreter runs the last translated instruction whenever it starts it, so entering
+    // native code is exact once the budget outlasts every translated instruction before it
+    block->native_min_budget = 1 + max_cycles - last_max_cycles;
+}
+
+Jit* jit_create(void) {
+    // Writable until the first translation, see set_code_writable
+    void* code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(code == MAP_FAILED) {
+        return NULL;
+    }
+
+    Jit* jit = malloc(sizeof(Jit));
+    memset(jit, 0, sizeof(Jit));
+    jit->code = code;
+    return jit;
+}
+
+void jit_destroy(Jit* jit) {
+    munmap(jit->code, JIT_CODE_SIZE);
+    free(jit);
+}
+
+#else
+
+Jit* jit_create(void) {
+    return NULL;
+}
+
+void jit_destroy(Jit* jit) {
+    (void)jit;
+}
+
+static void jit_compile(Jit* jit, BlockCache* cache, Block* block) {
+    (void)jit;
+    (void)cache;
+    (void)block;
+}
+
+#endif
+
+// Drops every translation; blocks are translated again once they are hot
+void jit_flush(Jit* jit, BlockCache* cache) {
+    jit->used = 0;
+    for(int i = 0; i < BLOCK_CACHE_ENTRIES; i++) {
+        cache->blocks[i].native = NULL;
+        cache->blocks[i].executions = 0;
+    }
+}
+
+/*
+    Runs like block_cache_run, entering native code for the translated part of a block
+    whenever the budget allows. Without a JIT (unsupported host, no executable memory) this is
+    the block cache interpreter.
+*/
+int jit_run(Jit* jit, BlockCache* cache, CPU* cpu, int cycles) {
+    if(jit == NULL) {
+        return block_cache_run(cache, cpu, cycles);
+    }
+
+    int cycles_completed = 0;
+    cpu_set_budget(cpu, cycles);
+    while(cpu->budget > 0) {
+        Block* block = block_cache_lookup(cache, cpu, cpu->program_counter);
+        int first = 0;
+
+        if(block->native == NULL && ++block->executions == JIT_HOT_THRESHOLD) {
+            jit_compile(jit, cache, block);
+        }
+
+        if(block->native != NULL && cpu->budget >= block->native_min_budget) {
+            int c = block->native(cpu);
+            jit->native_runs++;
+            cycles_completed += c;
+            cpu->budget -= c;
+            first = block->native_count;
+            // A budget cut by an interrupt leaves native code early, see emit_budget_check
+            if(first == block->count || cpu->budget <= 0) {
+                continue;
+            }
+        }
+
+        cycles_completed += block_cache_execute(cache, block, cpu, first);
+    }
+
+    return cycles_completed;
+}
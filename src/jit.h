@@ -0,0 +1,37 @@
+#include <stddef.h>
+#include "types.h"
+#include "cpu.h"
+#include "block_cache.h"
+
+#ifndef JIT_H
+#define JIT_H
+
+#define JIT_CODE_SIZE (1024 * 1024)
+
+// Executions of a block before it is translated to native code
+#ifndef JIT_HOT_THRESHOLD
+#define JIT_HOT_THRESHOLD 16
+#endif
+
+// Invalidations of a page after which its code is treated as self-modifying and left to the interpreter
+#define JIT_SELF_MODIFYING_LIMIT 8
+
+/*
+    Translates hot blocks from the block cache into x86-64 code. Each native block keeps the
+    CPU registers and flags in the CPU struct, so the interpreter can take over at any block
+    boundary. Instructions the JIT cannot translate end the native part of a block and are
+    interpreted.
+*/
+typedef struct Jit {
+    Byte* code;
+    size_t used;
+    unsigned long long blocks_compiled;
+    unsigned long long native_runs;
+} Jit;
+
+Jit* jit_create(void);
+void jit_destroy(Jit*);
+void jit_flush(Jit*, BlockCache*);
+int jit_run(Jit*, BlockCache*, CPU*, int);
+
+#endif
@@ -0,0 +1,296 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "loader.h"
+#include "block_cache.h"
+
+static bool has_extension(const char* path, const char* extension) {
+    const char* dot = strrchr(path, '.');
+    if(dot == NULL) {
+        return false;
+    }
+    for(dot++; *dot != '\0' && *extension != '\0'; dot++, extension++) {
+        if(tolower((unsigned char)*dot) != *extension) {
+            return false;
+        }
+    }
+    return *dot == '\0' && *extension == '\0';
+}
+
+// Intel HEX for .hex and .ihx, iNES for .nes and raw for anything else
+int loader_format_from_path(const char* path) {
+    if(has_extension(path, "hex") || has_extension(path, "ihx")) {
+        return LOADER_FORMAT_HEX;
+    }
+    if(has_extension(path, "nes")) {
+        return LOADER_FORMAT_INES;
+    }
+    return LOADER_FORMAT_RAW;
+}
+
+static void add_segment(LoaderImage* image, Word origin, int size, const Byte* bytes) {
+    image->segments[image->segment_count++] = (LoaderSegment){ origin, size, bytes };
+}
+
+static bool open_raw(LoaderImage* image, int origin) {
+    int size = image->mapping_size;
+    if(origin == LOADER_ORIGIN_TOP) {
+        origin = MEMORY_ADDRESS_SPACE - size;
+    }
+    if(origin < 0 || origin + size > MEMORY_ADDRESS_SPACE) {
+        return false;
+    }
+
+    const Byte* bytes = image->mapping;
+    int offset = origin % MEMORY_PAGE_SIZE;
+    if(offset != 0) {
+        // ROM is mapped a page at a time, so an image starting inside a page is copied once onto whole pages
+        image->parsed = calloc((offset + size + MEMORY_PAGE_SIZE - 1) / MEMORY_PAGE_SIZE, MEMORY_PAGE_SIZE);
+        memcpy(image->parsed + offset, bytes, size);
+        bytes = image->parsed + offset;
+    }
+    add_segment(image, origin, size, bytes);
+    return true;
+}
+
+static int hex_digit(char c) {
+    if(c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    c = tolower((unsigned char)c);
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+// The byte written as two hex digits at text[at], -1 if there are none
+static int hex_byte(const char* text, int length, int at) {
+    if(at + 2 > length) {
+        return -1;
+    }
+    int high = hex_digit(text[at]);
+    int low = hex_digit(text[at + 1]);
+    return high < 0 || low < 0 ? -1 : high << 4 | low;
+}
+
+/*
+    Parses the records of an Intel HEX file into one buffer covering the address space. Data
+    outside the first 64 KiB, a bad checksum or a malformed record fail the whole file.
+*/
+static bool open_hex(LoaderImage* image, bool* has_start, Word* start) {
+    const char* text = (const char*)image->mapping;
+    int length = image->mapping_size;
+    image->parsed = calloc(MEMORY_ADDRESS_SPACE, 1);
+    int low = MEMORY_ADDRESS_SPACE;
+    int high = -1;
+
+    for(int at = 0; at < length; at++) {
+        if(text[at] != ':') {
+            continue;
+        }
+
+        Byte record[5 + 255];
+        int count = hex_byte(text, length, at + 1);
+        if(count < 0) {
+            return false;
+        }
+        Byte sum = 0;
+        for(int i = 0; i < 5 + count; i++) {
+            int value = hex_byte(text, length, at + 1 + 2 * i);
+            if(value < 0) {
+                return false;
+            }
+            record[i] = value;
+            sum += value;
+        }
+        if(sum != 0) {
+            return false;
+        }
+        at += 2 * (5 + count);
+
+        int address = record[1] << 8 | record[2];
+        const Byte* data = record + 4;
+        switch(record[3]) {
+            case 0x00:
+                if(address + count > MEMORY_ADDRESS_SPACE) {
+                    return false;
+                }
+                memcpy(image->parsed + address, data, count);
+                if(count > 0 && address < low) {
+                    low = address;
+                }
+                if(count > 0 && address + count - 1 > high) {
+                    high = address + count - 1;
+                }
+                break;
+            case 0x01:
+                at = length;
+                break;
+            case 0x02:
+            case 0x04:
+                // Extended segment and linear addresses only reach past 64 KiB
+                if(count != 2 || data[0] != 0 || data[1] != 0) {
+                    return false;
+                }
+                break;
+            case 0x03:
+            case 0x05: {
+                if(count != 4) {
+                    return false;
+                }
+                long segment = record[3] == 0x03 ? (data[0] << 8 | data[1]) << 4 : (long)(data[0] << 8 | data[1]) << 16;
+                long entry = segment + (data[2] << 8 | data[3]);
+                if(entry >= MEMORY_ADDRESS_SPACE) {
+                    return false;
+                }
+                *has_start = true;
+                *start = entry;
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    if(high < 0) {
+        return false;
+    }
+
+    // Starting on a page boundary lets the whole segment be mapped as ROM
+    int origin = low / MEMORY_PAGE_SIZE * MEMORY_PAGE_SIZE;
+    add_segment(image, origin, high + 1 - origin, image->parsed + origin);
+    return true;
+}
+
+static bool open_ines(LoaderImage* image) {
+    const Byte* header = image->mapping;
+    if(image->mapping_size < LOADER_INES_HEADER_SIZE || memcmp(header, "NES\x1A", 4) != 0) {
+        return false;
+    }
+    int banks = header[4];
+    int offset = LOADER_INES_HEADER_SIZE + (header[6] & 0x04 ? LOADER_INES_TRAINER_SIZE : 0);
+    if(banks == 0 || offset + banks * LOADER_INES_BANK_SIZE > image->mapping_size) {
+        return false;
+    }
+
+    const Byte* prg = header + offset;
+    add_segment(image, LOADER_INES_ORIGIN, LOADER_INES_BANK_SIZE, prg);
+    add_segment(image, LOADER_INES_ORIGIN + LOADER_INES_BANK_SIZE, LOADER_INES_BANK_SIZE, prg + (banks - 1) * LOADER_INES_BANK_SIZE);
+    return true;
+}
+
+// The byte the image puts at address, false if no segment covers it
+static bool image_byte(const LoaderImage* image, Word address, Byte* value) {
+    for(int i = 0; i < image->segment_count; i++) {
+        const LoaderSegment* segment = &image->segments[i];
+        if(address >= segment->origin && address < segment->origin + segment->size) {
+            *value = segment->bytes[address - segment->origin];
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    Opens the image at path, NULL if it cannot be read or is not valid in the given format.
+    origin only applies to raw images, which are placed ending at $FFFF for LOADER_ORIGIN_TOP.
+*/
+LoaderImage* loader_open(const char* path, int format, int origin) {
+    LoaderImage* image = malloc(sizeof(LoaderImage));
+    memset(image, 0, sizeof(LoaderImage));
+    image->format = format;
+    image->mapping = memory_open_rom(path, &image->mapping_size);
+    if(image->mapping == NULL) {
+        free(image);
+        return NULL;
+    }
+
+    bool has_start = false;
+    Word start = 0;
+    bool opened = false;
+    switch(format) {
+        case LOADER_FORMAT_RAW: opened = open_raw(image, origin); break;
+        case LOADER_FORMAT_HEX: opened = open_hex(image, &has_start, &start); break;
+        case LOADER_FORMAT_INES: opened = open_ines(image); break;
+    }
+    // A parsed HEX file no longer needs its text
+    if(opened && format == LOADER_FORMAT_HEX) {
+        memory_close_rom(image->mapping, image->mapping_size);
+        image->mapping = NULL;
+    }
+    if(!opened) {
+        loader_close(image);
+        return NULL;
+    }
+
+    Byte low;
+    Byte high;
+    image->covers_vector = image_byte(image, CPU_RESET_VECTOR, &low) && image_byte(image, CPU_RESET_VECTOR + 1, &high);
+    if(image->covers_vector) {
+        image->entry = high << 8 | low;
+    } else {
+        image->entry = has_start ? start : image->segments[0].origin;
+    }
+    image->vector_page[CPU_RESET_VECTOR & 0xFF] = image->entry & 0xFF;
+    image->vector_page[(CPU_RESET_VECTOR + 1) & 0xFF] = image->entry >> 8;
+    return image;
+}
+
+// Closes an image once no CPU maps it any more
+void loader_close(LoaderImage* image) {
+    if(image->mapping != NULL) {
+        memory_close_rom(image->mapping, image->mapping_size);
+    }
+    free(image->parsed);
+    free(image);
+}
+
+/*
+    Loads image into cpu and points the program counter at its entry. The part of each segment
+    that lands on RAM is copied, since RAM is private to the CPU; the rest is mapped in place
+    as ROM, so loading into many CPUs neither copies nor parses it again. The flat layout has
+    no ROM and copies everything. If the image has no reset vector, one for entry goes into
+    RAM at $FFFC or, with nothing mapped there, onto vector_page as ROM.
+
+    cpu_reset clears RAM, including what was copied here and a reset vector written to it, so
+    only the parts mapped as ROM survive a reset; load the image again after one to restart a
+    program that lives in RAM.
+*/
+void loader_load(const LoaderImage* image, CPU* cpu) {
+    Memory* memory = &cpu->memory;
+    for(int i = 0; i < image->segment_count; i++) {
+        const LoaderSegment* segment = &image->segments[i];
+        int end = segment->origin + segment->size;
+        int ram_end = end < memory->SIZE_IN_BYTES ? end : memory->SIZE_IN_BYTES;
+        if(segment->origin < ram_end) {
+            memcpy(memory->data + segment->origin, segment->bytes, ram_end - segment->origin);
+            memory_mark_dirty(memory, segment->origin, ram_end - segment->origin);
+        }
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_PAGED
+        int rom_start = segment->origin > ram_end ? segment->origin : ram_end;
+        if(rom_start < end) {
+            int first_page = rom_start / MEMORY_PAGE_SIZE;
+            int pages = (end - 1) / MEMORY_PAGE_SIZE - first_page + 1;
+            memory_map_rom(memory, first_page, pages, segment->bytes + (first_page * MEMORY_PAGE_SIZE - segment->origin));
+        }
+#endif
+    }
+
+    if(!image->covers_vector) {
+        if(CPU_RESET_VECTOR + 1 < memory->SIZE_IN_BYTES) {
+            memcpy(memory->data + CPU_RESET_VECTOR, image->vector_page + (CPU_RESET_VECTOR & 0xFF), 2);
+            memory_mark_dirty(memory, CPU_RESET_VECTOR, 2);
+        }
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_PAGED
+        else if(memory->read_pages[CPU_RESET_VECTOR >> 8] == NULL && memory->devices[CPU_RESET_VECTOR >> 8].read == NULL) {
+            memory_map_rom(memory, CPU_RESET_VECTOR >> 8, 1, image->vector_page);
+        }
+#endif
+    }
+
+    if(cpu->block_cache != NULL) {
+        block_cache_flush(cpu->block_cache);
+    }
+    cpu->program_counter = image->entry;
+}
@@ -0,0 +1,59 @@
+#include <stdbool.h>
+#include "types.h"
+#include "cpu.h"
+
+#ifndef LOADER_H
+#define LOADER_H
+
+// Image formats understood by loader_open
+#define LOADER_FORMAT_RAW 0
+#define LOADER_FORMAT_HEX 1
+#define LOADER_FORMAT_INES 2
+
+// Origin for a raw image that ends at $FFFF
+#define LOADER_ORIGIN_TOP -1
+
+#define LOADER_MAX_SEGMENTS 2
+#define LOADER_INES_HEADER_SIZE 16
+#define LOADER_INES_TRAINER_SIZE 512
+#define LOADER_INES_BANK_SIZE 0x4000
+#define LOADER_INES_ORIGIN 0x8000
+
+// A run of bytes that appears in the address space from origin up
+typedef struct LoaderSegment {
+    Word origin;
+    int size;
+    const Byte* bytes;
+} LoaderSegment;
+
+/*
+    A program image, opened once and loaded into any number of CPUs. Raw and iNES files are
+    mapped with memory_open_rom and used in place; an Intel HEX file is parsed once into a
+    buffer of whole pages. iNES PRG ROM sits at $8000, with a single 16 KiB bank mirrored at
+    $C000 and, for larger ones, the first and last bank visible as a mapper shows them at
+    power on. CHR ROM is not part of the 6502 address space and is left out.
+
+    entry is where execution starts: the image's own reset vector if it covers one, else the
+    start address of a HEX file, else the lowest loaded address. vector_page is a ROM page
+    holding entry as its reset vector, mapped by loader_load when nothing else is at $FF00.
+    Unlike the parts of an image loaded into RAM, it survives cpu_reset, see loader_load.
+*/
+typedef struct LoaderImage {
+    int format;
+    LoaderSegment segments[LOADER_MAX_SEGMENTS];
+    int segment_count;
+    Word entry;
+    bool covers_vector;
+    Byte vector_page[MEMORY_PAGE_SIZE];
+
+    const Byte* mapping;
+    int mapping_size;
+    Byte* parsed;
+} LoaderImage;
+
+int loader_format_from_path(const char*);
+LoaderImage* loader_open(const char*, int, int);
+void loader_close(LoaderImage*);
+void loader_load(const LoaderImage*, CPU*);
+
+#endif
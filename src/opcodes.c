@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include "opcodes.h"
+
+#define MNEMONIC_ENTRY(op, name, mnemonic, mode, base_cycles, page_cross, handler) [name] = mnemonic,
+#define MODE_ENTRY(op, name, mnemonic, mode, base_cycles, page_cross, handler) [name] = mode,
+#define CYCLES_ENTRY(op, name, mnemonic, mode, base_cycles, page_cross, handler) [name] = base_cycles,
+#define PAGE_CROSS_ENTRY(op, name, mnemonic, mode, base_cycles, page_cross, handler) [name] = page_cross,
+
+const char* const opcode_mnemonics[256] = { OPCODE_TABLE(MNEMONIC_ENTRY) };
+const Byte opcode_addressing_modes[256] = { OPCODE_TABLE(MODE_ENTRY) };
+const Byte opcode_cycles[256] = { OPCODE_TABLE(CYCLES_ENTRY) };
+const Byte opcode_page_cross_penalty[256] = { OPCODE_TABLE(PAGE_CROSS_ENTRY) };
+
+// Instruction length in bytes (opcode included) for each addressing mode
+const Byte addressing_mode_lengths[] = {
+    [ADDR_IMPLIED] = 1,
+    [ADDR_ACCUMULATOR] = 1,
+    [ADDR_IMMEDIATE] = 2,
+    [ADDR_ZERO] = 2,
+    [ADDR_ZERO_X] = 2,
+    [ADDR_ZERO_Y] = 2,
+    [ADDR_ABS] = 3,
+    [ADDR_ABS_X] = 3,
+    [ADDR_ABS_Y] = 3,
+    [ADDR_INDIRECT] = 3,
+    [ADDR_IND_X] = 2,
+    [ADDR_IND_Y] = 2,
+    [ADDR_RELATIVE] = 2
+};
+
+/*
+    Writes the instruction starting at bytes[0] (located at address) in assembler syntax.
+    bytes must hold opcode_length(bytes[0]) bytes. Returns the instruction length.
+*/
+int opcode_disassemble(Word address, const Byte* bytes, char* buffer, size_t size) {
+    Byte opcode = bytes[0];
+    const char* mnemonic = opcode_mnemonics[opcode];
+    int length = opcode_length(opcode);
+    Byte zero_page = length > 1 ? bytes[1] : 0;
+    Word absolute = length > 2 ? (bytes[2] << 8) | zero_page : zero_page;
+
+    switch(opcode_addressing_modes[opcode]) {
+        case ADDR_IMPLIED: snprintf(buffer, size, "%s", mnemonic); break;
+        case ADDR_ACCUMULATOR: snprintf(buffer, size, "%s A", mnemonic); break;
+        case ADDR_IMMEDIATE: snprintf(buffer, size, "%s #$%02X", mnemonic, zero_page); break;
+        case ADDR_ZERO: snprintf(buffer, size, "%s $%02X", mnemonic, zero_page); break;
+        case ADDR_ZERO_X: snprintf(buffer, size, "%s $%02X,X", mnemonic, zero_page); break;
+        case ADDR_ZERO_Y: snprintf(buffer, size, "%s $%02X,Y", mnemonic, zero_page); break;
+        case ADDR_ABS: snprintf(buffer, size, "%s $%04X", mnemonic, absolute); break;
+        case ADDR_ABS_X: snprintf(buffer, size, "%s $%04X,X", mnemonic, absolute); break;
+        case ADDR_ABS_Y: snprintf(buffer, size, "%s $%04X,Y", mnemonic, absolute); break;
+        case ADDR_INDIRECT: snprintf(buffer, size, "%s ($%04X)", mnemonic, absolute); break;
+        case ADDR_IND_X: snprintf(buffer, size, "%s ($%02X,X)", mnemonic, zero_page); break;
+        case ADDR_IND_Y: snprintf(buffer, size, "%s ($%02X),Y", mnemonic, zero_page); break;
+        case ADDR_RELATIVE: {
+            // Branch offsets are relative to the address of the following instruction
+            Word target = address + 2 + (s8)zero_page;
+            snprintf(buffer, size, "%s $%04X", mnemonic, target);
+            break;
+        }
+    }
+
+    return length;
+}
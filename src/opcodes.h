@@ -0,0 +1,330 @@
+#include "types.h"
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifndef OPCODES_H
+#define OPCODES_H
+
+/*
+    The single source of truth for all 256 opcodes. Every row is
+        X(opcode, name, mnemonic, addressing mode, base cycles, page cross penalty, handler)
+    and is expanded into the Instruction enum, the dispatch tables in cpu.c and the metadata
+    tables below. Opcodes without an implementation use the unimplemented handler, which
+    completes no cycles. Undocumented opcodes are listed as ILLEGAL_XX.
+*/
+
+enum AddressingMode {
+    ADDR_IMPLIED,
+    ADDR_ACCUMULATOR,
+    ADDR_IMMEDIATE,
+    ADDR_ZERO,
+    ADDR_ZERO_X,
+    ADDR_ZERO_Y,
+    ADDR_ABS,
+    ADDR_ABS_X,
+    ADDR_ABS_Y,
+    ADDR_INDIRECT,
+    ADDR_IND_X,
+    ADDR_IND_Y,
+    ADDR_RELATIVE
+};
+
+#define OPCODE_TABLE(X) \
+	X(0x00, BRK,        "BRK", ADDR_IMPLIED,     7, 0, break_interrupt) \
+	X(0x01, ORA_IND_X,  "ORA", ADDR_IND_X,       6, 0, unimplemented) \
+	X(0x02, ILLEGAL_02, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x03, ILLEGAL_03, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x04, ILLEGAL_04, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x05, ORA_ZERO,   "ORA", ADDR_ZERO,        3, 0, unimplemented) \
+	X(0x06, ASL_ZERO,   "ASL", ADDR_ZERO,        5, 0, unimplemented) \
+	X(0x07, ILLEGAL_07, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x08, PHP,        "PHP", ADDR_IMPLIED,     3, 0, unimplemented) \
+	X(0x09, ORA_IMM,    "ORA", ADDR_IMMEDIATE,   2, 0, unimplemented) \
+	X(0x0A, ASL_ACC,    "ASL", ADDR_ACCUMULATOR, 2, 0, unimplemented) \
+	X(0x0B, ILLEGAL_0B, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x0C, ILLEGAL_0C, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x0D, ORA_ABS,    "ORA", ADDR_ABS,         4, 0, unimplemented) \
+	X(0x0E, ASL_ABS,    "ASL", ADDR_ABS,         6, 0, unimplemented) \
+	X(0x0F, ILLEGAL_0F, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x10, BPL,        "BPL", ADDR_RELATIVE,    2, 1, unimplemented) \
+	X(0x11, ORA_IND_Y,  "ORA", ADDR_IND_Y,       5, 1, unimplemented) \
+	X(0x12, ILLEGAL_12, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x13, ILLEGAL_13, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x14, ILLEGAL_14, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x15, ORA_ZERO_X, "ORA", ADDR_ZERO_X,      4, 0, unimplemented) \
+	X(0x16, ASL_ZERO_X, "ASL", ADDR_ZERO_X,      6, 0, unimplemented) \
+	X(0x17, ILLEGAL_17, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x18, CLC,        "CLC", ADDR_IMPLIED,     2, 0, unimplemented) \
+	X(0x19, ORA_ABS_Y,  "ORA", ADDR_ABS_Y,       4, 1, unimplemented) \
+	X(0x1A, ILLEGAL_1A, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x1B, ILLEGAL_1B, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x1C, ILLEGAL_1C, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x1D, ORA_ABS_X,  "ORA", ADDR_ABS_X,       4, 1, unimplemented) \
+	X(0x1E, ASL_ABS_X,  "ASL", ADDR_ABS_X,       7, 0, unimplemented) \
+	X(0x1F, ILLEGAL_1F, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x20, JSR_ABS,    "JSR", ADDR_ABS,         6, 0, jump_to_subroutine) \
+	X(0x21, AND_IND_X,  "AND", ADDR_IND_X,       6, 0, unimplemented) \
+	X(0x22, ILLEGAL_22, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x23, ILLEGAL_23, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x24, BIT_ZERO,   "BIT", ADDR_ZERO,        3, 0, unimplemented) \
+	X(0x25, AND_ZERO,   "AND", ADDR_ZERO,        3, 0, unimplemented) \
+	X(0x26, ROL_ZERO,   "ROL", ADDR_ZERO,        5, 0, unimplemented) \
+	X(0x27, ILLEGAL_27, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x28, PLP,        "PLP", ADDR_IMPLIED,     4, 0, unimplemented) \
+	X(0x29, AND_IMM,    "AND", ADDR_IMMEDIATE,   2, 0, unimplemented) \
+	X(0x2A, ROL_ACC,    "ROL", ADDR_ACCUMULATOR, 2, 0, unimplemented) \
+	X(0x2B, ILLEGAL_2B, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x2C, BIT_ABS,    "BIT", ADDR_ABS,         4, 0, unimplemented) \
+	X(0x2D, AND_ABS,    "AND", ADDR_ABS,         4, 0, unimplemented) \
+	X(0x2E, ROL_ABS,    "ROL", ADDR_ABS,         6, 0, unimplemented) \
+	X(0x2F, ILLEGAL_2F, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x30, BMI,        "BMI", ADDR_RELATIVE,    2, 1, unimplemented) \
+	X(0x31, AND_IND_Y,  "AND", ADDR_IND_Y,       5, 1, unimplemented) \
+	X(0x32, ILLEGAL_32, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x33, ILLEGAL_33, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x34, ILLEGAL_34, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x35, AND_ZERO_X, "AND", ADDR_ZERO_X,      4, 0, unimplemented) \
+	X(0x36, ROL_ZERO_X, "ROL", ADDR_ZERO_X,      6, 0, unimplemented) \
+	X(0x37, ILLEGAL_37, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x38, SEC,        "SEC", ADDR_IMPLIED,     2, 0, unimplemented) \
+	X(0x39, AND_ABS_Y,  "AND", ADDR_ABS_Y,       4, 1, unimplemented) \
+	X(0x3A, ILLEGAL_3A, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x3B, ILLEGAL_3B, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x3C, ILLEGAL_3C, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x3D, AND_ABS_X,  "AND", ADDR_ABS_X,       4, 1, unimplemented) \
+	X(0x3E, ROL_ABS_X,  "ROL", ADDR_ABS_X,       7, 0, unimplemented) \
+	X(0x3F, ILLEGAL_3F, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x40, RTI,        "RTI", ADDR_IMPLIED,     6, 0, return_from_interrupt) \
+	X(0x41, EOR_IND_X,  "EOR", ADDR_IND_X,       6, 0, unimplemented) \
+	X(0x42, ILLEGAL_42, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x43, ILLEGAL_43, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x44, ILLEGAL_44, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x45, EOR_ZERO,   "EOR", ADDR_ZERO,        3, 0, unimplemented) \
+	X(0x46, LSR_ZERO,   "LSR", ADDR_ZERO,        5, 0, unimplemented) \
+	X(0x47, ILLEGAL_47, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x48, PHA,        "PHA", ADDR_IMPLIED,     3, 0, unimplemented) \
+	X(0x49, EOR_IMM,    "EOR", ADDR_IMMEDIATE,   2, 0, unimplemented) \
+	X(0x4A, LSR_ACC,    "LSR", ADDR_ACCUMULATOR, 2, 0, unimplemented) \
+	X(0x4B, ILLEGAL_4B, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x4C, JMP_ABS,    "JMP", ADDR_ABS,         3, 0, jmp_absolute) \
+	X(0x4D, EOR_ABS,    "EOR", ADDR_ABS,         4, 0, unimplemented) \
+	X(0x4E, LSR_ABS,    "LSR", ADDR_ABS,         6, 0, unimplemented) \
+	X(0x4F, ILLEGAL_4F, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x50, BVC,        "BVC", ADDR_RELATIVE,    2, 1, unimplemented) \
+	X(0x51, EOR_IND_Y,  "EOR", ADDR_IND_Y,       5, 1, unimplemented) \
+	X(0x52, ILLEGAL_52, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x53, ILLEGAL_53, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x54, ILLEGAL_54, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x55, EOR_ZERO_X, "EOR", ADDR_ZERO_X,      4, 0, unimplemented) \
+	X(0x56, LSR_ZERO_X, "LSR", ADDR_ZERO_X,      6, 0, unimplemented) \
+	X(0x57, ILLEGAL_57, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x58, CLI,        "CLI", ADDR_IMPLIED,     2, 0, unimplemented) \
+	X(0x59, EOR_ABS_Y,  "EOR", ADDR_ABS_Y,       4, 1, unimplemented) \
+	X(0x5A, ILLEGAL_5A, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x5B, ILLEGAL_5B, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x5C, ILLEGAL_5C, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x5D, EOR_ABS_X,  "EOR", ADDR_ABS_X,       4, 1, unimplemented) \
+	X(0x5E, LSR_ABS_X,  "LSR", ADDR_ABS_X,       7, 0, unimplemented) \
+	X(0x5F, ILLEGAL_5F, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x60, RTS,        "RTS", ADDR_IMPLIED,     6, 0, return_from_subroutine) \
+	X(0x61, ADC_IND_X,  "ADC", ADDR_IND_X,       6, 0, unimplemented) \
+	X(0x62, ILLEGAL_62, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x63, ILLEGAL_63, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x64, ILLEGAL_64, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x65, ADC_ZERO,   "ADC", ADDR_ZERO,        3, 0, unimplemented) \
+	X(0x66, ROR_ZERO,   "ROR", ADDR_ZERO,        5, 0, unimplemented) \
+	X(0x67, ILLEGAL_67, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x68, PLA,        "PLA", ADDR_IMPLIED,     4, 0, unimplemented) \
+	X(0x69, ADC_IMM,    "ADC", ADDR_IMMEDIATE,   2, 0, unimplemented) \
+	X(0x6A, ROR_ACC,    "ROR", ADDR_ACCUMULATOR, 2, 0, unimplemented) \
+	X(0x6B, ILLEGAL_6B, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x6C, JMP_IND,    "JMP", ADDR_INDIRECT,    5, 0, unimplemented) \
+	X(0x6D, ADC_ABS,    "ADC", ADDR_ABS,         4, 0, unimplemented) \
+	X(0x6E, ROR_ABS,    "ROR", ADDR_ABS,         6, 0, unimplemented) \
+	X(0x6F, ILLEGAL_6F, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x70, BVS,        "BVS", ADDR_RELATIVE,    2, 1, unimplemented) \
+	X(0x71, ADC_IND_Y,  "ADC", ADDR_IND_Y,       5, 1, unimplemented) \
+	X(0x72, ILLEGAL_72, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x73, ILLEGAL_73, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x74, ILLEGAL_74, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x75, ADC_ZERO_X, "ADC", ADDR_ZERO_X,      4, 0, unimplemented) \
+	X(0x76, ROR_ZERO_X, "ROR", ADDR_ZERO_X,      6, 0, unimplemented) \
+	X(0x77, ILLEGAL_77, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x78, SEI,        "SEI", ADDR_IMPLIED,     2, 0, unimplemented) \
+	X(0x79, ADC_ABS_Y,  "ADC", ADDR_ABS_Y,       4, 1, unimplemented) \
+	X(0x7A, ILLEGAL_7A, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x7B, ILLEGAL_7B, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x7C, ILLEGAL_7C, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x7D, ADC_ABS_X,  "ADC", ADDR_ABS_X,       4, 1, unimplemented) \
+	X(0x7E, ROR_ABS_X,  "ROR", ADDR_ABS_X,       7, 0, unimplemented) \
+	X(0x7F, ILLEGAL_7F, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x80, ILLEGAL_80, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x81, STA_IND_X,  "STA", ADDR_IND_X,       6, 0, unimplemented) \
+	X(0x82, ILLEGAL_82, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x83, ILLEGAL_83, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x84, STY_ZERO,   "STY", ADDR_ZERO,        3, 0, unimplemented) \
+	X(0x85, STA_ZERO,   "STA", ADDR_ZERO,        3, 0, unimplemented) \
+	X(0x86, STX_ZERO,   "STX", ADDR_ZERO,        3, 0, unimplemented) \
+	X(0x87, ILLEGAL_87, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x88, DEY,        "DEY", ADDR_IMPLIED,     2, 0, unimplemented) \
+	X(0x89, ILLEGAL_89, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x8A, TXA,        "TXA", ADDR_IMPLIED,     2, 0, unimplemented) \
+	X(0x8B, ILLEGAL_8B, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x8C, STY_ABS,    "STY", ADDR_ABS,         4, 0, unimplemented) \
+	X(0x8D, STA_ABS,    "STA", ADDR_ABS,         4, 0, unimplemented) \
+	X(0x8E, STX_ABS,    "STX", ADDR_ABS,         4, 0, unimplemented) \
+	X(0x8F, ILLEGAL_8F, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x90, BCC,        "BCC", ADDR_RELATIVE,    2, 1, unimplemented) \
+	X(0x91, STA_IND_Y,  "STA", ADDR_IND_Y,       6, 0, unimplemented) \
+	X(0x92, ILLEGAL_92, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x93, ILLEGAL_93, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x94, STY_ZERO_X, "STY", ADDR_ZERO_X,      4, 0, unimplemented) \
+	X(0x95, STA_ZERO_X, "STA", ADDR_ZERO_X,      4, 0, unimplemented) \
+	X(0x96, STX_ZERO_Y, "STX", ADDR_ZERO_Y,      4, 0, unimplemented) \
+	X(0x97, ILLEGAL_97, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x98, TYA,        "TYA", ADDR_IMPLIED,     2, 0, unimplemented) \
+	X(0x99, STA_ABS_Y,  "STA", ADDR_ABS_Y,       5, 0, unimplemented) \
+	X(0x9A, TXS,        "TXS", ADDR_IMPLIED,     2, 0, unimplemented) \
+	X(0x9B, ILLEGAL_9B, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x9C, ILLEGAL_9C, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x9D, STA_ABS_X,  "STA", ADDR_ABS_X,       5, 0, unimplemented) \
+	X(0x9E, ILLEGAL_9E, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0x9F, ILLEGAL_9F, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xA0, LDY_IMM,    "LDY", ADDR_IMMEDIATE,   2, 0, ldy_imm) \
+	X(0xA1, LDA_IND_X,  "LDA", ADDR_IND_X,       6, 0, lda_indirect_x) \
+	X(0xA2, LDX_IMM,    "LDX", ADDR_IMMEDIATE,   2, 0, ldx_imm) \
+	X(0xA3, ILLEGAL_A3, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xA4, LDY_ZERO,   "LDY", ADDR_ZERO,        3, 0, ldy_zero) \
+	X(0xA5, LDA_ZERO,   "LDA", ADDR_ZERO,        3, 0, lda_zero) \
+	X(0xA6, LDX_ZERO,   "LDX", ADDR_ZERO,        3, 0, ldx_zero) \
+	X(0xA7, ILLEGAL_A7, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xA8, TAY,        "TAY", ADDR_IMPLIED,     2, 0, unimplemented) \
+	X(0xA9, LDA_IMM,    "LDA", ADDR_IMMEDIATE,   2, 0, lda_imm) \
+	X(0xAA, TAX,        "TAX", ADDR_IMPLIED,     2, 0, unimplemented) \
+	X(0xAB, ILLEGAL_AB, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xAC, LDY_ABS,    "LDY", ADDR_ABS,         4, 0, ldy_abs) \
+	X(0xAD, LDA_ABS,    "LDA", ADDR_ABS,         4, 0, lda_absolute) \
+	X(0xAE, LDX_ABS,    "LDX", ADDR_ABS,         4, 0, ldx_abs) \
+	X(0xAF, ILLEGAL_AF, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xB0, BCS,        "BCS", ADDR_RELATIVE,    2, 1, unimplemented) \
+	X(0xB1, LDA_IND_Y,  "LDA", ADDR_IND_Y,       5, 1, lda_indirect_y) \
+	X(0xB2, ILLEGAL_B2, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xB3, ILLEGAL_B3, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xB4, LDY_ZERO_X, "LDY", ADDR_ZERO_X,      4, 0, ldy_zero_x) \
+	X(0xB5, LDA_ZERO_X, "LDA", ADDR_ZERO_X,      4, 0, lda_zero_x) \
+	X(0xB6, LDX_ZERO_Y, "LDX", ADDR_ZERO_Y,      4, 0, ldx_zero_y) \
+	X(0xB7, ILLEGAL_B7, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xB8, CLV,        "CLV", ADDR_IMPLIED,     2, 0, unimplemented) \
+	X(0xB9, LDA_ABS_Y,  "LDA", ADDR_ABS_Y,       4, 1, lda_absolute_y) \
+	X(0xBA, TSX,        "TSX", ADDR_IMPLIED,     2, 0, unimplemented) \
+	X(0xBB, ILLEGAL_BB, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xBC, LDY_ABS_X,  "LDY", ADDR_ABS_X,       4, 1, ldy_abs_x) \
+	X(0xBD, LDA_ABS_X,  "LDA", ADDR_ABS_X,       4, 1, lda_absolute_x) \
+	X(0xBE, LDX_ABS_Y,  "LDX", ADDR_ABS_Y,       4, 1, ldx_abs_y) \
+	X(0xBF, ILLEGAL_BF, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xC0, CPY_IMM,    "CPY", ADDR_IMMEDIATE,   2, 0, unimplemented) \
+	X(0xC1, CMP_IND_X,  "CMP", ADDR_IND_X,       6, 0, unimplemented) \
+	X(0xC2, ILLEGAL_C2, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xC3, ILLEGAL_C3, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xC4, CPY_ZERO,   "CPY", ADDR_ZERO,        3, 0, unimplemented) \
+	X(0xC5, CMP_ZERO,   "CMP", ADDR_ZERO,        3, 0, unimplemented) \
+	X(0xC6, DEC_ZERO,   "DEC", ADDR_ZERO,        5, 0, unimplemented) \
+	X(0xC7, ILLEGAL_C7, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xC8, INY,        "INY", ADDR_IMPLIED,     2, 0, unimplemented) \
+	X(0xC9, CMP_IMM,    "CMP", ADDR_IMMEDIATE,   2, 0, unimplemented) \
+	X(0xCA, DEX,        "DEX", ADDR_IMPLIED,     2, 0, unimplemented) \
+	X(0xCB, ILLEGAL_CB, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xCC, CPY_ABS,    "CPY", ADDR_ABS,         4, 0, unimplemented) \
+	X(0xCD, CMP_ABS,    "CMP", ADDR_ABS,         4, 0, unimplemented) \
+	X(0xCE, DEC_ABS,    "DEC", ADDR_ABS,         6, 0, unimplemented) \
+	X(0xCF, ILLEGAL_CF, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xD0, BNE,        "BNE", ADDR_RELATIVE,    2, 1, unimplemented) \
+	X(0xD1, CMP_IND_Y,  "CMP", ADDR_IND_Y,       5, 1, unimplemented) \
+	X(0xD2, ILLEGAL_D2, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xD3, ILLEGAL_D3, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xD4, ILLEGAL_D4, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xD5, CMP_ZERO_X, "CMP", ADDR_ZERO_X,      4, 0, unimplemented) \
+	X(0xD6, DEC_ZERO_X, "DEC", ADDR_ZERO_X,      6, 0, unimplemented) \
+	X(0xD7, ILLEGAL_D7, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xD8, CLD,        "CLD", ADDR_IMPLIED,     2, 0, unimplemented) \
+	X(0xD9, CMP_ABS_Y,  "CMP", ADDR_ABS_Y,       4, 1, unimplemented) \
+	X(0xDA, ILLEGAL_DA, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xDB, ILLEGAL_DB, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xDC, ILLEGAL_DC, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xDD, CMP_ABS_X,  "CMP", ADDR_ABS_X,       4, 1, unimplemented) \
+	X(0xDE, DEC_ABS_X,  "DEC", ADDR_ABS_X,       7, 0, unimplemented) \
+	X(0xDF, ILLEGAL_DF, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xE0, CPX_IMM,    "CPX", ADDR_IMMEDIATE,   2, 0, unimplemented) \
+	X(0xE1, SBC_IND_X,  "SBC", ADDR_IND_X,       6, 0, unimplemented) \
+	X(0xE2, ILLEGAL_E2, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xE3, ILLEGAL_E3, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xE4, CPX_ZERO,   "CPX", ADDR_ZERO,        3, 0, unimplemented) \
+	X(0xE5, SBC_ZERO,   "SBC", ADDR_ZERO,        3, 0, unimplemented) \
+	X(0xE6, INC_ZERO,   "INC", ADDR_ZERO,        5, 0, unimplemented) \
+	X(0xE7, ILLEGAL_E7, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xE8, INX,        "INX", ADDR_IMPLIED,     2, 0, unimplemented) \
+	X(0xE9, SBC_IMM,    "SBC", ADDR_IMMEDIATE,   2, 0, unimplemented) \
+	X(0xEA, NOP,        "NOP", ADDR_IMPLIED,     2, 0, unimplemented) \
+	X(0xEB, ILLEGAL_EB, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xEC, CPX_ABS,    "CPX", ADDR_ABS,         4, 0, unimplemented) \
+	X(0xED, SBC_ABS,    "SBC", ADDR_ABS,         4, 0, unimplemented) \
+	X(0xEE, INC_ABS,    "INC", ADDR_ABS,         6, 0, unimplemented) \
+	X(0xEF, ILLEGAL_EF, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xF0, BEQ,        "BEQ", ADDR_RELATIVE,    2, 1, unimplemented) \
+	X(0xF1, SBC_IND_Y,  "SBC", ADDR_IND_Y,       5, 1, unimplemented) \
+	X(0xF2, ILLEGAL_F2, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xF3, ILLEGAL_F3, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xF4, ILLEGAL_F4, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xF5, SBC_ZERO_X, "SBC", ADDR_ZERO_X,      4, 0, unimplemented) \
+	X(0xF6, INC_ZERO_X, "INC", ADDR_ZERO_X,      6, 0, unimplemented) \
+	X(0xF7, ILLEGAL_F7, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xF8, SED,        "SED", ADDR_IMPLIED,     2, 0, unimplemented) \
+	X(0xF9, SBC_ABS_Y,  "SBC", ADDR_ABS_Y,       4, 1, unimplemented) \
+	X(0xFA, ILLEGAL_FA, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xFB, ILLEGAL_FB, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xFC, ILLEGAL_FC, "???", ADDR_IMPLIED,     0, 0, unimplemented) \
+	X(0xFD, SBC_ABS_X,  "SBC", ADDR_ABS_X,       4, 1, unimplemented) \
+	X(0xFE, INC_ABS_X,  "INC", ADDR_ABS_X,       7, 0, unimplemented) \
+	X(0xFF, ILLEGAL_FF, "???", ADDR_IMPLIED,     0, 0, unimplemented)
+
+#define OPCODE_ENUM_ENTRY(op, name, mnemonic, mode, base_cycles, page_cross, handler) name = op,
+
+enum Instruction {
+    OPCODE_TABLE(OPCODE_ENUM_ENTRY)
+};
+
+extern const char* const opcode_mnemonics[256];
+extern const Byte opcode_addressing_modes[256];
+extern const Byte opcode_cycles[256];
+extern const Byte opcode_page_cross_penalty[256];
+extern const Byte addressing_mode_lengths[];
+
+int opcode_disassemble(Word, const Byte*, char*, size_t);
+
+static inline int opcode_length(Byte opcode) {
+    return addressing_mode_lengths[opcode_addressing_modes[opcode]];
+}
+
+// Opcodes that only set registers and flags from what they read, the loads
+static inline bool opcode_only_reads(Byte opcode) {
+    switch(opcode) {
+        case LDA_IMM: case LDA_ZERO: case LDA_ZERO_X: case LDA_ABS: case LDA_ABS_X: case LDA_ABS_Y: case LDA_IND_X: case LDA_IND_Y:
+        case LDX_IMM: case LDX_ZERO: case LDX_ZERO_Y: case LDX_ABS: case LDX_ABS_Y:
+        case LDY_IMM: case LDY_ZERO: case LDY_ZERO_X: case LDY_ABS: case LDY_ABS_X:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Opcodes that can change the program counter, which end a decoded block
+static inline bool opcode_ends_block(Byte opcode) {
+    switch(opcode) {
+        case BRK: case JMP_ABS: case JMP_IND: case JSR_ABS: case RTI: case RTS:
+            return true;
+        default:
+            return opcode_addressing_modes[opcode] == ADDR_RELATIVE;
+    }
+}
+
+#endif
@@ -0,0 +1,159 @@
+#include <stdlib.h>
+#include <string.h>
+#include "profile.h"
+
+static const char* const mode_names[] = {
+    [ADDR_IMPLIED] = "implied",
+    [ADDR_ACCUMULATOR] = "accumulator",
+    [ADDR_IMMEDIATE] = "immediate",
+    [ADDR_ZERO] = "zero",
+    [ADDR_ZERO_X] = "zero_x",
+    [ADDR_ZERO_Y] = "zero_y",
+    [ADDR_ABS] = "absolute",
+    [ADDR_ABS_X] = "absolute_x",
+    [ADDR_ABS_Y] = "absolute_y",
+    [ADDR_INDIRECT] = "indirect",
+    [ADDR_IND_X] = "indirect_x",
+    [ADDR_IND_Y] = "indirect_y",
+    [ADDR_RELATIVE] = "relative"
+};
+
+Profile* profile_create(void) {
+    Profile* profile = malloc(sizeof(Profile));
+    profile_reset(profile);
+    return profile;
+}
+
+void profile_destroy(Profile* profile) {
+    free(profile);
+}
+
+void profile_reset(Profile* profile) {
+    memset(profile, 0, sizeof(Profile));
+}
+
+static u64 total_instructions(const Profile* profile) {
+    u64 total = 0;
+    for(int opcode = 0; opcode < 256; opcode++) {
+        total += profile->opcodes[opcode].executions;
+    }
+    return total;
+}
+
+static u64 total_cycles(const Profile* profile) {
+    u64 total = 0;
+    for(int opcode = 0; opcode < 256; opcode++) {
+        total += profile->opcodes[opcode].cycles;
+    }
+    return total;
+}
+
+// One row per opcode that ran
+void profile_write_opcodes_csv(const Profile* profile, FILE* out) {
+    fprintf(out, "opcode,mnemonic,mode,executions,cycles,page_crosses\n");
+    for(int opcode = 0; opcode < 256; opcode++) {
+        const ProfileOpcode* counters = &profile->opcodes[opcode];
+        if(counters->executions > 0) {
+            fprintf(out, "0x%02X,%s,%s,%llu,%llu,%llu\n", opcode, opcode_mnemonics[opcode],
+                    mode_names[opcode_addressing_modes[opcode]], (unsigned long long)counters->executions,
+                    (unsigned long long)counters->cycles, (unsigned long long)profile_page_crosses(profile, opcode));
+        }
+    }
+}
+
+// One row per address where instructions started
+void profile_write_addresses_csv(const Profile* profile, FILE* out) {
+    fprintf(out, "address,executions\n");
+    for(int address = 0; address < MEMORY_ADDRESS_SPACE; address++) {
+        if(profile->addresses[address] > 0) {
+            fprintf(out, "0x%04X,%llu\n", address, (unsigned long long)profile->addresses[address]);
+        }
+    }
+}
+
+// Both tables in one object, with the totals, leaving out what never ran
+void profile_write_json(const Profile* profile, FILE* out) {
+    fprintf(out, "{\n  \"instructions\": %llu,\n  \"cycles\": %llu,\n  \"opcodes\": [",
+            (unsigned long long)total_instructions(profile), (unsigned long long)total_cycles(profile));
+    const char* separator = "\n";
+    for(int opcode = 0; opcode < 256; opcode++) {
+        const ProfileOpcode* counters = &profile->opcodes[opcode];
+        if(counters->executions > 0) {
+            fprintf(out, "%s    {\"opcode\": %d, \"mnemonic\": \"%s\", \"mode\": \"%s\", \"executions\": %llu, \"cycles\": %llu, \"page_crosses\": %llu}",
+                    separator, opcode, opcode_mnemonics[opcode], mode_names[opcode_addressing_modes[opcode]],
+                    (unsigned long long)counters->executions, (unsigned long long)counters->cycles,
+                    (unsigned long long)profile_page_crosses(profile, opcode));
+            separator = ",\n";
+        }
+    }
+    fprintf(out, "\n  ],\n  \"addresses\": [");
+    separator = "\n";
+    for(int address = 0; address < MEMORY_ADDRESS_SPACE; address++) {
+        if(profile->addresses[address] > 0) {
+            fprintf(out, "%s    {\"address\": %d, \"executions\": %llu}", separator, address,
+                    (unsigned long long)profile->addresses[address]);
+            separator = ",\n";
+        }
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+// Reads address without side effects, false where only a device answers
+static bool peek(const Memory* memory, Word address, Byte* value) {
+#if MEMORY_LAYOUT == MEMORY_LAYOUT_FLAT
+    *value = memory->data[address];
+    return true;
+#else
+    const Byte* page = memory->read_pages[address >> 8];
+    if(page == NULL) {
+        return false;
+    }
+    *value = page[address & 0xFF];
+    return true;
+#endif
+}
+
+/*
+    Disassembles every address where instructions started, with how many did and their share
+    of all instructions run, and the base cycles that makes with the opcode there now. Runs of
+    consecutive instructions are kept together, so a hot loop reads as one block.
+*/
+void profile_write_listing(const Profile* profile, const Memory* memory, FILE* out) {
+    u64 instructions = total_instructions(profile);
+    fprintf(out, "; %llu instructions, %llu cycles\n", (unsigned long long)instructions,
+            (unsigned long long)total_cycles(profile));
+    fprintf(out, ";   executions       %%      cycles  address  bytes     instruction\n");
+
+    int next = -1;
+    for(int address = 0; address < MEMORY_ADDRESS_SPACE; address++) {
+        u64 executions = profile->addresses[address];
+        if(executions == 0) {
+            continue;
+        }
+        if(address != next) {
+            fprintf(out, "\n");
+        }
+
+        Byte bytes[3] = { 0, 0, 0 };
+        if(!peek(memory, address, &bytes[0])) {
+            fprintf(out, "%14llu  %6.2f  %10s     %04X  (device)\n", (unsigned long long)executions,
+                    100.0 * executions / instructions, "", address);
+            next = address + 1;
+            continue;
+        }
+        int length = opcode_length(bytes[0]);
+        for(int b = 1; b < length && b < (int)sizeof(bytes); b++) {
+            peek(memory, address + b, &bytes[b]);
+        }
+        char text[32];
+        opcode_disassemble(address, bytes, text, sizeof(text));
+        char hex[9] = "";
+        for(int b = 0, at = 0; b < length; b++) {
+            at += snprintf(hex + at, sizeof(hex) - at, b == 0 ? "%02X" : " %02X", bytes[b]);
+        }
+        fprintf(out, "%14llu  %6.2f  %10llu     %04X  %-8s  %s\n", (unsigned long long)executions,
+                100.0 * executions / instructions, (unsigned long long)(executions * opcode_cycles[bytes[0]]),
+                address, hex, text);
+        next = address + length;
+    }
+}
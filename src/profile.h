@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include "types.h"
+#include "cpu.h"
+#include "opcodes.h"
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+typedef struct ProfileOpcode {
+    u64 executions;
+    u64 cycles;
+} ProfileOpcode;
+
+/*
+    Where a CPU spent its instructions and cycles, in builds with CPU_PROFILE_ON: per opcode,
+    how often it ran and the cycles it took, and per address, how many instructions started
+    there. Every interpreter counts from cpu_run; the JIT is not built, and batch lanes and AOT
+    translated code are not counted. The cycles of a spinning loop skipped ahead count as the
+    closing JMP's, see cpu_skip_spin.
+*/
+typedef struct Profile {
+    ProfileOpcode opcodes[256];
+    u64 addresses[MEMORY_ADDRESS_SPACE];
+} Profile;
+
+// Cycles the opcode took over its base cycles, which is only ever the page crossing cycle
+static inline u64 profile_page_crosses(const Profile* profile, Byte opcode) {
+    if(!opcode_page_cross_penalty[opcode]) {
+        return 0;
+    }
+    return profile->opcodes[opcode].cycles - profile->opcodes[opcode].executions * opcode_cycles[opcode];
+}
+
+#if CPU_PROFILE == CPU_PROFILE_ON
+
+// Counts the instruction whose operand was just fetched, length bytes before the program counter
+static inline void profile_instruction(CPU* cpu, Byte opcode, int length) {
+    Profile* profile = cpu->profile;
+    profile->opcodes[opcode].executions++;
+    profile->addresses[(Word)(cpu->program_counter - length)]++;
+}
+
+#define PROFILE_INSTRUCTION(cpu, opcode) profile_instruction(cpu, opcode, opcode_length(opcode))
+#define PROFILE_CYCLES(cpu, opcode, c) ((cpu)->profile->opcodes[opcode].cycles += (c))
+
+#else
+
+#define PROFILE_INSTRUCTION(cpu, opcode) ((void)0)
+#define PROFILE_CYCLES(cpu, opcode, c) ((void)0)
+
+#endif
+
+Profile* profile_create(void);
+void profile_destroy(Profile*);
+void profile_reset(Profile*);
+void profile_write_opcodes_csv(const Profile*, FILE*);
+void profile_write_addresses_csv(const Profile*, FILE*);
+void profile_write_json(const Profile*, FILE*);
+void profile_write_listing(const Profile*, const Memory*, FILE*);
+
+#endif
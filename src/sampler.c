@@ -0,0 +1,156 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sampler.h"
+#include "scheduler.h"
+
+static const char* const frame_prefixes[] = {
+    [CALL_SUBROUTINE] = "sub",
+    [CALL_IRQ] = "irq",
+    [CALL_NMI] = "nmi",
+    [CALL_BRK] = "brk"
+};
+
+Sampler* sampler_create(int period) {
+    Sampler* sampler = malloc(sizeof(Sampler));
+    memset(sampler, 0, sizeof(Sampler));
+    sampler->period = period;
+    sampler->capacity = SAMPLER_INITIAL_SIZE;
+    sampler->stacks = calloc(sampler->capacity, sizeof(SampledStack));
+    return sampler;
+}
+
+void sampler_destroy(Sampler* sampler) {
+    for(int i = 0; i < sampler->capacity; i++) {
+        free(sampler->stacks[i].frames);
+    }
+    free(sampler->stacks);
+    free(sampler);
+}
+
+static u32 hash_frames(const CallFrame* frames, int depth) {
+    // FNV-1a over what names a frame
+    u32 hash = 2166136261u;
+    for(int i = 0; i < depth; i++) {
+        hash = (hash ^ frames[i].entry) * 16777619u;
+        hash = (hash ^ frames[i].kind) * 16777619u;
+    }
+    return hash;
+}
+
+static bool same_frames(const SampledStack* stack, const CallFrame* frames, int depth, u32 hash) {
+    if(stack->hash != hash || stack->depth != depth) {
+        return false;
+    }
+    for(int i = 0; i < depth; i++) {
+        if(stack->frames[i].entry != frames[i].entry || stack->frames[i].kind != frames[i].kind) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The slot holding frames, or the empty one where they go, in an open addressed table
+static SampledStack* find(SampledStack* stacks, int capacity, const CallFrame* frames, int depth, u32 hash) {
+    for(int i = hash & (capacity - 1);; i = (i + 1) & (capacity - 1)) {
+        if(stacks[i].samples == 0 || same_frames(&stacks[i], frames, depth, hash)) {
+            return &stacks[i];
+        }
+    }
+}
+
+static void grow(Sampler* sampler) {
+    int capacity = sampler->capacity * 2;
+    SampledStack* stacks = calloc(capacity, sizeof(SampledStack));
+    for(int i = 0; i < sampler->capacity; i++) {
+        SampledStack* stack = &sampler->stacks[i];
+        if(stack->samples > 0) {
+            *find(stacks, capacity, stack->frames, stack->depth, stack->hash) = *stack;
+        }
+    }
+    free(sampler->stacks);
+    sampler->stacks = stacks;
+    sampler->capacity = capacity;
+}
+
+static void record(Sampler* sampler, const CallStack* calls) {
+    int depth = calls != NULL ? calls->depth : 0;
+    const CallFrame* frames = calls != NULL ? calls->frames : NULL;
+    u32 hash = hash_frames(frames, depth);
+    SampledStack* stack = find(sampler->stacks, sampler->capacity, frames, depth, hash);
+    if(stack->samples == 0) {
+        stack->frames = malloc((depth + 1) * sizeof(CallFrame));
+        if(depth > 0) {
+            memcpy(stack->frames, frames, depth * sizeof(CallFrame));
+        }
+        stack->depth = depth;
+        stack->hash = hash;
+        sampler->count++;
+    }
+    stack->samples++;
+    sampler->samples++;
+    if(sampler->count * 4 > sampler->capacity * 3) {
+        grow(sampler);
+    }
+}
+
+static void take_sample(CPU* cpu, void* context, u64 when) {
+    Sampler* sampler = context;
+    record(sampler, cpu->call_stack);
+    scheduler_add(cpu->scheduler, when + sampler->period, take_sample, sampler);
+}
+
+/*
+    Starts sampling cpu, which must have a scheduler, a period from now. The CPU keeps a call
+    stack from here on, so subroutines it is already in when sampling starts are not seen.
+*/
+bool sampler_start(Sampler* sampler, CPU* cpu) {
+    if(cpu->scheduler == NULL) {
+        return false;
+    }
+    if(cpu->call_stack == NULL) {
+        cpu->call_stack = malloc(sizeof(CallStack));
+        memset(cpu->call_stack, 0, sizeof(CallStack));
+    }
+    scheduler_add(cpu->scheduler, cpu->clock + sampler->period, take_sample, sampler);
+    return true;
+}
+
+// Stops sampling cpu, which goes on keeping its call stack for the next sampler_start
+void sampler_stop(Sampler* sampler, CPU* cpu) {
+    scheduler_cancel(cpu->scheduler, take_sample, sampler);
+}
+
+static int most_samples_first(const void* a, const void* b) {
+    const SampledStack* x = *(const SampledStack* const*)a;
+    const SampledStack* y = *(const SampledStack* const*)b;
+    if(x->samples != y->samples) {
+        return x->samples < y->samples ? 1 : -1;
+    }
+    return x->hash < y->hash ? -1 : x->hash > y->hash;
+}
+
+/*
+    Writes one line per distinct stack, outermost frame first, in the collapsed format
+    flamegraph.pl reads: "main;sub_8000;irq_F000 42". Code outside any subroutine is main,
+    frames are named after how they were entered and their entry address.
+*/
+void sampler_write_collapsed(const Sampler* sampler, FILE* out) {
+    const SampledStack** sorted = malloc((sampler->count + 1) * sizeof(SampledStack*));
+    int count = 0;
+    for(int i = 0; i < sampler->capacity; i++) {
+        if(sampler->stacks[i].samples > 0) {
+            sorted[count++] = &sampler->stacks[i];
+        }
+    }
+    qsort(sorted, count, sizeof(SampledStack*), most_samples_first);
+
+    for(int i = 0; i < count; i++) {
+        const SampledStack* stack = sorted[i];
+        fprintf(out, "main");
+        for(int f = 0; f < stack->depth; f++) {
+            fprintf(out, ";%s_%04X", frame_prefixes[stack->frames[f].kind], stack->frames[f].entry);
+        }
+        fprintf(out, " %llu\n", (unsigned long long)stack->samples);
+    }
+    free(sorted);
+}
@@ -0,0 +1,41 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include "types.h"
+#include "cpu.h"
+#include "call_stack.h"
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#define SAMPLER_INITIAL_SIZE 64
+
+// A distinct call stack seen by the sampler and how many samples found the CPU in it
+typedef struct SampledStack {
+    CallFrame* frames;
+    int depth;
+    u32 hash;
+    u64 samples;
+} SampledStack;
+
+/*
+    Samples the call stack of a CPU every period cycles, counting each distinct stack once,
+    for flame graphs of guest code. Samples are events on the CPU's scheduler, so the engines
+    run undisturbed between them and sampling costs nothing per instruction; only JSR, RTS,
+    interrupts and RTI keep the call stack. A sample is taken at the first instruction
+    boundary at or after its cycle, like any event.
+*/
+typedef struct Sampler {
+    int period;
+    SampledStack* stacks;
+    int count;
+    int capacity;
+    u64 samples;
+} Sampler;
+
+Sampler* sampler_create(int);
+void sampler_destroy(Sampler*);
+bool sampler_start(Sampler*, CPU*);
+void sampler_stop(Sampler*, CPU*);
+void sampler_write_collapsed(const Sampler*, FILE*);
+
+#endif
@@ -0,0 +1,100 @@
+#include <stdlib.h>
+#include <string.h>
+#include "scheduler.h"
+
+Scheduler* scheduler_create(void) {
+    Scheduler* scheduler = malloc(sizeof(Scheduler));
+    memset(scheduler, 0, sizeof(Scheduler));
+    scheduler->capacity = SCHEDULER_INITIAL_SIZE;
+    scheduler->events = malloc(scheduler->capacity * sizeof(SchedulerEvent));
+    return scheduler;
+}
+
+void scheduler_destroy(Scheduler* scheduler) {
+    free(scheduler->events);
+    free(scheduler);
+}
+
+static bool earlier(const SchedulerEvent* a, const SchedulerEvent* b) {
+    return a->when < b->when || (a->when == b->when && a->order < b->order);
+}
+
+static void sift_up(Scheduler* scheduler, int index) {
+    SchedulerEvent event = scheduler->events[index];
+    while(index > 0) {
+        int parent = (index - 1) / 2;
+        if(!earlier(&event, &scheduler->events[parent])) {
+            break;
+        }
+        scheduler->events[index] = scheduler->events[parent];
+        index = parent;
+    }
+    scheduler->events[index] = event;
+}
+
+static void sift_down(Scheduler* scheduler, int index) {
+    SchedulerEvent event = scheduler->events[index];
+    for(;;) {
+        int child = 2 * index + 1;
+        if(child >= scheduler->count) {
+            break;
+        }
+        if(child + 1 < scheduler->count && earlier(&scheduler->events[child + 1], &scheduler->events[child])) {
+            child++;
+        }
+        if(!earlier(&scheduler->events[child], &event)) {
+            break;
+        }
+        scheduler->events[index] = scheduler->events[child];
+        index = child;
+    }
+    scheduler->events[index] = event;
+}
+
+// Removes the event at index, moving the last one into its place
+static void remove_at(Scheduler* scheduler, int index) {
+    scheduler->count--;
+    if(index == scheduler->count) {
+        return;
+    }
+    scheduler->events[index] = scheduler->events[scheduler->count];
+    sift_down(scheduler, index);
+    sift_up(scheduler, index);
+}
+
+// Schedules fire(cpu, context, when) for cycle when; an event already due fires at the next chance
+void scheduler_add(Scheduler* scheduler, u64 when, SchedulerCallback fire, void* context) {
+    if(scheduler->count == scheduler->capacity) {
+        scheduler->capacity *= 2;
+        scheduler->events = realloc(scheduler->events, scheduler->capacity * sizeof(SchedulerEvent));
+    }
+    scheduler->events[scheduler->count] = (SchedulerEvent){ when, scheduler->next_order++, fire, context };
+    scheduler->count++;
+    sift_up(scheduler, scheduler->count - 1);
+}
+
+// Removes the earliest pending event with this callback and context, false if there is none
+bool scheduler_cancel(Scheduler* scheduler, SchedulerCallback fire, void* context) {
+    int found = -1;
+    for(int i = 0; i < scheduler->count; i++) {
+        SchedulerEvent* event = &scheduler->events[i];
+        if(event->fire == fire && event->context == context && (found < 0 || earlier(event, &scheduler->events[found]))) {
+            found = i;
+        }
+    }
+    if(found < 0) {
+        return false;
+    }
+    remove_at(scheduler, found);
+    return true;
+}
+
+// Fires, in order, every event due at or before cpu->clock, including those the callbacks add
+void scheduler_fire_due(Scheduler* scheduler, CPU* cpu) {
+    while(scheduler->count > 0 && scheduler->events[0].when <= cpu->clock) {
+        SchedulerEvent event = scheduler->events[0];
+        remove_at(scheduler, 0);
+        scheduler->fired++;
+        event.fire(cpu, event.context, event.when);
+    }
+}
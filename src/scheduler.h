@@ -0,0 +1,44 @@
+#include <stdbool.h>
+#include "types.h"
+#include "cpu.h"
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#define SCHEDULER_INITIAL_SIZE 16
+
+// Called with the CPU, the context it was added with and the cycle it was due
+typedef void (*SchedulerCallback)(CPU*, void*, u64);
+
+typedef struct SchedulerEvent {
+    u64 when;
+    u64 order;
+    SchedulerCallback fire;
+    void* context;
+} SchedulerEvent;
+
+/*
+    Events due at absolute cycles of cpu->clock, kept as a binary min-heap on when, with
+    events due together firing in the order they were added. A CPU whose scheduler field
+    points here runs uninterrupted up to the next event, fires every event that is due and
+    carries on, so devices cost nothing between their events. An event fires at the first
+    instruction boundary at or after its cycle; cpu->clock tells how late that was.
+
+    Callbacks may add and cancel events, such as their own next occurrence. Events added by
+    a device while the CPU runs are only seen at the end of the current slice.
+*/
+typedef struct Scheduler {
+    SchedulerEvent* events;
+    int count;
+    int capacity;
+    u64 next_order;
+    unsigned long long fired;
+} Scheduler;
+
+Scheduler* scheduler_create(void);
+void scheduler_destroy(Scheduler*);
+void scheduler_add(Scheduler*, u64, SchedulerCallback, void*);
+bool scheduler_cancel(Scheduler*, SchedulerCallback, void*);
+void scheduler_fire_due(Scheduler*, CPU*);
+
+#endif
@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <string.h>
+#include "snapshot.h"
+#include "block_cache.h"
+
+// Generations are unique across all CPUs and threads, so a snapshot never matches memory it was not taken from
+static u32 next_generation = 1;
+
+Snapshot* snapshot_create(void) {
+    Snapshot* snapshot = malloc(sizeof(Snapshot));
+    snapshot->cpu = NULL;
+    snapshot->generation = 0;
+    snapshot->size = 0;
+    snapshot->pages_copied = 0;
+    return snapshot;
+}
+
+void snapshot_destroy(Snapshot* snapshot) {
+    free(snapshot);
+}
+
+static bool is_current(Snapshot* snapshot, CPU* cpu) {
+    return snapshot->cpu == cpu && snapshot->generation == cpu->memory.snapshot_generation;
+}
+
+// Calls copy_page for every page of RAM, or only for the dirty ones when incremental
+static void for_each_page(CPU* cpu, int size, bool incremental, void (*copy_page)(Snapshot*, CPU*, int), Snapshot* snapshot) {
+    int pages = size / MEMORY_PAGE_SIZE;
+    for(int word = 0; word < MEMORY_PAGES / 32; word++) {
+        u32 dirty = incremental ? cpu->memory.snapshot_dirty_pages[word] : ~0u;
+        while(dirty != 0) {
+            int page = word * 32 + __builtin_ctz(dirty);
+            dirty &= dirty - 1;
+            if(page < pages) {
+                copy_page(snapshot, cpu, page);
+                snapshot->pages_copied++;
+            }
+        }
+        cpu->memory.snapshot_dirty_pages[word] = 0;
+    }
+}
+
+static void save_page(Snapshot* snapshot, CPU* cpu, int page) {
+    memcpy(snapshot->data + page * MEMORY_PAGE_SIZE, cpu->memory.data + page * MEMORY_PAGE_SIZE, MEMORY_PAGE_SIZE);
+}
+
+static void load_page(Snapshot* snapshot, CPU* cpu, int page) {
+    memcpy(cpu->memory.data + page * MEMORY_PAGE_SIZE, snapshot->data + page * MEMORY_PAGE_SIZE, MEMORY_PAGE_SIZE);
+    // The restored page may hold code, and the next reset has to zero it
+    cpu->memory.dirty_pages[page >> 5] |= 1u << (page & 31);
+    if(cpu->block_cache != NULL) {
+        block_cache_invalidate(cpu->block_cache, page << 8);
+    }
+}
+
+void snapshot_take(Snapshot* snapshot, CPU* cpu) {
+    for_each_page(cpu, cpu->memory.SIZE_IN_BYTES, is_current(snapshot, cpu), save_page, snapshot);
+
+    snapshot->cpu = cpu;
+    snapshot->generation = __atomic_fetch_add(&next_generation, 1, __ATOMIC_RELAXED);
+    cpu->memory.snapshot_generation = snapshot->generation;
+    snapshot->size = cpu->memory.SIZE_IN_BYTES;
+    snapshot->program_counter = cpu->program_counter;
+    snapshot->stack_pointer = cpu->stack_pointer;
+    snapshot->accumulator = cpu->accumulator;
+    snapshot->idx_reg_x = cpu->idx_reg_x;
+    snapshot->idx_reg_y = cpu->idx_reg_y;
+    snapshot->flags = cpu->flags;
+}
+
+// The snapshot must have been taken, from cpu or from a CPU with at least as much RAM
+void snapshot_restore(Snapshot* snapshot, CPU* cpu) {
+    int size = snapshot->size < cpu->memory.SIZE_IN_BYTES ? snapshot->size : cpu->memory.SIZE_IN_BYTES;
+    for_each_page(cpu, size, is_current(snapshot, cpu), load_page, snapshot);
+
+    // Memory matches the snapshot again, so the next restore of it can be incremental
+    snapshot->cpu = cpu;
+    cpu->memory.snapshot_generation = snapshot->generation;
+    cpu->program_counter = snapshot->program_counter;
+    cpu->stack_pointer = snapshot->stack_pointer;
+    cpu->accumulator = snapshot->accumulator;
+    cpu->idx_reg_x = snapshot->idx_reg_x;
+    cpu->idx_reg_y = snapshot->idx_reg_y;
+    cpu->flags = snapshot->flags;
+}
@@ -0,0 +1,35 @@
+#include <stddef.h>
+#include "types.h"
+#include "cpu.h"
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/*
+    Registers, flags and RAM of a CPU at one point in time. Snapshots are incremental: taking or
+    restoring one copies only the pages written since the CPU's last snapshot, as recorded in
+    snapshot_dirty_pages. That only holds for the snapshot taken or restored most recently on
+    its CPU; using any other snapshot copies all of RAM.
+
+    Only data is saved. ROM, device state and RAM mapped from other host buffers are not.
+*/
+typedef struct Snapshot {
+    const CPU* cpu;
+    u32 generation;
+    Word program_counter;
+    Byte stack_pointer;
+    Byte accumulator;
+    Byte idx_reg_x;
+    Byte idx_reg_y;
+    Flags flags;
+    int size;
+    unsigned long long pages_copied;
+    Byte data[MEMORY_ADDRESS_SPACE];
+} Snapshot;
+
+Snapshot* snapshot_create(void);
+void snapshot_destroy(Snapshot*);
+void snapshot_take(Snapshot*, CPU*);
+void snapshot_restore(Snapshot*, CPU*);
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "trace.h"
+
+TraceRing* trace_create(void) {
+    TraceRing* ring = malloc(sizeof(TraceRing));
+    memset(ring, 0, sizeof(TraceRing));
+    return ring;
+}
+
+void trace_destroy(TraceRing* ring) {
+    free(ring);
+}
+
+/*
+    Copies the records in ring to out, oldest first, and returns how many there were. out must
+    hold TRACE_RING_RECORDS. Records the CPU wrote over while they were being copied are left
+    out, so this is safe from another thread while the CPU runs.
+*/
+int trace_copy(const TraceRing* ring, TraceRecord* out) {
+    u64 written = __atomic_load_n(&ring->written, __ATOMIC_ACQUIRE);
+    u64 first = written > TRACE_RING_RECORDS ? written - TRACE_RING_RECORDS : 0;
+    for(u64 n = first; n < written; n++) {
+        out[n - first] = ring->records[n & (TRACE_RING_RECORDS - 1)];
+    }
+
+    u64 now = __atomic_load_n(&ring->written, __ATOMIC_ACQUIRE);
+    // The writer fills slot now - 1 before publishing now, so one more may be torn
+    u64 overwritten = now + 1 > TRACE_RING_RECORDS ? now + 1 - TRACE_RING_RECORDS : 0;
+    if(overwritten <= first) {
+        return written - first;
+    }
+    if(overwritten >= written) {
+        return 0;
+    }
+    memmove(out, out + (overwritten - first), (written - overwritten) * sizeof(TraceRecord));
+    return written - overwritten;
+}
+
+static bool write_all(int file, const void* bytes, size_t size) {
+    const char* cursor = bytes;
+    while(size > 0) {
+        ssize_t done = write(file, cursor, size);
+        if(done <= 0) {
+            return false;
+        }
+        cursor += done;
+        size -= done;
+    }
+    return true;
+}
+
+/*
+    Writes the records in ring, oldest first, behind a TraceFileHeader to an open file. clock
+    is the CPU's clock when it stopped. Only write is called, so a signal handler may use this
+    on the thread that was running the CPU.
+*/
+bool trace_save(const TraceRing* ring, u64 clock, int file) {
+    u64 written = ring->written;
+    int count = written < TRACE_RING_RECORDS ? written : TRACE_RING_RECORDS;
+    int oldest = (written - count) & (TRACE_RING_RECORDS - 1);
+    int before_wrap = count < TRACE_RING_RECORDS - oldest ? count : TRACE_RING_RECORDS - oldest;
+
+    TraceFileHeader header = { TRACE_FILE_MAGIC, TRACE_FILE_VERSION, sizeof(TraceRecord), count, 0, clock };
+    return write_all(file, &header, sizeof(header))
+        && write_all(file, &ring->records[oldest], before_wrap * sizeof(TraceRecord))
+        && write_all(file, &ring->records[0], (count - before_wrap) * sizeof(TraceRecord));
+}
+
+/*
+    Reads a file written by trace_save, NULL if it cannot be read or is not a trace. Returns
+    the records, to be freed by the caller, with their count and the clock saved with them.
+*/
+TraceRecord* trace_load(const char* path, int* count, u64* clock) {
+    FILE* file = fopen(path, "rb");
+    if(file == NULL) {
+        return NULL;
+    }
+
+    TraceFileHeader header;
+    TraceRecord* records = NULL;
+    if(fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, TRACE_FILE_MAGIC, sizeof(header.magic)) == 0
+            && header.version == TRACE_FILE_VERSION && header.record_size == sizeof(TraceRecord)
+            && header.count <= TRACE_RING_RECORDS) {
+        records = malloc((header.count + 1) * sizeof(TraceRecord));
+        if(fread(records, sizeof(TraceRecord), header.count, file) == header.count) {
+            *count = header.count;
+            *clock = header.clock;
+        } else {
+            free(records);
+            records = NULL;
+        }
+    }
+    fclose(file);
+    return records;
+}
+
+// Prints record as one disassembled instruction a line, with its full clock and the registers and flags it started with
+void trace_print_record(FILE* out, const TraceRecord* record, u64 clock) {
+    Byte bytes[3] = { record->opcode, record->operand & 0xFF, record->operand >> 8 };
+    char text[32];
+    Word address = trace_address(record);
+    int length = opcode_disassemble(address, bytes, text, sizeof(text));
+
+    char hex[9] = "";
+    for(int b = 0, at = 0; b < length; b++) {
+        at += snprintf(hex + at, sizeof(hex) - at, b == 0 ? "%02X" : " %02X", bytes[b]);
+    }
+    fprintf(out, "%12llu  %04X  %-8s  %-14s  A:%02X X:%02X Y:%02X SP:%02X P:%02X\n",
+            (unsigned long long)clock, address, hex, text,
+            record->accumulator, record->idx_reg_x, record->idx_reg_y, record->stack_pointer, record->status);
+}
+
+/*
+    Prints records, oldest first, with trace_print_record. clock is a full clock near the last
+    record, such as the CPU's when it stopped, from which the full clock of every record is
+    rebuilt. Interrupts taken and passes of a spinning loop skipped ahead show as gaps in the
+    clock.
+*/
+void trace_print(FILE* out, const TraceRecord* records, int count, u64 clock) {
+    if(count == 0) {
+        return;
+    }
+
+    // A CPU that has not caught up with its running engine may be behind the last record
+    u64* clocks = malloc(count * sizeof(u64));
+    clocks[count - 1] = clock + (int)(records[count - 1].clock - (u32)clock);
+    for(int i = count - 2; i >= 0; i--) {
+        clocks[i] = clocks[i + 1] - (u32)(records[i + 1].clock - records[i].clock);
+    }
+    for(int i = 0; i < count; i++) {
+        trace_print_record(out, &records[i], clocks[i]);
+    }
+    free(clocks);
+}
+
+// Prints the last count instructions cpu ran, or all it has kept for a negative count
+void trace_dump(CPU* cpu, FILE* out, int count) {
+    if(cpu->trace == NULL) {
+        fprintf(out, "no trace, build with TRACE=ON\n");
+        return;
+    }
+    TraceRecord* records = malloc(TRACE_RING_RECORDS * sizeof(TraceRecord));
+    int copied = trace_copy(cpu->trace, records);
+    int skipped = count >= 0 && count < copied ? copied - count : 0;
+    trace_print(out, records + skipped, copied - skipped, cpu->clock);
+    free(records);
+}
+
+static CPU* crash_cpu = NULL;
+static char crash_path[4096];
+static const int crash_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+
+static void save_on_crash(int signal_number) {
+    int file = open(crash_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(file >= 0) {
+        trace_save(crash_cpu->trace, crash_cpu->clock, file);
+        close(file);
+    }
+    // The default action then ends the process as it would have without the handler
+    signal(signal_number, SIG_DFL);
+    raise(signal_number);
+}
+
+/*
+    Saves the trace of cpu to path if the process crashes, for tracedump to read. Only one CPU
+    is saved, the one given last. Does nothing in builds without a trace.
+*/
+void trace_dump_on_crash(CPU* cpu, const char* path) {
+    if(cpu->trace == NULL || strlen(path) >= sizeof(crash_path)) {
+        return;
+    }
+    crash_cpu = cpu;
+    strcpy(crash_path, path);
+    for(size_t i = 0; i < sizeof(crash_signals) / sizeof(crash_signals[0]); i++) {
+        signal(crash_signals[i], save_on_crash);
+    }
+}
@@ -0,0 +1,112 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "types.h"
+#include "cpu.h"
+#include "opcodes.h"
+
+#ifndef TRACE_H
+#define TRACE_H
+
+// Records kept per CPU, a power of two
+#define TRACE_RING_RECORDS 4096
+
+#define TRACE_FILE_MAGIC "6502TRC"
+#define TRACE_FILE_VERSION 1
+
+/*
+    One instruction as it was about to run: its bytes, the registers and flags before it and
+    the low 32 bits of the clock at its first cycle. Consecutive records are never 2^32 cycles
+    apart, so full clocks are rebuilt backwards from a later one. program_counter is where the
+    instruction's operand ended, which the dispatch loops have at hand, see trace_address.
+*/
+typedef struct TraceRecord {
+    u32 clock;
+    Word program_counter;
+    Byte opcode;
+    Byte status;
+    Word operand;
+    // In the order CPU keeps them, to be copied in one go
+    Byte stack_pointer;
+    Byte accumulator;
+    Byte idx_reg_x;
+    Byte idx_reg_y;
+    Byte unused[2];
+} TraceRecord;
+
+/*
+    The last TRACE_RING_RECORDS instructions a CPU ran, in builds with CPU_TRACE_ON. Every
+    interpreter records into it from cpu_run; the JIT is not built, and batch lanes and AOT
+    translated code are not traced. Only the CPU's own thread writes: it fills the slot for
+    record number written and then publishes written + 1, so any thread can take a copy with
+    trace_copy while the CPU runs, and a signal handler can save it with trace_save.
+*/
+typedef struct TraceRing {
+    TraceRecord records[TRACE_RING_RECORDS];
+    u64 written;
+    // Where records go as each half of the ring fills, NULL for nowhere, see trace_sink.h
+    struct TraceSink* sink;
+} TraceRing;
+
+void trace_sink_take(TraceRing*, u64);
+
+// What trace_save writes ahead of the records, which follow oldest first
+typedef struct TraceFileHeader {
+    char magic[8];
+    u32 version;
+    u32 record_size;
+    u32 count;
+    u32 unused;
+    // The clock at the instruction after the last record
+    u64 clock;
+} TraceFileHeader;
+
+// Where the instruction in record starts
+static inline Word trace_address(const TraceRecord* record) {
+    return record->program_counter - opcode_length(record->opcode);
+}
+
+#if CPU_TRACE == CPU_TRACE_ON
+
+/*
+    Records the instruction whose operand was just fetched, cycles after cpu->trace_clock.
+    Dispatch loops pass the cycles they have completed since cpu_set_budget, and only move
+    trace_clock on when they give up the count, which saves a store per instruction.
+*/
+static inline void trace_instruction(CPU* cpu, Byte opcode, Word operand, int cycles) {
+    TraceRing* ring = cpu->trace;
+    u64 written = ring->written;
+    TraceRecord* record = &ring->records[written & (TRACE_RING_RECORDS - 1)];
+    record->clock = (u32)(cpu->trace_clock + cycles);
+    record->program_counter = cpu->program_counter;
+    record->opcode = opcode;
+    record->status = flags_to_byte(&cpu->flags, false);
+    record->operand = operand;
+    memcpy(&record->stack_pointer, &cpu->stack_pointer, 4);
+    __atomic_store_n(&ring->written, written + 1, __ATOMIC_RELEASE);
+    if(__builtin_expect(((written + 1) & (TRACE_RING_RECORDS / 2 - 1)) == 0 && ring->sink != NULL, 0)) {
+        trace_sink_take(ring, cpu->trace_clock + cycles);
+    }
+}
+
+#define TRACE_INSTRUCTION(cpu, opcode, operand, cycles) trace_instruction(cpu, opcode, operand, cycles)
+#define TRACE_CYCLES(cpu, c) ((cpu)->trace_clock += (c))
+
+#else
+
+#define TRACE_INSTRUCTION(cpu, opcode, operand, cycles) ((void)0)
+#define TRACE_CYCLES(cpu, c) ((void)0)
+
+#endif
+
+TraceRing* trace_create(void);
+void trace_destroy(TraceRing*);
+int trace_copy(const TraceRing*, TraceRecord*);
+bool trace_save(const TraceRing*, u64, int);
+TraceRecord* trace_load(const char*, int*, u64*);
+void trace_print_record(FILE*, const TraceRecord*, u64);
+void trace_print(FILE*, const TraceRecord*, int, u64);
+void trace_dump(CPU*, FILE*, int);
+void trace_dump_on_crash(CPU*, const char*);
+
+#endif
@@ -0,0 +1,394 @@
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "trace_sink.h"
+
+#define TRACE_SINK_QUEUE_SLOTS (TRACE_SINK_BATCHES + 1)
+
+// Called from one thread only
+static bool queue_push(TraceBatchQueue* queue, TraceBatch* batch) {
+    u32 tail = queue->tail;
+    u32 next = (tail + 1) % TRACE_SINK_QUEUE_SLOTS;
+    if(next == __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+    queue->batches[tail] = batch;
+    __atomic_store_n(&queue->tail, next, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Called from one other thread only, NULL if the queue is empty
+static TraceBatch* queue_pop(TraceBatchQueue* queue) {
+    u32 head = queue->head;
+    if(head == __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    TraceBatch* batch = queue->batches[head];
+    __atomic_store_n(&queue->head, (head + 1) % TRACE_SINK_QUEUE_SLOTS, __ATOMIC_RELEASE);
+    return batch;
+}
+
+static void flush_buffer(TraceSink* sink) {
+    if(sink->used > 0 && fwrite(sink->buffer, 1, sink->used, sink->file) != (size_t)sink->used) {
+        sink->failed = true;
+    }
+    sink->offset += sink->used;
+    sink->used = 0;
+}
+
+// Room for the longest encoding of a record, a keyframe
+#define TRACE_STREAM_MAX_RECORD (1 + sizeof(u64) + sizeof(TraceRecord))
+
+// Makes room in the buffer for size more bytes
+static void make_room(TraceSink* sink, int size) {
+    if(sink->used + size > TRACE_SINK_BUFFER_SIZE) {
+        flush_buffer(sink);
+    }
+}
+
+static Byte* put_varint(Byte* at, u32 value) {
+    while(value >= 0x80) {
+        *at++ = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    *at++ = value;
+    return at;
+}
+
+static void add_keyframe(TraceSink* sink, const TraceRecord* record, u64 clock) {
+    if(sink->index_count == sink->index_capacity) {
+        sink->index_capacity = sink->index_capacity == 0 ? 64 : sink->index_capacity * 2;
+        sink->index = realloc(sink->index, sink->index_capacity * sizeof(TraceIndexEntry));
+    }
+    sink->index[sink->index_count++] = (TraceIndexEntry){ sink->records, sink->offset + sink->used, clock };
+
+    Byte* at = sink->buffer + sink->used;
+    *at = TRACE_STREAM_KEYFRAME;
+    memcpy(at + 1, &clock, sizeof(clock));
+    memcpy(at + 1 + sizeof(clock), record, sizeof(TraceRecord));
+    sink->used += TRACE_STREAM_MAX_RECORD;
+}
+
+// Encodes record against the last one, see TRACE_STREAM_KEYFRAME
+static void encode_record(TraceSink* sink, const TraceRecord* record, u64 clock, bool keyframe) {
+    const TraceRecord* last = &sink->last;
+    make_room(sink, TRACE_STREAM_MAX_RECORD);
+    if(keyframe || sink->records % TRACE_SINK_KEYFRAME_INTERVAL == 0) {
+        add_keyframe(sink, record, clock);
+    } else {
+        int jump = (int16_t)(trace_address(record) - last->program_counter);
+        u32 cycles = record->clock - last->clock;
+        Byte flags = (record->accumulator != last->accumulator ? TRACE_STREAM_ACCUMULATOR : 0)
+            | (record->idx_reg_x != last->idx_reg_x ? TRACE_STREAM_IDX_REG_X : 0)
+            | (record->idx_reg_y != last->idx_reg_y ? TRACE_STREAM_IDX_REG_Y : 0)
+            | (record->stack_pointer != last->stack_pointer ? TRACE_STREAM_STACK_POINTER : 0)
+            | (record->status != last->status ? TRACE_STREAM_STATUS : 0)
+            | (jump != 0 ? TRACE_STREAM_JUMPED : 0)
+            | (cycles != opcode_cycles[last->opcode] ? TRACE_STREAM_CLOCK : 0);
+
+        Byte* at = sink->buffer + sink->used;
+        *at++ = flags;
+        *at++ = record->opcode;
+        int length = opcode_length(record->opcode);
+        if(length > 1) {
+            *at++ = record->operand & 0xFF;
+        }
+        if(length > 2) {
+            *at++ = record->operand >> 8;
+        }
+        const Byte registers[] = { record->accumulator, record->idx_reg_x, record->idx_reg_y, record->stack_pointer, record->status };
+        for(int i = 0; i < 5; i++) {
+            if(flags & (1 << i)) {
+                *at++ = registers[i];
+            }
+        }
+        if(flags & TRACE_STREAM_JUMPED) {
+            at = put_varint(at, jump < 0 ? ((u32)-jump << 1) - 1 : (u32)jump << 1);
+        }
+        if(flags & TRACE_STREAM_CLOCK) {
+            at = put_varint(at, cycles);
+        }
+        sink->used = at - sink->buffer;
+    }
+    sink->last = *record;
+    sink->last_clock = clock;
+    sink->records++;
+}
+
+static void encode_batch(TraceSink* sink, TraceBatch* batch) {
+    // Full clocks are rebuilt backwards from the last, as in trace_print
+    u64 clocks[TRACE_SINK_BATCH_RECORDS];
+    clocks[batch->count - 1] = batch->clock;
+    for(int i = batch->count - 2; i >= 0; i--) {
+        clocks[i] = clocks[i + 1] - (u32)(batch->records[i + 1].clock - batch->records[i].clock);
+    }
+    for(int i = 0; i < batch->count; i++) {
+        encode_record(sink, &batch->records[i], clocks[i], i == 0 && (batch->after_gap || sink->records == 0));
+    }
+}
+
+static void* write_batches(void* context) {
+    TraceSink* sink = context;
+    for(;;) {
+        sem_wait(&sink->filled);
+        TraceBatch* batch = queue_pop(&sink->queue);
+        if(batch == NULL) {
+            // Only trace_sink_close posts without a batch, once every batch is queued
+            break;
+        }
+        encode_batch(sink, batch);
+        queue_push(&sink->free, batch);
+    }
+
+    flush_buffer(sink);
+    TraceStreamTrailer trailer = { sink->offset, sink->index_count, sink->records, sink->dropped, TRACE_STREAM_MAGIC };
+    if(fwrite(sink->index, sizeof(TraceIndexEntry), sink->index_count, sink->file) != sink->index_count
+            || fwrite(&trailer, sizeof(trailer), 1, sink->file) != 1) {
+        sink->failed = true;
+    }
+    return NULL;
+}
+
+/*
+    Starts streaming the trace of cpu to a new file at path, from the next instruction it
+    runs. NULL if the file cannot be created or cpu has no trace (a build without TRACE=ON).
+*/
+TraceSink* trace_sink_open(CPU* cpu, const char* path) {
+    if(cpu->trace == NULL) {
+        return NULL;
+    }
+    FILE* file = fopen(path, "wb");
+    if(file == NULL) {
+        return NULL;
+    }
+    // Writes go out a TRACE_SINK_BUFFER_SIZE buffer at a time already
+    setvbuf(file, NULL, _IONBF, 0);
+
+    TraceSink* sink = malloc(sizeof(TraceSink));
+    memset(sink, 0, sizeof(TraceSink));
+    sink->cpu = cpu;
+    sink->file = file;
+    sink->buffer = malloc(TRACE_SINK_BUFFER_SIZE);
+    sink->batches = malloc(TRACE_SINK_BATCHES * sizeof(TraceBatch));
+    for(int i = 0; i < TRACE_SINK_BATCHES; i++) {
+        queue_push(&sink->free, &sink->batches[i]);
+    }
+    sem_init(&sink->filled, 0, 0);
+
+    TraceStreamHeader header = { TRACE_STREAM_MAGIC, TRACE_STREAM_VERSION, sizeof(TraceRecord) };
+    memcpy(sink->buffer, &header, sizeof(header));
+    sink->used = sizeof(header);
+
+    sink->taken = cpu->trace->written;
+    cpu->trace->sink = sink;
+    pthread_create(&sink->thread, NULL, write_batches, sink);
+    return sink;
+}
+
+// Hands the records since the last call to the writer, clock being the full clock of the newest
+static void take(TraceSink* sink, TraceRing* ring, u64 clock) {
+    u64 written = ring->written;
+    if(written <= sink->taken) {
+        // Nothing new, or the ring was emptied for a reused CPU
+        sink->taken = written;
+        return;
+    }
+
+    TraceBatch* batch = queue_pop(&sink->free);
+    if(batch == NULL) {
+        sink->dropped += written - sink->taken;
+        sink->taken = written;
+        sink->gap = true;
+        return;
+    }
+    batch->count = written - sink->taken;
+    for(int i = 0; i < batch->count; i++) {
+        batch->records[i] = ring->records[(sink->taken + i) & (TRACE_RING_RECORDS - 1)];
+    }
+    batch->clock = clock;
+    batch->after_gap = sink->gap;
+    sink->gap = false;
+    sink->taken = written;
+    queue_push(&sink->queue, batch);
+    sem_post(&sink->filled);
+}
+
+// Called by the trace hook as each half of the ring fills, see trace_instruction
+void trace_sink_take(TraceRing* ring, u64 clock) {
+    take(ring->sink, ring, clock);
+}
+
+/*
+    Hands over what is left in the ring, waits for the writer to finish the file and closes
+    it. Returns false if any of it could not be written.
+*/
+bool trace_sink_close(TraceSink* sink) {
+    TraceRing* ring = sink->cpu->trace;
+    if(ring->written != sink->taken) {
+        // The CPU has stopped, so its clock is the one after the newest record
+        TraceRecord* newest = &ring->records[(ring->written - 1) & (TRACE_RING_RECORDS - 1)];
+        u64 clock = sink->cpu->clock;
+        take(sink, ring, clock + (int)(newest->clock - (u32)clock));
+    }
+    ring->sink = NULL;
+    sem_post(&sink->filled);
+    pthread_join(sink->thread, NULL);
+
+    bool written = !sink->failed && fclose(sink->file) == 0;
+    sem_destroy(&sink->filled);
+    free(sink->index);
+    free(sink->batches);
+    free(sink->buffer);
+    free(sink);
+    return written;
+}
+
+static bool get_varint(FILE* file, u64* value) {
+    *value = 0;
+    for(int shift = 0; shift < 64; shift += 7) {
+        int c = getc(file);
+        if(c == EOF) {
+            return false;
+        }
+        *value |= (u64)(c & 0x7F) << shift;
+        if(!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Opens a stream written by a TraceSink at its first record, NULL if it is not one
+TraceReader* trace_reader_open(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if(file == NULL) {
+        return NULL;
+    }
+
+    TraceStreamHeader header;
+    TraceStreamTrailer trailer;
+    if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_STREAM_MAGIC, sizeof(header.magic)) != 0
+            || header.version != TRACE_STREAM_VERSION || header.record_size != sizeof(TraceRecord)
+            || fseek(file, -(long)sizeof(trailer), SEEK_END) != 0 || fread(&trailer, sizeof(trailer), 1, file) != 1
+            || memcmp(trailer.magic, TRACE_STREAM_MAGIC, sizeof(trailer.magic)) != 0
+            || fseek(file, trailer.index_offset, SEEK_SET) != 0) {
+        fclose(file);
+        return NULL;
+    }
+
+    TraceReader* reader = malloc(sizeof(TraceReader));
+    memset(reader, 0, sizeof(TraceReader));
+    reader->file = file;
+    reader->index_count = trailer.index_count;
+    reader->records = trailer.records;
+    reader->dropped = trailer.dropped;
+    reader->index = malloc((trailer.index_count + 1) * sizeof(TraceIndexEntry));
+    if(fread(reader->index, sizeof(TraceIndexEntry), trailer.index_count, file) != trailer.index_count
+            || !trace_reader_seek(reader, 0)) {
+        trace_reader_close(reader);
+        return NULL;
+    }
+    return reader;
+}
+
+void trace_reader_close(TraceReader* reader) {
+    fclose(reader->file);
+    free(reader->index);
+    free(reader);
+}
+
+/*
+    Makes record number the next one trace_reader_next returns, decoding on from the keyframe
+    before it. False if there are not that many records.
+*/
+bool trace_reader_seek(TraceReader* reader, u64 record) {
+    if(record > reader->records || reader->index_count == 0) {
+        return record == 0 && reader->records == 0;
+    }
+
+    u64 low = 0;
+    u64 high = reader->index_count;
+    while(high - low > 1) {
+        u64 middle = (low + high) / 2;
+        if(reader->index[middle].record <= record) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    if(fseek(reader->file, reader->index[low].offset, SEEK_SET) != 0) {
+        return false;
+    }
+    reader->next = reader->index[low].record;
+
+    TraceRecord skipped;
+    u64 clock;
+    while(reader->next < record) {
+        if(!trace_reader_next(reader, &skipped, &clock)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Decodes the next record and its full clock, false at the end of the stream
+bool trace_reader_next(TraceReader* reader, TraceRecord* record, u64* clock) {
+    if(reader->next >= reader->records) {
+        return false;
+    }
+    FILE* file = reader->file;
+    int flags = getc(file);
+    if(flags == EOF) {
+        return false;
+    }
+
+    if(flags == TRACE_STREAM_KEYFRAME) {
+        if(fread(clock, sizeof(*clock), 1, file) != 1 || fread(record, sizeof(TraceRecord), 1, file) != 1) {
+            return false;
+        }
+    } else {
+        const TraceRecord* last = &reader->last;
+        *record = *last;
+        int opcode = getc(file);
+        if(opcode == EOF) {
+            return false;
+        }
+        record->opcode = opcode;
+        int length = opcode_length(opcode);
+        Byte operand[2] = { 0, 0 };
+        if(fread(operand, 1, length - 1, file) != (size_t)(length - 1)) {
+            return false;
+        }
+        record->operand = operand[0] | operand[1] << 8;
+
+        Byte* registers[] = { &record->accumulator, &record->idx_reg_x, &record->idx_reg_y, &record->stack_pointer, &record->status };
+        for(int i = 0; i < 5; i++) {
+            if(flags & (1 << i)) {
+                int value = getc(file);
+                if(value == EOF) {
+                    return false;
+                }
+                *registers[i] = value;
+            }
+        }
+
+        u64 jump = 0;
+        u64 cycles = opcode_cycles[last->opcode];
+        if(((flags & TRACE_STREAM_JUMPED) && !get_varint(file, &jump))
+                || ((flags & TRACE_STREAM_CLOCK) && !get_varint(file, &cycles))) {
+            return false;
+        }
+        Word address = last->program_counter + (jump & 1 ? -(int)((jump + 1) >> 1) : (int)(jump >> 1));
+        record->program_counter = address + length;
+        record->clock = last->clock + (u32)cycles;
+        *clock = reader->last_clock + (u32)cycles;
+    }
+
+    reader->last = *record;
+    reader->last_clock = *clock;
+    reader->next++;
+    return true;
+}
@@ -0,0 +1,131 @@
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "types.h"
+#include "cpu.h"
+#include "trace.h"
+
+#ifndef TRACE_SINK_H
+#define TRACE_SINK_H
+
+// Records handed to the writer at a time, half the ring so it never overwrites what is not handed over
+#define TRACE_SINK_BATCH_RECORDS (TRACE_RING_RECORDS / 2)
+// Batches waiting for or being written, beyond which the CPU drops records instead of waiting
+#define TRACE_SINK_BATCHES 64
+#define TRACE_SINK_BUFFER_SIZE (1024 * 1024)
+#define TRACE_SINK_KEYFRAME_INTERVAL 65536
+
+#define TRACE_STREAM_MAGIC "6502TRZ"
+#define TRACE_STREAM_VERSION 1
+
+/*
+    How a record is encoded against the one before it. A keyframe is the full clock and the
+    record as it is; anything else is a flags byte, the opcode and operand, the registers
+    that changed and, where the flags say so, how far the instruction is from where the last
+    one left the program counter (zigzag) and its clock from where the last one's base
+    cycles would have put it. Varints are LEB128.
+*/
+#define TRACE_STREAM_ACCUMULATOR 0x01
+#define TRACE_STREAM_IDX_REG_X 0x02
+#define TRACE_STREAM_IDX_REG_Y 0x04
+#define TRACE_STREAM_STACK_POINTER 0x08
+#define TRACE_STREAM_STATUS 0x10
+#define TRACE_STREAM_JUMPED 0x20
+#define TRACE_STREAM_CLOCK 0x40
+#define TRACE_STREAM_KEYFRAME 0x80
+
+// At the start of a stream, followed by the encoded records
+typedef struct TraceStreamHeader {
+    char magic[8];
+    u32 version;
+    u32 record_size;
+} TraceStreamHeader;
+
+// A record every reader can start decoding from
+typedef struct TraceIndexEntry {
+    u64 record;
+    u64 offset;
+    u64 clock;
+} TraceIndexEntry;
+
+/*
+    At the end of a stream, after the index. dropped counts records the writer could not keep
+    up with; the record after each gap is a keyframe.
+*/
+typedef struct TraceStreamTrailer {
+    u64 index_offset;
+    u64 index_count;
+    u64 records;
+    u64 dropped;
+    char magic[8];
+} TraceStreamTrailer;
+
+typedef struct TraceBatch {
+    TraceRecord records[TRACE_SINK_BATCH_RECORDS];
+    int count;
+    // Full clock of the last record, and whether records were dropped before the first
+    u64 clock;
+    bool after_gap;
+} TraceBatch;
+
+// Batch pointers passed one way between two threads
+typedef struct TraceBatchQueue {
+    TraceBatch* batches[TRACE_SINK_BATCHES + 1];
+    u32 head;
+    u32 tail;
+} TraceBatchQueue;
+
+/*
+    Streams every instruction a traced CPU runs to a file. Each time half the CPU's trace ring
+    fills, its records are copied into a free batch and queued for a writer thread, which
+    encodes them against each other and writes them out a buffer at a time. The CPU never
+    waits for the writer: with no free batch left the records are dropped and counted. The
+    file ends with an index of keyframes, so a TraceReader can start anywhere.
+*/
+typedef struct TraceSink {
+    CPU* cpu;
+    FILE* file;
+    pthread_t thread;
+    sem_t filled;
+    TraceBatchQueue queue;
+    TraceBatchQueue free;
+    TraceBatch* batches;
+    u64 taken;
+    bool gap;
+
+    // Owned by the writer thread
+    Byte* buffer;
+    int used;
+    u64 offset;
+    TraceRecord last;
+    u64 last_clock;
+    u64 records;
+    TraceIndexEntry* index;
+    u64 index_count;
+    u64 index_capacity;
+    bool failed;
+
+    unsigned long long dropped;
+} TraceSink;
+
+typedef struct TraceReader {
+    FILE* file;
+    TraceIndexEntry* index;
+    u64 index_count;
+    u64 records;
+    u64 dropped;
+    u64 next;
+    TraceRecord last;
+    u64 last_clock;
+} TraceReader;
+
+TraceSink* trace_sink_open(CPU*, const char*);
+bool trace_sink_close(TraceSink*);
+
+TraceReader* trace_reader_open(const char*);
+void trace_reader_close(TraceReader*);
+bool trace_reader_seek(TraceReader*, u64);
+bool trace_reader_next(TraceReader*, TraceRecord*, u64*);
+
+#endif
@@ -1,7 +1,9 @@
 // Primitive type defintions
 typedef unsigned char u8;
 typedef unsigned short u16;
-typedef char s8;
+typedef unsigned int u32;
+typedef unsigned long long u64;
+typedef signed char s8;
 
 typedef u8 Byte;
 typedef u16 Word;
@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../src/aot.h"
+
+/*
+    rom2c <image> [origin] [function]
+
+    Translates a raw ROM image loaded at origin (hex, defaults to the image ending at $FFFF)
+    into C source on stdout that defines function (defaults to rom_run).
+*/
+int main(int argc, char** argv) {
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s <image> [origin] [function]\n", argv[0]);
+        return 1;
+    }
+
+    FILE* file = fopen(argv[1], "rb");
+    if(file == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    // One byte more than the address space, so an image too large for it is not cut short
+    static Byte data[0x10000 + 1];
+    int size = fread(data, 1, sizeof(data), file);
+    fclose(file);
+    if(size > 0x10000) {
+        fprintf(stderr, "%s: image of more than 65536 bytes does not fit\n", argv[0]);
+        return 1;
+    }
+
+    long origin = argc > 2 ? strtol(argv[2], NULL, 16) : 0x10000 - size;
+    if(origin < 0 || origin + size > 0x10000) {
+        fprintf(stderr, "%s: image of %d bytes does not fit at $%04lX\n", argv[0], size, origin);
+        return 1;
+    }
+
+    static AotImage image;
+    aot_load(&image, data, size, origin);
+    int instructions = aot_discover(&image);
+    aot_emit(&image, stdout, argc > 3 ? argv[3] : "rom_run");
+    fprintf(stderr, "%s: translated %d instructions\n", argv[0], instructions);
+    return 0;
+}
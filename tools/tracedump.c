@@ -0,0 +1,58 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../src/trace.h"
+#include "../src/trace_sink.h"
+
+/*
+    tracedump <trace> [count] [first]
+
+    Disassembles a trace one instruction a line, with its clock and the registers and flags it
+    started with. For a trace saved by trace_save, such as the one trace_dump_on_crash leaves
+    behind, that is the last count records (default: all). For a stream written by a
+    TraceSink it is count records (default: all) from record number first (default: 0), which
+    is found through the stream's keyframe index rather than by reading up to it.
+*/
+static int dump_stream(const char* name, TraceReader* reader, u64 count, u64 first) {
+    if(!trace_reader_seek(reader, first)) {
+        fprintf(stderr, "%s: the stream has only %llu records\n", name, (unsigned long long)reader->records);
+        return 1;
+    }
+    printf("%llu instructions streamed, %llu left out, from record %llu\n",
+            (unsigned long long)reader->records, (unsigned long long)reader->dropped, (unsigned long long)first);
+    TraceRecord record;
+    u64 clock;
+    for(u64 n = 0; n < count && trace_reader_next(reader, &record, &clock); n++) {
+        trace_print_record(stdout, &record, clock);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s <trace> [count] [first]\n", argv[0]);
+        return 1;
+    }
+
+    TraceReader* reader = trace_reader_open(argv[1]);
+    if(reader != NULL) {
+        u64 count = argc > 2 ? strtoull(argv[2], NULL, 0) : reader->records;
+        int result = dump_stream(argv[0], reader, count, argc > 3 ? strtoull(argv[3], NULL, 0) : 0);
+        trace_reader_close(reader);
+        return result;
+    }
+
+    int count;
+    u64 clock;
+    TraceRecord* records = trace_load(argv[1], &count, &clock);
+    if(records == NULL) {
+        fprintf(stderr, "%s: %s is not a readable trace\n", argv[0], argv[1]);
+        return 1;
+    }
+
+    int shown = argc > 2 ? atoi(argv[2]) : count;
+    int skipped = shown >= 0 && shown < count ? count - shown : 0;
+    printf("%d of %d instructions, stopped at cycle %llu\n", count - skipped, count, clock);
+    trace_print(stdout, records + skipped, count - skipped, clock);
+    free(records);
+    return 0;
+}